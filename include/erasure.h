@@ -0,0 +1,44 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2018 Paul Gardner-Stephen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __LBARD_ERASURE_H
+#define __LBARD_ERASURE_H
+
+// Largest number of packets in a zone. Received packets are tracked in a bitmap.
+#define ERASURE_MAX_ZONE_PACKETS 16
+#define ERASURE_MAX_STRIPE_BYTES 256
+
+struct erasure_zone {
+  // Packets per zone, and how many of them may be lost
+  int packets;
+  int parity;
+  // Bytes per packet of data + parity, and how they are divided
+  int stripe_bytes;
+  int data_bytes;
+  int parity_bytes;
+};
+
+int erasure_zone_setup(struct erasure_zone *z,int packets,int parity,int stripe_bytes);
+int erasure_zone_encode(struct erasure_zone *z,unsigned char *zone_data,
+			unsigned char *zone_parity);
+int erasure_zone_decode(struct erasure_zone *z,unsigned char *zone_data,
+			unsigned char *zone_parity,unsigned int received);
+int erasure_zone_received_count(unsigned int received);
+
+#endif
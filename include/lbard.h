@@ -2,13 +2,17 @@
 
 #define SYNC_MSG_HEADER_LEN 2
 
-// For now we use a fixed link MTU for all radio types for now.
-// For ALE 2G we fragment frames.  We can revise this for ALE 3G large message blocks,
-// and when we implement a better analog modem down the track.
+// Packet size, before FEC, for radio types that don't say what suits them best.
+// Each radio type gives its preferred frame size (see radio_frame_size()), from
+// which the packet size is worked out for the FEC level in use.
 #define LINK_MTU 200
+// Largest packet that fits in a single RS codeword
+#define MAX_LINK_MTU 223
 
 extern struct sync_state *sync_state;
 #define SYNC_SALT_LEN 8
+// SHA1 of the salt-independent inputs to a bundle's sync key
+#define SYNC_DIGEST_LEN 20
 
 #define SERVALD_STOP "/usr/bin/servald stop"
 #define DEFAULT_BROADCAST_ADDRESSES "10.255.255.255","192.168.2.255","192.168.2.1"
@@ -47,6 +51,8 @@ struct segment_list {
   unsigned char *data;
   int start_offset;
   int length;
+  // Data is in the partial's spool file mapping, not malloc()d
+  int spooled;
   struct segment_list *prev,*next;
 };
 
@@ -63,9 +69,12 @@ struct recent_senders {
 struct partial_bundle {
   // Data from the piece headers for keeping track
   char *bid_prefix;
+  unsigned char bid_prefix_bin[8];
   long long bundle_version;
 
   int recent_bytes;
+  // When we last received something new of it (see partial_choose_victim())
+  time_t last_progress_time;
   
   struct segment_list *manifest_segments;
   int manifest_length;
@@ -79,15 +88,64 @@ struct partial_bundle {
   int request_bitmap_start;
   unsigned char request_bitmap[32];
   unsigned char request_manifest_bitmap[2];
+
+  // Decoder for coded ('C') body pieces, if we have received any
+  struct fountain_decoder *fountain;
+
+  // Spool file holding the received bytes, if any (see partial_spool.c)
+  int spool_fd;
+  unsigned char *spool_map;
+  long long spool_map_len;
 };
 
 #define DEFAULT_PEER_KEEPALIVE_INTERVAL 20
 extern int peer_keepalive_interval;
 
+// Slots that a peer can bind bundles to, so that their pieces need only carry the
+// slot number.  'K' + slot + 8 byte BID prefix + 8 byte version.
+#define PIECE_CONTEXT_SLOTS 16
+#define PIECE_CONTEXT_BINDING_LEN (1+1+8+8)
+struct piece_context_rx {
+  unsigned char bid_prefix_bin[8];
+  long long version;
+  int valid;
+};
+
+// How much of a journal bundle a peer is known to hold (see journal.c)
+#define JOURNAL_HELD_SLOTS 8
+struct journal_held {
+  unsigned char bid_prefix_bin[8];
+  long long length;
+  time_t last_time;
+};
+
+// Where we had got to sending a bundle to a peer before something of higher
+// priority displaced it (see tx_resume.c)
+#define TX_RESUME_SLOTS 8
+struct tx_resume {
+  int bundle;
+  long long version;
+  int manifest_offset;
+  int body_offset;
+  int manifest_offset_hard_lower_bound;
+  int body_offset_hard_lower_bound;
+  int coded;
+  // The request bitmap they last sent us for it, if any
+  int have_request_bitmap;
+  int request_bitmap_offset;
+  unsigned char request_bitmap[32];
+  unsigned char request_manifest_bitmap[2];
+  // Zero if the slot is unused
+  time_t last_time;
+};
+
 struct peer_state {
   char *sid_prefix;
   unsigned char sid_prefix_bin[4];
 
+  // One more than our position in active_peers[], or zero if we aren't active
+  int active_slot;
+
   // random 32 bit instance ID, used to work out when LBARD has died and restarted
   // on a peer, so that we can restart the sync process.
   unsigned int instance_id;
@@ -112,6 +170,28 @@ struct peer_state {
   int rssi_log_count;
   int recent_rssis[RSSI_LOG_SIZE];
   long long recent_rssi_times[RSSI_LOG_SIZE];
+
+  // Adaptive FEC. We keep decaying averages of the RS corrections needed, and the
+  // fraction of packets lost, for packets from this peer, and from those work out
+  // the FEC level we would like them to use.  They do the same for us, and tell us
+  // the level they would like us to use.
+  int packets_seen;
+  int fec_error_average;
+  int fec_loss_average;
+  int fec_missed_packets_seen;
+  int fec_level_wanted;
+  int fec_level_requested;
+  time_t fec_level_request_time;
+  // When they last told us that they understand Golay protected packet headers
+  time_t golay_header_time;
+  // Packets that failed FEC decoding, but that we know they sent
+  int fec_failed_packet_count;
+  // When they last told us that they understand compressed piece headers, and
+  // the bundles they have bound to each slot
+  time_t compressed_pieces_time;
+  // ... and run-length progress reports
+  time_t progress_runs_time;
+  struct piece_context_rx piece_context[PIECE_CONTEXT_SLOTS];
   
 #ifdef SYNC_BY_BAR
   // BARs we have seen from them.
@@ -138,21 +218,38 @@ struct peer_state {
   int tx_bundle_manifest_offset_hard_lower_bound;
   int tx_bundle_body_offset_hard_lower_bound;
 
+  // Set once we have sent the whole body of tx_bundle, after which we send coded
+  // body blocks instead of repeating pieces, if fountain_pieces is enabled.
+  int tx_bundle_coded;
+
   // number of http fetch errors for a manifest/payload we tolerate, before
   // discarding this bundle and trying to send the next.
 #define MAX_CACHE_ERRORS 5
   int tx_cache_errors;
 
-  /* Bundles we want to send to this peer
-     In theory, we can have a relatively short queue, since we intend to rebuild the
-     tree periodically. Thus any bundles received will cause the new sync process to
-     not insert those in the TX queue, and thus allow the transfer of the next 
-     MAX_TXQUEUE_LEN highest priority bundles. */
-#define MAX_TXQUEUE_LEN 10
-  int tx_queue_len; 
-  int tx_queue_bundles[MAX_TXQUEUE_LEN];
-  unsigned int tx_queue_priorities[MAX_TXQUEUE_LEN];
-  int tx_queue_overflow;
+  // Journal bundles we know this peer holds some of, and whether we are holding
+  // off sending the body of tx_bundle until we hear how much of it they have.
+  struct journal_held journal_held[JOURNAL_HELD_SLOTS];
+  int tx_bundle_journal_wait;
+
+  // Send progress of bundles that were displaced from tx_bundle
+  struct tx_resume tx_resume[TX_RESUME_SLOTS];
+
+  /* Bundles we want to send to this peer, other than tx_bundle, as a max-heap on
+     priority that grows as required (see tx_queue.c). */
+  int tx_queue_len;
+  int tx_queue_alloc;
+  int *tx_queue_bundles;
+  int *tx_queue_priorities;
+  // One more than each bundle's position in the heap, or zero if not queued
+  int tx_queue_position_alloc;
+  int *tx_queue_position;
+
+  // A bit for each bundle that the sync tree says they lack, and whether they are
+  // currently included in each bundle's num_peers_that_dont_have_it (see rank.c)
+  int lacks_bitmap_bytes;
+  unsigned char *lacks_bitmap;
+  int lacks_counted;
 #endif
 
   /* Bitmaps that we use to keep track of progress of sending a bundle.
@@ -164,6 +261,13 @@ struct peer_state {
   int request_bitmap_offset;
   unsigned char request_bitmap[32];
   unsigned char request_manifest_bitmap[2];
+
+  // Everything they hold of held_map_bundle, as byte ranges, if they have sent
+  // us a run-length progress report ('H') for it.
+#define MAX_HELD_RANGES 32
+  int held_map_bundle;
+  int held_range_count;
+  int held_ranges[MAX_HELD_RANGES][2];
 };
 
 // Bundles this peer is transferring.
@@ -176,7 +280,28 @@ struct peer_state {
 // peers, as a small protection against malicious nodes offering fake bundle
 // pieces that will result in the crypto checksums failing at the end.
 #define MAX_BUNDLES_IN_FLIGHT 256
-extern struct partial_bundle partials[MAX_BUNDLES_IN_FLIGHT];  
+extern struct partial_bundle partials[MAX_BUNDLES_IN_FLIGHT];
+int partial_find(unsigned char *bid_prefix_bin);
+int partial_allocate(char *bid_prefix,unsigned char *bid_prefix_bin,long long version);
+extern long long partial_lookups;
+extern long long partial_lookup_hits;
+extern long long partial_evictions;
+extern long long partial_evicted_bytes;
+struct segment_list *partial_segment_new(struct partial_bundle *p,int is_manifest,
+					 int offset,int bytes,unsigned char *data);
+int partial_segment_add_bytes(struct partial_bundle *p,int is_manifest,
+			      struct segment_list *s,int offset,int bytes,
+			      unsigned char *data);
+
+extern char *partial_spool_dir;
+int partial_spool_create(struct partial_bundle *p);
+int partial_spool_write(struct partial_bundle *p,int is_manifest,int offset,int bytes,
+			unsigned char *data);
+unsigned char *partial_spool_ptr(struct partial_bundle *p,int is_manifest,int offset);
+int partial_spool_abandon(struct partial_bundle *p);
+int partial_spool_close(struct partial_bundle *p,int discard);
+int partial_spool_note_progress(struct partial_bundle *p);
+int partial_spool_restore(void);
 
 struct recent_bundle {
   char *bid_prefix;
@@ -232,6 +357,8 @@ struct bundle_record {
   int announce_bar_now;
 #else
   sync_key_t sync_key;
+  // Cached so that the key can be recalculated cheaply when the salt changes
+  uint8_t sync_digest[SYNC_DIGEST_LEN];
 #endif
   long long length;
   char *filehash;
@@ -251,6 +378,13 @@ struct bundle_record {
   
   long long last_priority;
   int num_peers_that_dont_have_it;
+
+  // Cached result of calculate_bundle_intrinsic_priority() (see rank.c)
+  long long intrinsic_priority;
+  int intrinsic_priority_valid;
+  // ... and of bundle_priority_class(), which doesn't depend on our peers
+  int priority_class;
+  int priority_class_valid;
 };
 
 // New unified BAR + optional bundle record for BAR tree structure
@@ -306,6 +440,21 @@ extern uint8_t report_lengths[REPORT_QUEUE_LEN];
 extern struct peer_state *report_queue_peers[REPORT_QUEUE_LEN];
 extern int report_queue_partials[REPORT_QUEUE_LEN];
 extern char *report_queue_message[REPORT_QUEUE_LEN];
+extern unsigned int report_queue_sequence[REPORT_QUEUE_LEN];
+extern int report_queue_types[REPORT_QUEUE_LEN];
+// Types of report, which are also their keys in the queue along with bundle and peer
+#define REPORT_TYPE_ACK 1
+#define REPORT_TYPE_BITMAP 2
+#define REPORT_TYPE_BAR 3
+int report_queue_slot(int peer,unsigned char *bid_prefix_bin,int type,int partial,
+		      char *description);
+int report_type_priority(int type);
+int report_queue_is_stale(int slot);
+int report_queue_remove_sent(int *sent);
+extern long long report_bytes_sent;
+extern long long report_bytes_superseded;
+extern long long report_bytes_evicted;
+extern long long report_bytes_stale;
 
 
 extern unsigned int my_instance_id;
@@ -313,6 +462,8 @@ extern unsigned int my_instance_id;
 #define MAX_PEERS 1024
 extern struct peer_state *peer_records[MAX_PEERS];
 extern int peer_count;
+extern int active_peers[MAX_PEERS];
+extern int active_peer_total;
 
 #define MAX_BUNDLES 10000
 extern struct bundle_record bundles[MAX_BUNDLES];
@@ -335,6 +486,17 @@ extern unsigned int option_flags;
 #define FLAG_NO_RANDOMIZE_START_OFFSET 2
 #define FLAG_NO_BITMAP_PROGRESS 4
 #define FLAG_NO_HARD_LOWER 8
+// Send sync tree messages in the original fixed 10 bytes per record 'S' format,
+// for talking to older LBARD instances that don't understand 's' messages.
+#define FLAG_LEGACY_SYNC_MESSAGES 16
+// Always use the default FEC level, and don't ask peers to adapt theirs.
+#define FLAG_NO_ADAPTIVE_FEC 32
+// Partition the sync tree key space by bundle priority class, so that MeshMS
+// and small bundles reconcile first. All peers must agree on this option.
+extern int sync_tree_priority_keys;
+// Resend bundle bodies as rateless coded blocks instead of repeating pieces.
+// Peers must understand 'C' messages.
+extern int fountain_pieces;
 
 extern FILE *debug_file;
 extern int debug_bundles;
@@ -381,6 +543,23 @@ int saw_piece(char *peer_prefix,int for_me,
 	      int is_manifest_piece,unsigned char *piece,
 
 	      char *prefix, char *servald_server, char *credential);
+int saw_piece_find_partial(char *peer_prefix,int for_me,
+			   char *bid_prefix, unsigned char *bid_prefix_bin,
+			   long long version,
+			   long long piece_offset,int piece_bytes,int is_manifest_piece,
+			   int *peer_out,int *bundle_number_out);
+int saw_coded_piece(char *peer_prefix,int for_me,
+		    char *bid_prefix, unsigned char *bid_prefix_bin,
+		    long long version,int body_length,
+		    unsigned int seed,int count,unsigned char *blocks,
+		    char *prefix, char *servald_server, char *credential);
+int partial_fountain_add_piece(struct partial_bundle *p,long long piece_offset,
+			       int piece_bytes,unsigned char *piece);
+int sync_bundle_can_be_coded(int bundle_number);
+int sync_append_coded_bundle_blocks(int bundle_number,
+				    unsigned char *body,int body_len,
+				    int *offset,int mtu,unsigned char *msg,
+				    int target_peer);
 int saw_length(char *peer_prefix,char *bid_prefix,long long version,
 	       int body_length);
 int saw_message(unsigned char *msg,int len,int rssi,char *my_sid,
@@ -394,6 +573,10 @@ int rhizome_update_bundle(unsigned char *manifest_data,int manifest_length,
 			  char *servald_server,char *credential);
 int prime_bundle_cache(int bundle_number,char *prefix,
 		       char *servald_server, char *credential);
+int bundle_cache_fetch_body(int bundle_number,char *sid_prefix_hex,
+			    char *servald_server, char *credential,
+			    unsigned char **body,int *body_len);
+int bundle_cache_release_fetched_body(unsigned char *body,int body_len);
 int hex_byte_value(char *hexstring);
 int find_highest_priority_bundle(void);
 int find_highest_priority_bar(void);
@@ -414,6 +597,68 @@ int update_my_message(int serialfd,
 		      char *servald_server,char *credential);
 size_t write_data(void *ptr, size_t size, size_t nmemb, FILE *stream);
 int radio_send_message(int serialfd, unsigned char *msg_out,int offset);
+
+// Adaptive FEC levels, from weakest to strongest
+#define FEC_LEVEL_LIGHTEST 0
+#define FEC_LEVEL_LIGHT 1
+#define FEC_LEVEL_DEFAULT 2
+#define FEC_LEVEL_HEAVY 3
+#define FEC_LEVEL_COUNT 4
+// Don't let a request from a peer stand for longer than this without being refreshed
+#define FEC_REQUEST_TIMEOUT 60
+// E + 4 byte SID prefix of peer + FEC level = 6 bytes
+#define FEC_LEVEL_REQUEST_LEN 6
+// Set on the FEC level byte by versions that understand Golay protected headers
+#define FEC_LEVEL_FLAG_GOLAY_HEADER 0x80
+// ... and compressed piece headers
+#define FEC_LEVEL_FLAG_COMPRESSED_PIECES 0x40
+// ... and run-length progress reports
+#define FEC_LEVEL_FLAG_PROGRESS_RUNS 0x20
+#define FEC_LEVEL_MASK 0x0f
+extern int fec_level_tx;
+int fec_choose_tx_level(void);
+int fec_max_data_bytes(int level);
+int fec_encode_packet(int level,unsigned char *data,int length,unsigned char *out);
+int fec_decode_any_level(unsigned char *packet_data,int packet_bytes,int *data_length);
+// Two Golay codewords of sender SID fragment, message counter and length
+#define GOLAY_HEADER_LEN 6
+extern int golay_header_tx;
+int golay_header_encode(unsigned char *packet,int packet_bytes,unsigned char *out);
+int golay_header_decode(unsigned char *packet,int packet_bytes,
+			unsigned char *sid_fragment,int *counter_low);
+int fec_note_failed_packet(unsigned char sid_fragment,int counter_low);
+int append_fec_level_request(unsigned char *msg_out,int *offset,int mtu);
+extern int compressed_pieces_tx;
+extern int progress_runs_tx;
+extern int progress_runs_min_block_shift;
+int sync_build_progress_runs_in_slot(int slot,int partial);
+int peer_held_map_next_missing(struct peer_state *p,int bundle,int offset);
+int peer_held_map_holds(struct peer_state *p,int bundle,int start,int end);
+extern int message_counter;
+int piece_context_header_len(long long start_offset);
+int piece_context_slot(int bundle_number,long long version,int *announce);
+int piece_context_append_piece(int slot,int announce,int target_peer,
+			       long long start_offset,int bytes,
+			       int is_manifest,int not_end_of_item,
+			       unsigned char *p,int *offset,unsigned char *msg);
+// Rateless coding of bundle bodies in blocks of 64 bytes, to match the request
+// bitmap accounting.  The decoder keeps a K x K bit matrix, so only bodies of up
+// to 32KB are coded.
+#define FOUNTAIN_BLOCK_SIZE 64
+#define FOUNTAIN_MAX_BLOCKS 512
+struct fountain_decoder;
+int fountain_block_count(int length);
+int fountain_encode_block(unsigned char *body,int length,unsigned int seed,
+			  unsigned char *out);
+struct fountain_decoder *fountain_decoder_new(int length);
+void fountain_decoder_free(struct fountain_decoder *d);
+int fountain_decoder_add(struct fountain_decoder *d,unsigned int seed,
+			 unsigned char *block);
+int fountain_decoder_add_bytes(struct fountain_decoder *d,int offset,int bytes,
+			       unsigned char *data);
+int fountain_decoder_complete(struct fountain_decoder *d);
+int fountain_decoder_rank(struct fountain_decoder *d);
+unsigned char *fountain_decoder_body(struct fountain_decoder *d);
 int radio_receive_bytes(unsigned char *buffer, int bytes, int monitor_mode);
 ssize_t write_all(int fd, const void *buf, size_t len);
 int radio_read_bytes(int serialfd, int monitor_mode);
@@ -445,12 +690,22 @@ int serial_setup_port_with_speed(int fd,int speed);
 int status_dump(void);
 int status_log(char *msg);
 
+long long bundle_intrinsic_priority(int bundle);
+int bundle_priority_changed(int bundle);
+int bundle_priority_peer_changed(char *sid_prefix);
+int peer_note_lacks_bundle(struct peer_state *p,int bundle,int lacks);
+void peer_lacks_forget(struct peer_state *p);
+void peer_lacks_set_counted(struct peer_state *p,int counted);
+void bundle_lacks_clear(int bundle);
+void peer_lacks_forget_all(void);
 long long calculate_bundle_intrinsic_priority(char *bid,
 					      long long length,
 					      long long version,
 					      char *service,
 					      char *recipient,
 					      int insert_failures);
+int bundle_priority_class(char *bid,long long length,long long version,char *service);
+int bundle_cached_priority_class(int bundle);
 int bid_to_peer_bundle_index(int peer,char *bid_hex);
 int manifest_extract_bid(unsigned char *manifest_data,char *bid_hex);
 int we_have_this_bundle_or_newer(char *bid_prefix, long long version);
@@ -464,6 +719,27 @@ int register_bundle(char *service,
 		    char *sender,
 		    char *recipient,
 		    char *name);
+int register_bundle_with_key(sync_key_t bundle_sync_key,
+			     uint8_t sync_digest[SYNC_DIGEST_LEN],
+			     char *service,
+			     char *bid,
+			     char *version,
+			     char *author,
+			     char *originated_here,
+			     long long length,
+			     char *filehash,
+			     char *sender,
+			     char *recipient,
+			     char *name);
+int bundle_acceptable(char *service,long long version,char **reason);
+unsigned long long bundle_list_entry_hash(char *bid,long long version);
+extern unsigned long long bundle_list_digest;
+extern uint8_t bundle_tree_salt[SYNC_SALT_LEN];
+extern char *bundle_snapshot_filename;
+extern int bundle_snapshot_dirty;
+int bundle_snapshot_load(char *filename,char *token);
+int bundle_snapshot_save(char *filename,char *token);
+int bundle_snapshot_serviceloop(char *token);
 long long size_byte_to_length(unsigned char size_byte);
 char *bundle_recipient_if_known(char *bid_prefix);
 int rhizome_log(char *service,
@@ -492,11 +768,18 @@ int http_process(struct sockaddr *cliaddr,
 		 int socket);
 int chartohex(int c);
 int random_active_peer(void);
+void peer_note_heard(int peer);
+void peer_note_inactive(struct peer_state *p);
+int active_peers_serviceloop(void);
 int append_bytes(int *offset,int mtu,unsigned char *msg_out,
 		 unsigned char *data,int count);
 int sync_tree_receive_message(struct peer_state *p, unsigned char *msg);
 int lookup_bundle_by_sync_key(uint8_t bundle_sync_key[KEY_LEN]);
 int peer_queue_bundle_tx(struct peer_state *p,struct bundle_record *b, int priority);
+int peer_queue_reprioritise_tx(struct peer_state *p,int bundle,int priority);
+int peer_unqueue_bundle_tx(struct peer_state *p,int bundle);
+int peer_queue_pop_tx(struct peer_state *p,int *bundle,int *priority);
+void peer_queue_free_tx(struct peer_state *p);
 int sync_parse_ack(struct peer_state *p,unsigned char *msg,
 		   char *sid_prefix_hex,
 		   char *servald_server, char *credential);
@@ -525,12 +808,28 @@ int http_meshmb_read(char *server_and_port,
 		     char *id_hex,int timeout_ms);
 
 int sync_setup(void);
+int sync_tree_populate_with_our_bundles(void);
+int sync_tree_send_data(int *offset,int mtu, unsigned char *msg_out,int peer,
+			char *sid_prefix_hex,char *servald_server,char *credential);
+int packet_note_fill(int bytes,int mtu);
+extern int packet_fill_average;
+extern long long packet_fill_bytes;
+extern long long packet_fill_capacity;
 int sync_by_tree_stuff_packet(int *offset,int mtu, unsigned char *msg_out,
 			      char *sid_prefix_hex,
 			      char *servald_server,char *credential);
 int sync_tell_peer_we_have_this_bundle(int peer, int bundle);
 int sync_tell_peer_we_have_the_bundle_of_this_partial(int peer, int partial);
 int sync_queue_bundle(struct peer_state *p,int bundle);
+int journal_bundle_p(int bundle);
+int journal_note_peer_holds(struct peer_state *p,unsigned char *bid_prefix_bin,
+			    long long length);
+long long journal_peer_held_length(struct peer_state *p,int bundle);
+int journal_begin_tx(struct peer_state *p,int bundle);
+int journal_tx_body_deferred(struct peer_state *p);
+int tx_resume_save(struct peer_state *p);
+int tx_resume_restore(struct peer_state *p,int bundle);
+int tx_resume_forget(struct peer_state *p,int bundle);
 int sync_schedule_progress_report(int peer, int partial, int randomJump);
 int sync_schedule_progress_report_bitmap(int peer, int partial);
 int bundle_calculate_tree_key(sync_key_t *sync_key,
@@ -538,7 +837,22 @@ int bundle_calculate_tree_key(sync_key_t *sync_key,
 			      char *bid,
 			      long long version,
 			      long long length,
-			      char *filehash);
+			      char *filehash,
+			      char *service);
+int bundle_calculate_sync_digest(uint8_t digest[SYNC_DIGEST_LEN],
+				 char *bid,
+				 long long version,
+				 long long length,
+				 char *filehash);
+int bundle_tree_key_from_digest(sync_key_t *bundle_tree_key,
+				uint8_t sync_tree_salt[SYNC_SALT_LEN],
+				uint8_t digest[SYNC_DIGEST_LEN],
+				char *bid,
+				long long version,
+				long long length,
+				char *service);
+extern int sync_salt_rotation_interval;
+int sync_tree_rotate_salt(void);
 int dump_bytes(FILE *f,char *msg,unsigned char *bytes,int length);
 int urandombytes(unsigned char *buf, size_t len);
 int active_peer_count(void);
@@ -575,6 +889,8 @@ int lookup_bundle_by_prefix_bin_and_version_or_newer(unsigned char *prefix, long
 int radio_set_type(int radio_type);
 int radio_set_feature(int bitmask);
 int radio_get_type(void);
+extern int radio_frame_size_override;
+int radio_frame_size(void);
 
 int uhf_rfd900_setup(int fd);
 int uhf_serviceloop(int fd);
@@ -651,6 +967,10 @@ int describe_bundle(int fn, FILE *f,FILE *bundlelogfile,int bn,int peerid,
 
 int stun_serviceloop(void);
 int autodetect_radio_type(int fd);
+// Lane, 2 byte sequence number, logical MTU and zone geometry
+#define OUTERNET_HEADER_LEN 5
+extern int outernet_zone_packets;
+extern int outernet_zone_parity;
 int outernet_rx_setup(char *socket_filename);
 int outernet_rx_serviceloop(void);
 int set_nonblock(int fd);
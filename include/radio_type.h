@@ -8,6 +8,10 @@ typedef struct radio_type {
   int (*send_packet)(int /* fd */,unsigned char * /* packet */,int /* length */);
   int (*is_radio_ready)(void);
   int hf_turnaround_delay;
+  // Largest frame (packet plus FEC) that the radio can send, and the frame size
+  // that gets the most data through, given its per-frame overheads.
+  int max_frame_size;
+  int preferred_frame_size;
 } radio_type;
 
 extern radio_type radio_types[];
@@ -35,9 +35,12 @@ int sync_has_transmit_queued(const struct sync_state *state);
 
 // ask for a message to be inserted into buff, returns packet length
 size_t sync_build_message(struct sync_state *state, uint8_t *buff, size_t len);
+// as above, but using the compact bit packed record encoding
+size_t sync_build_compact_message(struct sync_state *state, uint8_t *buff, size_t len);
 
 // process a message received from a peer.
 int sync_recv_message(struct sync_state *state, void *peer_context, const uint8_t *buff, size_t len);
+int sync_recv_compact_message(struct sync_state *state, void *peer_context, const uint8_t *buff, size_t len);
 
 
 #endif
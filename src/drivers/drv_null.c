@@ -1,6 +1,6 @@
 /*
 
-RADIO TYPE: NORADIO,"noradio","No radio",null_radio_detect,null_serviceloop,null_receive_bytes,null_send_packet,null_check_if_ready,10
+RADIO TYPE: NORADIO,"noradio","No radio",null_radio_detect,null_serviceloop,null_receive_bytes,null_send_packet,null_check_if_ready,10,255,232
 */
 
 
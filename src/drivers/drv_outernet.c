@@ -11,12 +11,16 @@
   as soon as possible, so that early warning of disaster messages can
   be received in a timely manner.
   Also, because the satellite link may end up with lost packets, we need
-  to both interleave and apply some level of redundancy.  We will use 3+1
-  RAID5-style parity, together with a 1:5 interleave, i.e., we will uplink
-  five bundles simultaneously, with one packet from each being sent, and for
-  every 3 packets, we will provide one parity packet.  This means that at
+  to both interleave and apply some level of redundancy.  We use an erasure
+  code over zones of packets (see src/fec/erasure.c), together with a 1:5
+  interleave, i.e., we will uplink five bundles simultaneously, with one packet
+  from each being sent.  By default a zone is 4 packets, any 1 of which can be
+  lost, i.e., the same overhead as 3+1 RAID5-style parity.  This means that at
   least six consecutive packets must be lost before there will be a problem
-  with reception.  However, it is of course possible that problems will still
+  with reception.  The zone size and number of losses it can tolerate can be
+  set with the outernetfec=<packets>,<losses> option, e.g., outernetfec=8,2
+  tolerates the same 1 in 4 loss rate, but copes better with bursts.
+  However, it is of course possible that problems will still
   occur, and so we must retransmit high priority bundles repeatedly.  For now,
   this will be managed by having the Rhizome database for the uplink side having
   to exercise restraint at the number of bundles that it is pushing.  To also
@@ -38,7 +42,7 @@ The following specially formatted comments tell the LBARD build environment abou
 See radio_type for the meaning of each field.
 See radios.h target in Makefile to see how this comment is used to register support for the radio.
 
-RADIO TYPE: OUTERNET,"outernet","Outernet.is broadcast satellite",outernet_radio_detect,outernet_serviceloop,outernet_receive_bytes,outernet_send_packet,outernet_check_if_ready,10
+RADIO TYPE: OUTERNET,"outernet","Outernet.is broadcast satellite",outernet_radio_detect,outernet_serviceloop,outernet_receive_bytes,outernet_send_packet,outernet_check_if_ready,10,255,232
 
 */
 
@@ -62,6 +66,7 @@ RADIO TYPE: OUTERNET,"outernet","Outernet.is broadcast satellite",outernet_radio
 #include "lbard.h"
 #include "hf.h"
 #include "radios.h"
+#include "erasure.h"
 #include "code_instrumentation.h"
 
 long long last_uplink_packet_time=0;
@@ -70,10 +75,15 @@ int last_uplink_lane=-1;
 #define MAX_MTU 255
 unsigned char outernet_packet[MAX_MTU];
 int outernet_packet_len=0;
-// (outernet_mtu - 4) must be a multiple of 4
+// Only as much of (outernet_mtu - OUTERNET_HEADER_LEN) as is a multiple of the
+// zone size is used.
 int outernet_mtu=240;
 int outernet_sequence_number=0;
 
+// Packets per parity zone, and how many of those can be lost
+int outernet_zone_packets=4;
+int outernet_zone_parity=1;
+
 // Import serial_port string from main.c
 extern char *serial_port;
 
@@ -211,7 +221,7 @@ int outernet_uplink_next_in_queue(int lane)
     */       
     int serialised_len=2+4+cached_manifest_encoded_len+cached_body_len;
     // (but allow extra space for a complete parity zone, so that packet building is simpler)
-    unsigned char *serialised_data=malloc(serialised_len+MAX_MTU*4);
+    unsigned char *serialised_data=malloc(serialised_len+MAX_MTU*ERASURE_MAX_ZONE_PACKETS);
     if (!serialised_data) {
       LOG_ERROR("Could not allocate buffer for serialised data for bundle #%d (manifest len=%d, body len=%d)",
 		bundle,cached_manifest_encoded_len,cached_body_len);
@@ -231,7 +241,8 @@ int outernet_uplink_next_in_queue(int lane)
     // Put a safe empty region at the end, so the last parity block can be correctly
     // calculated, regardless of the length of the serialised bundle modulo parity block
     // size.
-    bzero(&serialised_data[2+4+cached_manifest_encoded_len+cached_body_len],MAX_MTU*4);
+    bzero(&serialised_data[2+4+cached_manifest_encoded_len+cached_body_len],
+	  MAX_MTU*ERASURE_MAX_ZONE_PACKETS);
 
     // Store in lane
     lane_queues[lane]->serialised_bundle=serialised_data;
@@ -493,12 +504,14 @@ int outernet_check_if_ready(void)
 
   So, we then need in each packet:
 
-  1 byte = data unit size, i.e., the fixed number of data bytes
-  per packet. Used to calculate parity regions.
+  1 byte = lane number.
   2 bytes = sequence number (16K values = ~6 hour turn over), plus
   start/end of bundle markers.
+  1 byte = logical MTU, i.e., header plus the data and parity bytes in each
+  packet. Used to calculate parity zones.
+  1 byte = zone geometry: (packets per zone - 1) << 4 | losses tolerated.
   n bytes = data.
-  n/3 bytes = parity stripe.
+  m bytes = parity stripe.
 
 */
  
@@ -512,69 +525,44 @@ int outernet_uplink_build_packet(int lane)
     if (!lane_queues[lane]) { retVal=-1; break;}
     if (lane_queues[lane]->serialised_bundle_number==-1)
        { retVal=-1; break;}
-  
-    // 3/4 of the usable bytes are available for data
-    int data_bytes=(outernet_mtu-(1+2+1))*3/4;
-    int parity_bytes=data_bytes/3;
-    if (parity_bytes*3!=data_bytes) {
-      LOG_ERROR("Parity stripe size problem. MTU=%d, data_bytes=%d, parity_bytes=%d",
-		outernet_mtu,data_bytes,parity_bytes);
+
+    // Work out how the packet is divided between data and parity
+    struct erasure_zone z;
+    int stripe_bytes=outernet_mtu-OUTERNET_HEADER_LEN;
+    stripe_bytes-=stripe_bytes%outernet_zone_packets;
+    if (erasure_zone_setup(&z,outernet_zone_packets,outernet_zone_parity,stripe_bytes)) {
+      LOG_ERROR("Parity zone problem. MTU=%d, zone packets=%d, zone parity=%d",
+		outernet_mtu,outernet_zone_packets,outernet_zone_parity);
       retVal=-1;
       break;
     }
+    int data_bytes=z.data_bytes;
 
-    // Work out where parity zone lies, i.e., which 3 packets
-    // worth of data.
-    int parity_zone_size=data_bytes*4;
+    // Work out where parity zone lies, i.e., which packets worth of data.
+    int parity_zone_size=data_bytes*z.packets;
     int parity_zone_start=lane_queues[lane]->serialised_offset
       -(lane_queues[lane]->serialised_offset%parity_zone_size);
-    // Within that, work out where the parity stripe lies, i.e.,
-    // which third of a packet offset.
+    // Within that, work out which packet of the zone this is
     int parity_stripe_number=
       (lane_queues[lane]->serialised_offset-parity_zone_start)
       /data_bytes;
     LOG_NOTE("serialised_offset=%d, parity_zone_start=%d, parity_stripe_number=%d, data_bytes=%d, parity_bytes=%d, serialised_len=%d",
 	     lane_queues[lane]->serialised_offset,
 	     parity_zone_start,parity_stripe_number,
-	     data_bytes,parity_bytes,
+	     data_bytes,z.parity_bytes,
 	     lane_queues[lane]->serialised_len	     );
 
-    /* Generate the parity stripe for this zone.
-       For each block of data, we XOR together 1/3 of each of the other 
-       three data blocks in the parity zone to produce the parity stripe.
-       
-    */
-    unsigned char *dataStart=&lane_queues[lane]->serialised_bundle[parity_zone_start];
-    unsigned char parity_stripe[MAX_MTU];
-    unsigned char *srcA,*srcB,*srcC;
-    switch (parity_stripe_number) {
-    case 0:
-      srcA=&dataStart[data_bytes*1+parity_bytes*0];
-      srcB=&dataStart[data_bytes*2+parity_bytes*0];
-      srcC=&dataStart[data_bytes*3+parity_bytes*0];
-      break;
-    case 1:
-      srcA=&dataStart[data_bytes*0+parity_bytes*0];
-      srcB=&dataStart[data_bytes*2+parity_bytes*1];
-      srcC=&dataStart[data_bytes*3+parity_bytes*1];
-      break;
-    case 2:
-      srcA=&dataStart[data_bytes*0+parity_bytes*1];
-      srcB=&dataStart[data_bytes*1+parity_bytes*1];
-      srcC=&dataStart[data_bytes*3+parity_bytes*2];
-      break;
-    case 3:
-      srcA=&dataStart[data_bytes*0+parity_bytes*2];
-      srcB=&dataStart[data_bytes*1+parity_bytes*2];
-      srcC=&dataStart[data_bytes*2+parity_bytes*2];
-      break;
-    }
-    for(int i=0;i<parity_bytes;i++) parity_stripe[i]=srcA[i]^srcB[i]^srcC[i];
+    // Generate the parity for the whole zone, and send this packet's share of it.
+    unsigned char zone_parity[ERASURE_MAX_STRIPE_BYTES*ERASURE_MAX_ZONE_PACKETS];
+    erasure_zone_encode(&z,&lane_queues[lane]->serialised_bundle[parity_zone_start],
+			zone_parity);
 
     // Glue everything together:
 
-    bcopy(&lane_queues[lane]->serialised_bundle[lane_queues[lane]->serialised_offset],&outernet_packet[1+2+1],data_bytes);
-    bcopy(parity_stripe,&outernet_packet[1+2+1+data_bytes],parity_bytes);
+    bcopy(&lane_queues[lane]->serialised_bundle[lane_queues[lane]->serialised_offset],
+	  &outernet_packet[OUTERNET_HEADER_LEN],data_bytes);
+    bcopy(&zone_parity[parity_stripe_number*z.parity_bytes],
+	  &outernet_packet[OUTERNET_HEADER_LEN+data_bytes],z.parity_bytes);
     
     // Sequence number
     int seq=lane_queues[lane]->serialised_offset/data_bytes;
@@ -586,7 +574,7 @@ int outernet_uplink_build_packet(int lane)
     // Send to end of serialised bundle + rounded out to end of parity zone, to make sure end of
     // bundle is protected as well as the rest of it is.
     if ((lane_queues[lane]->serialised_offset>=lane_queues[lane]->serialised_len)
-        &&(parity_stripe_number==3)) {
+        &&(parity_stripe_number==(z.packets-1))) {
       // Last packet in bundle
       seq|=0x8000;
       // So get ready for next one
@@ -596,9 +584,10 @@ int outernet_uplink_build_packet(int lane)
     outernet_packet[0]=lane&0xff;
     outernet_packet[1]=(seq>>0)&0xff;
     outernet_packet[2]=(seq>>8)&0xff;
-    outernet_packet[3]=outernet_mtu;
+    outernet_packet[3]=OUTERNET_HEADER_LEN+stripe_bytes;
+    outernet_packet[4]=((z.packets-1)<<4)|z.parity;
 
-    outernet_packet_len=1+2+1+data_bytes+parity_bytes;
+    outernet_packet_len=OUTERNET_HEADER_LEN+data_bytes+z.parity_bytes;
     // dump_bytes(stderr,"Packet for uplink",outernet_packet,outernet_packet_len);
     
   } while(0);
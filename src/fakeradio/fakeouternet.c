@@ -7,6 +7,10 @@
 
   The receiver side writes the received packets to a named UNIX socket.
 
+  Run as "fakeouternet sweep" to instead simulate sending a bundle through
+  the parity zone erasure code at a range of packet loss rates, and report
+  how often the bundle arrives complete for each zone configuration.
+
 */
 
 #include <unistd.h>
@@ -28,6 +32,7 @@
 #include <sys/time.h>
 
 #include "code_instrumentation.h"
+#include "erasure.h"
 
 int fd=-1;
 int named_socket=-1;
@@ -235,6 +240,77 @@ long long gettime_ms()
 }
 
 
+#define SWEEP_BUNDLE_BYTES 16384
+#define SWEEP_MTU 200
+#define SWEEP_TRIALS 200
+
+int loss_sweep(void)
+{
+  // Zone configurations to try: packets per zone, losses tolerated
+  int configs[][2]={{4,1},{8,1},{8,2},{8,3},{12,3},{16,4}};
+  int config_count=sizeof(configs)/sizeof(configs[0]);
+  int loss_rates[]={0,2,5,10,15,20,30};
+  int loss_rate_count=sizeof(loss_rates)/sizeof(loss_rates[0]);
+
+  unsigned char zone_data[ERASURE_MAX_STRIPE_BYTES*ERASURE_MAX_ZONE_PACKETS];
+  unsigned char zone_parity[ERASURE_MAX_STRIPE_BYTES*ERASURE_MAX_ZONE_PACKETS];
+  unsigned char sent_data[ERASURE_MAX_STRIPE_BYTES*ERASURE_MAX_ZONE_PACKETS];
+
+  srandom(1);
+
+  printf("Bundle completion rate for a %d byte bundle, MTU=%d, %d trials\n",
+	 SWEEP_BUNDLE_BYTES,SWEEP_MTU,SWEEP_TRIALS);
+  printf("zone  overhead packets");
+  for(int l=0;l<loss_rate_count;l++) printf("  %3d%%loss",loss_rates[l]);
+  printf("\n");
+
+  for(int c=0;c<config_count;c++) {
+    int n=configs[c][0];
+    int k=configs[c][1];
+    struct erasure_zone z;
+    int stripe=(SWEEP_MTU-5)/n*n;
+    if (erasure_zone_setup(&z,n,k,stripe)) {
+      fprintf(stderr,"Could not set up zone of %d packets, tolerating %d losses\n",n,k);
+      return -1;
+    }
+    int zone_bytes=z.data_bytes*n;
+    int zones=(SWEEP_BUNDLE_BYTES+zone_bytes-1)/zone_bytes;
+    printf("%2d,%-2d  %6.1f%% %7d",n,k,
+	   100.0*z.parity_bytes/z.data_bytes,zones*n);
+
+    for(int l=0;l<loss_rate_count;l++) {
+      int complete=0;
+      for(int trial=0;trial<SWEEP_TRIALS;trial++) {
+	int ok=1;
+	for(int zn=0;ok&&(zn<zones);zn++) {
+	  for(int i=0;i<zone_bytes;i++) sent_data[i]=random();
+	  memcpy(zone_data,sent_data,zone_bytes);
+	  erasure_zone_encode(&z,zone_data,zone_parity);
+
+	  // Lose packets, and scribble over what they carried
+	  unsigned int received=0;
+	  for(int i=0;i<n;i++) {
+	    if ((random()%100)>=loss_rates[l]) received|=1<<i;
+	    else {
+	      memset(&zone_data[i*z.data_bytes],0xa5,z.data_bytes);
+	      memset(&zone_parity[i*z.parity_bytes],0xa5,z.parity_bytes);
+	    }
+	  }
+
+	  if (erasure_zone_decode(&z,zone_data,zone_parity,received)) ok=0;
+	  else if (memcmp(zone_data,sent_data,zone_bytes)) {
+	    fprintf(stderr,"Zone %d,%d decoded incorrectly (received=0x%x)\n",n,k,received);
+	    return -1;
+	  }
+	}
+	complete+=ok;
+      }
+      printf("  %7.1f%%",100.0*complete/SWEEP_TRIALS);
+    }
+    printf("\n");
+  }
+  return 0;
+}
 
 int main(int argc,char **argv)
 {
@@ -261,6 +337,11 @@ int main(int argc,char **argv)
   int retVal=-1;
   do {
 
+    if ((argc==2)&&(!strcasecmp(argv[1],"sweep"))) {
+      retVal=loss_sweep();
+      break;
+    }
+
     if (argc<3) {
       LOG_ERROR("You must provide UDP port and at least one unix socket path on command line.");
       break;
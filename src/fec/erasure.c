@@ -0,0 +1,216 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2018 Paul Gardner-Stephen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+  Erasure coding for the Outernet parity zones.
+
+  A zone is n packets, each of which carries stripe_bytes bytes, and we want to be
+  able to lose any k of them.  We don't want separate parity packets, so that
+  every packet carries the same amount of data, and the data in the bundle can be
+  found with a simple offset calculation.
+
+  So we treat the zone as stripe_bytes codewords of a systematic Cauchy
+  Reed-Solomon code over GF(256), each with one symbol in every packet: n-k data
+  symbols and k parity symbols.  Codeword j keeps its parity symbols in packets
+  (j+0)%n .. (j+k-1)%n, so that over every n codewords, each packet holds k parity
+  symbols.  Losing k packets then costs each codeword at most k symbols, which
+  is exactly what it can recover.
+
+  Within a packet, the data symbols come first, in codeword order, and then the
+  parity symbols, also in codeword order.  The data of the zone is therefore just
+  the data of each packet, one after the other.
+
+  The parity symbols are p_t = sum_m C[t][m] d_m, where C[t][m] = 1/(t ^ (k+m)) is
+  a Cauchy matrix, every square sub-matrix of which is invertible.  So whichever
+  e data symbols are lost, any e of the parity symbols let us solve for them.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "erasure.h"
+
+static unsigned char gf_exp[512];
+static unsigned char gf_log[256];
+static int gf_ready=0;
+
+static void gf_init(void)
+{
+  if (gf_ready) return;
+  int x=1;
+  for(int i=0;i<255;i++) {
+    gf_exp[i]=x;
+    gf_log[x]=i;
+    x<<=1;
+    if (x&0x100) x^=0x11d;
+  }
+  for(int i=255;i<512;i++) gf_exp[i]=gf_exp[i-255];
+  gf_ready=1;
+}
+
+static inline unsigned char gf_mul(unsigned char a,unsigned char b)
+{
+  if (!a||!b) return 0;
+  return gf_exp[gf_log[a]+gf_log[b]];
+}
+
+static inline unsigned char gf_inv(unsigned char a)
+{
+  return gf_exp[255-gf_log[a]];
+}
+
+static inline unsigned char cauchy(struct erasure_zone *z,int t,int m)
+{
+  return gf_inv(t^(z->parity+m));
+}
+
+int erasure_zone_setup(struct erasure_zone *z,int packets,int parity,int stripe_bytes)
+{
+  if ((packets<1)||(packets>ERASURE_MAX_ZONE_PACKETS)) return -1;
+  if ((parity<0)||(parity>=packets)) return -1;
+  if ((stripe_bytes<packets)||(stripe_bytes>ERASURE_MAX_STRIPE_BYTES)) return -1;
+  // Each packet must hold the same number of parity symbols
+  if (stripe_bytes%packets) return -1;
+
+  gf_init();
+  z->packets=packets;
+  z->parity=parity;
+  z->stripe_bytes=stripe_bytes;
+  z->parity_bytes=stripe_bytes/packets*parity;
+  z->data_bytes=stripe_bytes-z->parity_bytes;
+  return 0;
+}
+
+int erasure_zone_received_count(unsigned int received)
+{
+  return __builtin_popcount(received);
+}
+
+/*
+  Work out which packets hold the symbols of codeword j, and where.
+  data_at[m] and parity_at[t] are set to the offsets within zone_data and
+  zone_parity, and data_pkt[m] and parity_pkt[t] to the packet numbers.
+  data_pos[] and parity_pos[] count the symbols each packet holds in codewords
+  before j, and are advanced past codeword j.
+*/
+static void erasure_codeword(struct erasure_zone *z,int j,
+			     int *data_pos,int *parity_pos,
+			     int *data_pkt,int *data_at,
+			     int *parity_pkt,int *parity_at)
+{
+  int n=z->packets;
+  int k=z->parity;
+  int m=0;
+  for(int i=0;i<n;i++) {
+    int t=(i-(j%n)+n)%n;
+    if (t<k) {
+      parity_pkt[t]=i;
+      parity_at[t]=i*z->parity_bytes+parity_pos[i]++;
+    } else {
+      data_pkt[m]=i;
+      data_at[m]=i*z->data_bytes+data_pos[i]++;
+      m++;
+    }
+  }
+}
+
+int erasure_zone_encode(struct erasure_zone *z,unsigned char *zone_data,
+			unsigned char *zone_parity)
+{
+  int n=z->packets;
+  int k=z->parity;
+  int data_pos[ERASURE_MAX_ZONE_PACKETS]={0};
+  int parity_pos[ERASURE_MAX_ZONE_PACKETS]={0};
+  int data_pkt[ERASURE_MAX_ZONE_PACKETS],data_at[ERASURE_MAX_ZONE_PACKETS];
+  int parity_pkt[ERASURE_MAX_ZONE_PACKETS],parity_at[ERASURE_MAX_ZONE_PACKETS];
+
+  for(int j=0;j<z->stripe_bytes;j++) {
+    erasure_codeword(z,j,data_pos,parity_pos,data_pkt,data_at,parity_pkt,parity_at);
+    for(int t=0;t<k;t++) {
+      unsigned char p=0;
+      for(int m=0;m<n-k;m++)
+	p^=gf_mul(cauchy(z,t,m),zone_data[data_at[m]]);
+      zone_parity[parity_at[t]]=p;
+    }
+  }
+  return 0;
+}
+
+int erasure_zone_decode(struct erasure_zone *z,unsigned char *zone_data,
+			unsigned char *zone_parity,unsigned int received)
+{
+  int n=z->packets;
+  int k=z->parity;
+  unsigned int all=(1U<<n)-1;
+  received&=all;
+  if (received==all) return 0;
+  if (erasure_zone_received_count(received)<(n-k)) return -1;
+
+  int data_pos[ERASURE_MAX_ZONE_PACKETS]={0};
+  int parity_pos[ERASURE_MAX_ZONE_PACKETS]={0};
+  int data_pkt[ERASURE_MAX_ZONE_PACKETS],data_at[ERASURE_MAX_ZONE_PACKETS];
+  int parity_pkt[ERASURE_MAX_ZONE_PACKETS],parity_at[ERASURE_MAX_ZONE_PACKETS];
+
+  for(int j=0;j<z->stripe_bytes;j++) {
+    erasure_codeword(z,j,data_pos,parity_pos,data_pkt,data_at,parity_pkt,parity_at);
+
+    // Which data symbols are missing, and which parity symbols do we have?
+    int missing[ERASURE_MAX_ZONE_PACKETS],e=0;
+    int rows[ERASURE_MAX_ZONE_PACKETS],r=0;
+    for(int m=0;m<n-k;m++)
+      if (!(received&(1<<data_pkt[m]))) missing[e++]=m;
+    if (!e) continue;
+    for(int t=0;(t<k)&&(r<e);t++)
+      if (received&(1<<parity_pkt[t])) rows[r++]=t;
+    if (r<e) return -1;
+
+    // Set up e equations in the e missing symbols, with the known data symbols
+    // moved to the right hand side, and solve by Gauss-Jordan elimination.
+    unsigned char a[ERASURE_MAX_ZONE_PACKETS][ERASURE_MAX_ZONE_PACKETS+1];
+    for(int row=0;row<e;row++) {
+      int t=rows[row];
+      unsigned char b=zone_parity[parity_at[t]];
+      for(int m=0;m<n-k;m++)
+	if (received&(1<<data_pkt[m]))
+	  b^=gf_mul(cauchy(z,t,m),zone_data[data_at[m]]);
+      for(int c=0;c<e;c++) a[row][c]=cauchy(z,t,missing[c]);
+      a[row][e]=b;
+    }
+    for(int c=0;c<e;c++) {
+      int p;
+      for(p=c;p<e;p++) if (a[p][c]) break;
+      // Can't happen for a Cauchy matrix, but don't write garbage if it does
+      if (p==e) return -1;
+      if (p!=c)
+	for(int i=0;i<=e;i++) {
+	  unsigned char x=a[p][i]; a[p][i]=a[c][i]; a[c][i]=x;
+	}
+      unsigned char inv=gf_inv(a[c][c]);
+      for(int i=c;i<=e;i++) a[c][i]=gf_mul(a[c][i],inv);
+      for(int row=0;row<e;row++) {
+	if ((row==c)||(!a[row][c])) continue;
+	unsigned char f=a[row][c];
+	for(int i=c;i<=e;i++) a[row][i]^=gf_mul(f,a[c][i]);
+      }
+    }
+    for(int c=0;c<e;c++) zone_data[data_at[missing[c]]]=a[c][e];
+  }
+  return 0;
+}
@@ -79,6 +79,10 @@
   int syn_error, count;
 
   /* form the syndromes; i.e., evaluate data(x) at roots of g(x) */
+#ifdef COMPUTE_SYNDROMES
+  /* The including code has a faster way of doing this */
+  COMPUTE_SYNDROMES(s);
+#else
   for(i=0;i<NROOTS;i++)
     s[i] = data[0];
 
@@ -91,6 +95,7 @@
       }
     }
   }
+#endif
 
   /* Convert syndromes to index form, checking for nonzero condition */
   syn_error = 0;
@@ -11,6 +11,31 @@
 
 #include "fixed.h"
 
+void encode_rs_8(data_t *data, data_t *parity,int pad);
+
+/* Syndromes are computed by Horner's rule, multiplying by a fixed root for each
+ * syndrome at every step. Doing that multiply by table lookup instead of via
+ * log/antilog tables and modulo reduction gives identical results much faster.
+ */
+static data_t syndrome_table[NROOTS][256];
+static int syndrome_table_ready;
+
+static void init_syndrome_table(void){
+  int i,x;
+
+  for(i=0;i<NROOTS;i++)
+    for(x=1;x<256;x++)
+      syndrome_table[i][x] = ALPHA_TO[MODNN(INDEX_OF[x] + (FCR+i)*PRIM)];
+  syndrome_table_ready = 1;
+}
+
+#define COMPUTE_SYNDROMES(S) \
+  for(i=0;i<NROOTS;i++) \
+    S[i] = data[0]; \
+  for(j=1;j<NN-PAD;j++) \
+    for(i=0;i<NROOTS;i++) \
+      S[i] = syndrome_table[i][S[i]] ^ data[j];
+
 int decode_rs_8(data_t *data, int *eras_pos, int no_eras, int pad){
   int retval;
  
@@ -18,6 +43,20 @@ int decode_rs_8(data_t *data, int *eras_pos, int no_eras, int pad){
     return -1;
   }
 
+  /* Most packets arrive intact. A block is a codeword, i.e., has all zero syndromes,
+   * exactly when re-encoding its data gives its parity, and that is much cheaper to
+   * check than computing the syndromes.
+   */
+  {
+    data_t parity[NROOTS];
+    encode_rs_8(data,parity,pad);
+    if(!memcmp(parity,&data[NN-NROOTS-pad],NROOTS*sizeof(data_t)))
+      return 0;
+  }
+
+  if(!syndrome_table_ready)
+    init_syndrome_table();
+
 #include "decode_rs.h"
   
   return retval;
@@ -3,24 +3,31 @@
  * May be used under the terms of the GNU Lesser General Public License (LGPL)
  */
 #include <string.h>
+#include <stdint.h>
 #include "fixed.h"
 #ifdef __VEC__
 #include <sys/sysctl.h>
 #endif
 
 
-static enum {UNKNOWN=0,MMX,SSE,SSE2,ALTIVEC,PORT} cpu_mode;
+static enum {UNKNOWN=0,MMX,SSE,SSE2,ALTIVEC,PORT,TABLE} cpu_mode;
 
 static void encode_rs_8_c(data_t *data, data_t *parity,int pad);
+static void init_encode_rs_8_table(void);
+static void encode_rs_8_table(data_t *data, data_t *parity,int pad);
 #if __vec__
 static void encode_rs_8_av(data_t *data, data_t *parity,int pad);
 #endif
 
 void encode_rs_8(data_t *data, data_t *parity,int pad){
   if(cpu_mode == UNKNOWN){
-    cpu_mode = PORT;
+    init_encode_rs_8_table();
+    cpu_mode = TABLE;
   }
   switch(cpu_mode){
+  case TABLE:
+    encode_rs_8_table(data,parity,pad);
+    return;
 #if __vec__
   case ALTIVEC:
     encode_rs_8_av(data,parity,pad);
@@ -79,3 +86,45 @@ static void encode_rs_8_c(data_t *data, data_t *parity,int pad){
 #include "encode_rs.h"
 
 }
+
+/* Table driven version, producing identical output to the portable C version.
+ * The portable version does a log/antilog lookup and modulo reduction for every
+ * parity symbol of every data symbol. Instead we precompute, for each of the 256
+ * possible feedback values, the NROOTS symbols that get XORed into the shift
+ * register, and keep the shift register packed into 64-bit words, so that both
+ * the XOR and the shift are done 8 symbols at a time. Symbol 0 of the register
+ * is the most significant byte of word 0. This is done with shifts rather than
+ * by overlaying bytes on words, so that byte order and alignment don't matter.
+ */
+#define TABLE_WORDS (NROOTS/8)
+static uint64_t feedback_table[256][TABLE_WORDS];
+
+static void init_encode_rs_8_table(void){
+  int f,k;
+
+  for(f=1;f<256;f++){
+    int feedback = INDEX_OF[f];
+    for(k=0;k<NROOTS;k++)
+      feedback_table[f][k/8] |= ((uint64_t)ALPHA_TO[MODNN(feedback + GENPOLY[NROOTS-1-k])])
+	<< (56-8*(k%8));
+  }
+}
+
+static void encode_rs_8_table(data_t *data, data_t *parity,int pad){
+  uint64_t reg[TABLE_WORDS];
+  int i,k;
+
+  memset(reg,0,sizeof(reg));
+  for(i=0;i<NN-NROOTS-PAD;i++){
+    data_t feedback = data[i] ^ (reg[0]>>56);
+    for(k=0;k<TABLE_WORDS-1;k++)
+      reg[k] = (reg[k]<<8) | (reg[k+1]>>56);
+    reg[TABLE_WORDS-1] <<= 8;
+    if(feedback){
+      for(k=0;k<TABLE_WORDS;k++)
+	reg[k] ^= feedback_table[feedback][k];
+    }
+  }
+  for(k=0;k<NROOTS;k++)
+    parity[k] = reg[k/8] >> (56-8*(k%8));
+}
@@ -0,0 +1,244 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2016 Serval Project Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+  Rateless (fountain) coding of bundle bodies.
+
+  The body is cut into K blocks of FOUNTAIN_BLOCK_SIZE bytes, the last one padded
+  with zeroes.  Each coded block is the XOR of a subset of those blocks, and the
+  subset is given entirely by a 32-bit seed, so a coded block goes on air as just
+  the seed and the data.  Seeds below K are the plain source blocks, i.e., the code
+  is systematic.  Larger seeds select each source block with probability 1/2.
+
+  Any K linearly independent blocks reconstruct the body, and a random set of K+n
+  coded blocks is independent with probability of about 1-2^-n, whichever blocks
+  a given receiver happened to miss.  So one coded block fills a different gap for
+  every receiver that hears it.
+
+  We use dense rather than LT-style sparse subsets because our bodies are at most a
+  few hundred blocks, where LT codes need a large fraction of extra blocks to
+  decode reliably.  The decoder is incremental Gaussian elimination, which costs
+  O(K^2/64) word operations per block received, and keeps the rows fully reduced,
+  so that once we have K independent blocks the body is simply read out.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sync.h"
+#include "lbard.h"
+
+struct fountain_decoder {
+  int length;
+  int blocks;
+  int words;
+  int rank;
+
+  // Bitmap of the columns (source blocks) that have a pivot row
+  uint64_t *pivots;
+  // Row for each pivot column, and the data that goes with it
+  uint64_t *rows;
+  unsigned char *data;
+};
+
+int fountain_block_count(int length)
+{
+  return (length+FOUNTAIN_BLOCK_SIZE-1)/FOUNTAIN_BLOCK_SIZE;
+}
+
+// Work out which source blocks are combined for a given seed.
+static void fountain_seed_row(unsigned int seed,int blocks,int words,uint64_t *row)
+{
+  bzero(row,words*sizeof(uint64_t));
+  if (seed<blocks) {
+    row[seed>>6]=1ULL<<(seed&63);
+    return;
+  }
+
+  // splitmix64, since it must give exactly the same rows on every platform.
+  // (A linear generator such as xorshift would not do, as then all of the rows
+  // would lie in a space of only as many dimensions as the generator has bits.)
+  uint64_t x=seed;
+  int any=0;
+  for(int w=0;w<words;w++) {
+    x+=0x9e3779b97f4a7c15ULL;
+    uint64_t z=x;
+    z=(z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+    z=(z^(z>>27))*0x94d049bb133111ebULL;
+    row[w]=z^(z>>31);
+    if ((w==words-1)&&(blocks&63)) row[w]&=(1ULL<<(blocks&63))-1;
+    if (row[w]) any=1;
+  }
+  if (!any) row[(seed%blocks)>>6]=1ULL<<((seed%blocks)&63);
+}
+
+int fountain_encode_block(unsigned char *body,int length,unsigned int seed,
+			  unsigned char *out)
+{
+  int blocks=fountain_block_count(length);
+  if ((blocks<1)||(blocks>FOUNTAIN_MAX_BLOCKS)) return -1;
+  int words=(blocks+63)/64;
+  uint64_t row[FOUNTAIN_MAX_BLOCKS/64];
+  fountain_seed_row(seed,blocks,words,row);
+
+  bzero(out,FOUNTAIN_BLOCK_SIZE);
+  for(int b=0;b<blocks;b++) {
+    if (!(row[b>>6]&(1ULL<<(b&63)))) continue;
+    int start=b*FOUNTAIN_BLOCK_SIZE;
+    int n=length-start;
+    if (n>FOUNTAIN_BLOCK_SIZE) n=FOUNTAIN_BLOCK_SIZE;
+    for(int i=0;i<n;i++) out[i]^=body[start+i];
+  }
+  return 0;
+}
+
+struct fountain_decoder *fountain_decoder_new(int length)
+{
+  int blocks=fountain_block_count(length);
+  if ((blocks<1)||(blocks>FOUNTAIN_MAX_BLOCKS)) return NULL;
+
+  struct fountain_decoder *d=calloc(1,sizeof(struct fountain_decoder));
+  if (!d) return NULL;
+  d->length=length;
+  d->blocks=blocks;
+  d->words=(blocks+63)/64;
+  d->pivots=calloc(d->words,sizeof(uint64_t));
+  d->rows=calloc(blocks*d->words,sizeof(uint64_t));
+  d->data=calloc(blocks,FOUNTAIN_BLOCK_SIZE);
+  if ((!d->pivots)||(!d->rows)||(!d->data)) {
+    fountain_decoder_free(d);
+    return NULL;
+  }
+  return d;
+}
+
+void fountain_decoder_free(struct fountain_decoder *d)
+{
+  if (!d) return;
+  free(d->pivots);
+  free(d->rows);
+  free(d->data);
+  free(d);
+}
+
+static void fountain_xor_block(unsigned char *a,unsigned char *b)
+{
+  uint64_t *x=(uint64_t *)a;
+  uint64_t *y=(uint64_t *)b;
+  for(int i=0;i<FOUNTAIN_BLOCK_SIZE/8;i++) x[i]^=y[i];
+}
+
+static int fountain_decoder_add_row(struct fountain_decoder *d,uint64_t *row,
+				    unsigned char *block)
+{
+  int words=d->words;
+  uint64_t r[FOUNTAIN_MAX_BLOCKS/64];
+  uint64_t v[FOUNTAIN_BLOCK_SIZE/8];
+  memcpy(r,row,words*sizeof(uint64_t));
+  memcpy(v,block,FOUNTAIN_BLOCK_SIZE);
+
+  // Eliminate the columns we already have.  Pivot rows are zero in every other
+  // pivot column, so this never brings back a column that we have cleared.
+  for(int w=0;w<words;w++) {
+    uint64_t bits=r[w]&d->pivots[w];
+    while(bits) {
+      int c=(w<<6)+__builtin_ctzll(bits);
+      bits&=bits-1;
+      uint64_t *p=&d->rows[c*words];
+      for(int i=0;i<words;i++) r[i]^=p[i];
+      fountain_xor_block((unsigned char *)v,&d->data[c*FOUNTAIN_BLOCK_SIZE]);
+    }
+  }
+
+  int col=-1;
+  for(int w=0;w<words;w++)
+    if (r[w]) { col=(w<<6)+__builtin_ctzll(r[w]); break; }
+  // Nothing new in this block
+  if (col<0) return 0;
+
+  // Clear the new column from the existing rows
+  for(int c=0;c<d->blocks;c++) {
+    if (!(d->pivots[c>>6]&(1ULL<<(c&63)))) continue;
+    uint64_t *p=&d->rows[c*words];
+    if (!(p[col>>6]&(1ULL<<(col&63)))) continue;
+    for(int i=0;i<words;i++) p[i]^=r[i];
+    fountain_xor_block(&d->data[c*FOUNTAIN_BLOCK_SIZE],(unsigned char *)v);
+  }
+
+  memcpy(&d->rows[col*words],r,words*sizeof(uint64_t));
+  memcpy(&d->data[col*FOUNTAIN_BLOCK_SIZE],v,FOUNTAIN_BLOCK_SIZE);
+  d->pivots[col>>6]|=1ULL<<(col&63);
+  d->rank++;
+  return 1;
+}
+
+int fountain_decoder_add(struct fountain_decoder *d,unsigned int seed,
+			 unsigned char *block)
+{
+  if (!d) return -1;
+  uint64_t row[FOUNTAIN_MAX_BLOCKS/64];
+  fountain_seed_row(seed,d->blocks,d->words,row);
+  return fountain_decoder_add_row(d,row,block);
+}
+
+int fountain_decoder_add_bytes(struct fountain_decoder *d,int offset,int bytes,
+			       unsigned char *data)
+{
+  // Plain pieces count towards decoding as the source blocks they completely
+  // cover.
+  if (!d) return -1;
+  int added=0;
+  int first=(offset+FOUNTAIN_BLOCK_SIZE-1)/FOUNTAIN_BLOCK_SIZE;
+  for(int b=first;b<d->blocks;b++) {
+    int start=b*FOUNTAIN_BLOCK_SIZE;
+    int n=d->length-start;
+    if (n>FOUNTAIN_BLOCK_SIZE) n=FOUNTAIN_BLOCK_SIZE;
+    if (start+n>offset+bytes) break;
+    unsigned char block[FOUNTAIN_BLOCK_SIZE];
+    bzero(block,FOUNTAIN_BLOCK_SIZE);
+    bcopy(&data[start-offset],block,n);
+    added+=fountain_decoder_add(d,b,block);
+  }
+  return added;
+}
+
+int fountain_decoder_complete(struct fountain_decoder *d)
+{
+  if (!d) return 0;
+  return d->rank==d->blocks;
+}
+
+int fountain_decoder_rank(struct fountain_decoder *d)
+{
+  if (!d) return 0;
+  return d->rank;
+}
+
+unsigned char *fountain_decoder_body(struct fountain_decoder *d)
+{
+  // Once every column has a pivot, the fully reduced rows are each a single
+  // source block.
+  if (!fountain_decoder_complete(d)) return NULL;
+  return d->data;
+}
@@ -397,6 +397,25 @@ int http_get_simple(char *server_and_port, char *auth_token,
   return http_response;
 }
 
+// Write a large buffer to a socket a piece at a time, so that a body held in a
+// mapped file is paged in as we go, rather than all at once.
+static int http_write_stream(int sock,unsigned char *data,long long length)
+{
+  long long written=0;
+  while(written<length) {
+    long long n=length-written;
+    if (n>65536) n=65536;
+    ssize_t r=write(sock,&data[written],n);
+    if (r<1) {
+      if ((r==-1)&&((errno==EINTR)||(errno==EAGAIN))) continue;
+      perror("write");
+      return -1;
+    }
+    written+=r;
+  }
+  return 0;
+}
+
 int http_post_bundle(char *server_and_port, char *auth_token,
 		     char *path,
 		     unsigned char *manifest_data, int manifest_length,
@@ -407,8 +426,9 @@ int http_post_bundle(char *server_and_port, char *auth_token,
   char server_name[1024];
   int server_port=-1;
 
-  // Limit bundle size to 5MB via this transport, to limit memory consumption.
-  if (body_length>(5*1024*1024)) return -1;
+  // The body is streamed straight from where it is, so only the headers and the
+  // manifest need to fit in the request buffer.
+  if ((manifest_length<0)||(manifest_length>8192)) return -1;
   
   if (sscanf(server_and_port,"%[^:]:%d",server_name,&server_port)!=2) return -1;
 
@@ -417,7 +437,7 @@ int http_post_bundle(char *server_and_port, char *auth_token,
   if (strlen(auth_token)>500) return -1;
   if (strlen(path)>500) return -1;
   
-  char request[8192+body_length];
+  char request[8192+8192+1024];
   char authdigest[1024];
   int zero=0;
 
@@ -500,15 +520,15 @@ int http_post_bundle(char *server_and_port, char *auth_token,
 
   int subtotal_len=total_len;
   total_len=total_len+manifest_length;
-  total_len+=snprintf(&request[total_len],8192+body_length-total_len,  
+  total_len+=snprintf(&request[total_len],sizeof(request)-total_len,  
 			   "\r\n"
 			   "--%s\r\n"
 			   "%s",
 			   boundary_string,
 			   body_header);
-  bcopy(body_data,&request[total_len],body_length);
-  total_len=total_len+body_length;
-  total_len+=snprintf(&request[total_len],8192+body_length-total_len,
+  // The body goes between the headers and the trailer
+  int body_offset=total_len;
+  total_len+=snprintf(&request[total_len],sizeof(request)-total_len,
 	   "\r\n"
 	   "--%s--\r\n",
 	   boundary_string);
@@ -518,13 +538,18 @@ int http_post_bundle(char *server_and_port, char *auth_token,
   int present_len=2+boundary_len+2+strlen(manifest_header);
   if  (0) fprintf(stderr,
 		  "    subtotal_len=%d, difference+present=%d (should match content_length)\n",
-		  subtotal_len,total_len-subtotal_len+present_len);
+		  subtotal_len,total_len+body_length-subtotal_len+present_len);
   
   int sock=connect_to_port(server_name,server_port);
   if (sock<0) return -1;
 
   // Write request
-  write_all(sock,request,total_len);
+  if ((write_all(sock,request,body_offset)<0)
+      ||http_write_stream(sock,body_data,body_length)
+      ||(write_all(sock,&request[body_offset],total_len-body_offset)<0)) {
+    close(sock);
+    return -1;
+  }
 
   // Read reply, streaming output to file after we have skipped the header
   int http_response=-1;
@@ -701,6 +701,49 @@ int main(int argc, char **argv)
 	  }
 	  LOG_NOTE("Outernet socket name is '%s'",outernet_socketname);
 	}
+	else if (! strncasecmp("outernetfec=", argv[n], 12)) 
+        {
+          if ((sscanf(&argv[n][12],"%d,%d",
+                      &outernet_zone_packets,&outernet_zone_parity)!=2)
+              ||(outernet_zone_packets<1)||(outernet_zone_packets>16)
+              ||(outernet_zone_parity<0)
+              ||(outernet_zone_parity>=outernet_zone_packets))
+          {
+            LOG_ERROR("outernetfec out of range");
+            fprintf(stderr,"outernetfec must be <packets per zone>,<lost packets tolerated>, with at most 16 packets per zone, and fewer losses than packets.\n");
+            exitVal = -1;
+            break;
+          }
+          LOG_NOTE("outernet_zone_packets=%d, outernet_zone_parity=%d",
+                   outernet_zone_packets,outernet_zone_parity);
+        }
+	else if (! strncasecmp("framesize=", argv[n], 10)) 
+        {
+          radio_frame_size_override = atoi(&argv[n][10]);
+          if ((radio_frame_size_override<128)||(radio_frame_size_override>255))
+          {
+            LOG_ERROR("framesize out of range");
+            fprintf(stderr,"framesize must be between 128 and 255 bytes.\n");
+            exitVal = -1;
+            break;
+          }
+          LOG_NOTE("radio_frame_size_override=%d",radio_frame_size_override);
+        }
+	else if (! strncasecmp("progressblock=", argv[n], 14)) 
+        {
+          int block_size = atoi(&argv[n][14]);
+          if ((block_size<64)||(block_size>65536)||(block_size&(block_size-1)))
+          {
+            LOG_ERROR("progressblock out of range");
+            fprintf(stderr,"progressblock must be a power of two from 64 to 65536 bytes.\n");
+            exitVal = -1;
+            break;
+          }
+          progress_runs_min_block_shift=6;
+          while((1<<progress_runs_min_block_shift)<block_size)
+            progress_runs_min_block_shift++;
+          LOG_NOTE("progress_runs_min_block_shift=%d",progress_runs_min_block_shift);
+        }
 	else if (! strncasecmp("bundlelog=", argv[n], 10)) 
         {
           bundlelog_filename = strdup(&argv[n][10]);
@@ -712,11 +755,43 @@ int main(int argc, char **argv)
             "Will log bundle receipts and peer connectivity to '%s'\n",
             bundlelog_filename);
         } 
+        else if (! strncasecmp("snapshot=", argv[n], 9)) 
+        {
+          bundle_snapshot_filename = strdup(&argv[n][9]);
+          LOG_NOTE("bundle_snapshot_filename: %s", bundle_snapshot_filename);
+        }
+        else if (! strncasecmp("partialspool=", argv[n], 13)) 
+        {
+          partial_spool_dir = strdup(&argv[n][13]);
+          LOG_NOTE("partial_spool_dir: %s", partial_spool_dir);
+        }
         else if (! strcasecmp("nopriority", argv[n])) 
         {
           debug_noprioritisation = 1;
           LOG_NOTE("debug_noprioritisation set to 1");
         }
+        else if (! strncasecmp("syncsaltrotate=", argv[n], 15)) 
+        {
+          sync_salt_rotation_interval = atoi(&argv[n][15]);
+          if (sync_salt_rotation_interval<60)
+          {
+            LOG_ERROR("syncsaltrotate out of range");
+            fprintf(stderr,"syncsaltrotate must be at least 60 seconds.\n");
+            exitVal = -1;
+            break;
+          }
+          LOG_NOTE("sync_salt_rotation_interval=%d",sync_salt_rotation_interval);
+        }
+        else if (! strcasecmp("prioritysync", argv[n])) 
+        {
+          sync_tree_priority_keys = 1;
+          LOG_NOTE("sync_tree_priority_keys set to 1");
+        }
+        else if (! strcasecmp("fountain", argv[n])) 
+        {
+          fountain_pieces = 1;
+          LOG_NOTE("fountain_pieces set to 1");
+        }
         else if (! strcasecmp("nohttpd", argv[n])) 
         {
           http_server = 0;
@@ -870,10 +945,22 @@ int main(int argc, char **argv)
     }
 
     char token[1024] = "";
+
+    // Restore our bundle list from the last snapshot, if we have one, so that we
+    // only need to ask servald for what has changed since.
+    sync_tree_rotate_salt();
+    // Resume any transfers that were in progress when we last stopped.  This has
+    // to happen before we load our bundle list, so that any that have since
+    // arrived by other means are culled.
+    partial_spool_restore();
+    if (bundle_snapshot_filename)
+    {
+      bundle_snapshot_load(bundle_snapshot_filename, token);
+    }
     
     while (exitVal == 0) 
     {
-      unsigned char msg_out[LINK_MTU];
+      unsigned char msg_out[MAX_LINK_MTU];
 
       account_time("ID regenerate");
 
@@ -902,6 +989,18 @@ int main(int argc, char **argv)
 
       load_rhizome_db_async(servald_server, credential, token);
 
+      account_time("sync_tree_rotate_salt()");
+
+      sync_tree_rotate_salt();
+
+      account_time("bundle_snapshot_serviceloop()");
+
+      bundle_snapshot_serviceloop(token);
+
+      account_time("active_peers_serviceloop()");
+
+      active_peers_serviceloop();
+
       account_time("make_periodic_requests()");
 
       make_periodic_requests();
@@ -1060,7 +1159,7 @@ int main(int argc, char **argv)
             serialfd,
             my_sid,
             my_sid_hex,
-            LINK_MTU,
+            MAX_LINK_MTU,
             msg_out,
             servald_server,
             credential);
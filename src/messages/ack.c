@@ -44,26 +44,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 int sync_schedule_progress_report(int peer, int partial, int randomJump)
 {
-  int slot=report_queue_length;
-
-  for(int i=0;i<report_queue_length;i++) {
-    if (report_queue_peers[i]==peer_records[peer]) {
-      // We already want to tell this peer something.
-      // We should only need to tell a peer one thing at a time.
-      slot=i; break;
-    }
-  }
-
   // Work out where we will request data to be sent from
   int isReallyFirstByte=0;
   int first_required_body_offset
     =partial_find_missing_byte(partials[partial].body_segments,&isReallyFirstByte);
-  
-  if (slot>=REPORT_QUEUE_LEN) slot=random()%REPORT_QUEUE_LEN;
 
-  // Mark utilisation of slot, so that we can flush out stale messages
-  report_queue_partials[slot]=partial;
-  report_queue_peers[slot]=peer_records[peer];
+  int slot=report_queue_slot(peer,
+			     partials[partial].bid_prefix_bin,
+			     REPORT_TYPE_ACK,partial,"progress report (ACK)");
+  if (slot<0) return -1;
   
   int ofs=0;
 
@@ -84,16 +73,6 @@ int sync_schedule_progress_report(int peer, int partial, int randomJump)
     else report_queue[slot][ofs++]='A';
   }
 
-  if (report_queue_message[slot]) {
-    fprintf(stderr,"Replacing report_queue message '%s' with 'progress report' (ACK)\n",
-	    slot>=0?(report_queue_message[slot]?report_queue_message[slot]:"< report_queue_message=slot >"):"< slot<0 >");
-    free(report_queue_message[slot]);
-    report_queue_message[slot]=NULL;
-  } else {
-    fprintf(stderr,"Setting report_queue message to 'progress report' (ACK)\n");
-  }
-  report_queue_message[slot]=strdup("progress report");
-
   // BID prefix
   for(int i=0;i<8;i++) {
     int hex_value=0;
@@ -126,7 +105,6 @@ int sync_schedule_progress_report(int peer, int partial, int randomJump)
   
   report_lengths[slot]=ofs;
   assert(ofs<MAX_REPORT_LEN);
-  if (slot>=report_queue_length) report_queue_length=slot+1;
 
   if (randomJump) {
     if (!monitor_mode)
@@ -187,6 +165,12 @@ int sync_parse_ack(struct peer_state *p,unsigned char *msg,
 	  msg[1],msg[2],msg[3],msg[4],msg[5],msg[6],msg[7],msg[8],
 	  bundle,bundle_count);
 
+  // Whoever the ACK is for, an 'F' or 'f' ACK tells us how much of a journal the
+  // sender already has.  'A' and 'a' ACKs only point at some byte they still need,
+  // which may not be the first.
+  if (p&&((msg[0]=='F')||(msg[0]=='f'))&&(body_offset>=0)&&journal_bundle_p(bundle))
+    journal_note_peer_holds(p,bundles[bundle].bid_bin,body_offset);
+
   if (!for_me) return 0;
   
   // Sanity check inputs, so that we don't mishandle memory.
@@ -52,8 +52,19 @@ int sync_append_some_bundle_bytes(int bundle_number,int start_offset,int len,
   int actual_bytes=0;
   int not_end_of_item=0;
 
+  // Use the short header form if all our peers understand it (see
+  // compressed_piece.c)
+  int compressed=compressed_pieces_tx&&(start_offset<=0xffffff);
+  int context_slot=-1,context_announce=0;
+  if (compressed) {
+    context_slot=piece_context_slot(bundle_number,cached_version,&context_announce);
+    max_bytes=mtu-(*offset)-piece_context_header_len(start_offset);
+    if (context_announce) max_bytes-=PIECE_CONTEXT_BINDING_LEN;
+    if (max_bytes>0xff) max_bytes=0xff;
+  }
+
   // If we can't announce even one byte, we should just give up.
-  if (start_offset>0xfffff) {
+  if ((!compressed)&&(start_offset>0xfffff)) {
     max_bytes-=2; if (max_bytes<0) max_bytes=0;
   }
   if (max_bytes<1) return -1;
@@ -91,38 +102,44 @@ int sync_append_some_bundle_bytes(int bundle_number,int start_offset,int len,
 						       start_offset,actual_bytes);
   dump_peer_tx_bitmap(target_peer);
   
-  // Generate 4 byte offset block (and option 2-byte extension for big bundles)
-  long long offset_compound=0;
-  offset_compound=(start_offset&0xfffff);
-  offset_compound|=((actual_bytes&0x7ff)<<20);
-  if (is_manifest) offset_compound|=0x80000000;
-  offset_compound|=((start_offset>>20LL)&0xffffLL)<<32LL;
-
-  // Now write the 23/25 byte header and actual bytes into output message
-  // BID prefix (8 bytes)
-  if (start_offset>0xfffff)
-    msg[(*offset)++]='P'+not_end_of_item;
-  else 
-    msg[(*offset)++]='p'+not_end_of_item;
-
-  // Intended recipient
-  msg[(*offset)++]=peer_records[target_peer]->sid_prefix_bin[0];
-  msg[(*offset)++]=peer_records[target_peer]->sid_prefix_bin[1];
+  if (compressed)
+    piece_context_append_piece(context_slot,context_announce,target_peer,
+			       start_offset,actual_bytes,is_manifest,not_end_of_item,
+			       p,offset,msg);
+  else {
+    // Generate 4 byte offset block (and option 2-byte extension for big bundles)
+    long long offset_compound=0;
+    offset_compound=(start_offset&0xfffff);
+    offset_compound|=((actual_bytes&0x7ff)<<20);
+    if (is_manifest) offset_compound|=0x80000000;
+    offset_compound|=((start_offset>>20LL)&0xffffLL)<<32LL;
+
+    // Now write the 23/25 byte header and actual bytes into output message
+    // BID prefix (8 bytes)
+    if (start_offset>0xfffff)
+      msg[(*offset)++]='P'+not_end_of_item;
+    else 
+      msg[(*offset)++]='p'+not_end_of_item;
+
+    // Intended recipient
+    msg[(*offset)++]=peer_records[target_peer]->sid_prefix_bin[0];
+    msg[(*offset)++]=peer_records[target_peer]->sid_prefix_bin[1];
   
-  for(int i=0;i<8;i++) msg[(*offset)++]=bundles[bundle_number].bid_bin[i];
-  // Bundle version (8 bytes)
-  for(int i=0;i<8;i++)
-    msg[(*offset)++]=(cached_version>>(i*8))&0xff;
-  // offset_compound (4 bytes)
-  for(int i=0;i<4;i++)
-    msg[(*offset)++]=(offset_compound>>(i*8))&0xff;
-  if (start_offset>0xfffff) {
-    for(int i=4;i<6;i++)
+    for(int i=0;i<8;i++) msg[(*offset)++]=bundles[bundle_number].bid_bin[i];
+    // Bundle version (8 bytes)
+    for(int i=0;i<8;i++)
+      msg[(*offset)++]=(cached_version>>(i*8))&0xff;
+    // offset_compound (4 bytes)
+    for(int i=0;i<4;i++)
       msg[(*offset)++]=(offset_compound>>(i*8))&0xff;
-  }
+    if (start_offset>0xfffff) {
+      for(int i=4;i<6;i++)
+	msg[(*offset)++]=(offset_compound>>(i*8))&0xff;
+    }
 
-  bcopy(p,&msg[(*offset)],actual_bytes);
-  (*offset)+=actual_bytes;
+    bcopy(p,&msg[(*offset)],actual_bytes);
+    (*offset)+=actual_bytes;
+  }
 
   /* Advance the cursor for sending this bundle to all other peers if their cursor
      sits within the window we have just sent. */
@@ -174,17 +191,16 @@ int sync_append_some_bundle_bytes(int bundle_number,int start_offset,int len,
   return actual_bytes;
 }
 
-int saw_piece(char *peer_prefix,int for_me,
-	      char *bid_prefix, unsigned char *bid_prefix_bin,
-	      long long version,
-	      long long piece_offset,int piece_bytes,int is_end_piece,
-	      int is_manifest_piece,unsigned char *piece,
-
-	      char *prefix, char *servald_server, char *credential)
+int saw_piece_find_partial(char *peer_prefix,int for_me,
+			   char *bid_prefix, unsigned char *bid_prefix_bin,
+			   long long version,
+			   long long piece_offset,int piece_bytes,int is_manifest_piece,
+			   int *peer_out,int *bundle_number_out)
 {
-  int next_byte_would_be_useful=0;
-  int new_bytes_in_piece=0;
-  
+  /* Find or make the partial for a piece of a bundle that we have just seen.
+     Returns -1 if the piece came from a peer we don't know, or -2 if we already
+     have that version of the bundle (in which case we will tell the sender).
+  */
   int peer=find_peer_by_prefix(peer_prefix);
   if (peer<0) {
     printf(">>> %s Saw a piece from unknown SID=%s* -- ignoring.\n",
@@ -192,15 +208,13 @@ int saw_piece(char *peer_prefix,int for_me,
     return -1;
   }
 
-  if (debug_pieces)
-  printf(">>> %s Saw a piece of BID=%s* from SID=%s*: %s [%lld,%lld) %s\n",
-	 timestamp_str(),bid_prefix,peer_prefix,
-	 is_manifest_piece?"manifest":"body",
-	 piece_offset,piece_offset+piece_bytes,
-	 is_end_piece?"END PIECE":"");
-  
+  *peer_out=peer;
   int bundle_number=-1;
 
+  // A peer sending a journal has all of that version of it
+  if (version<0x100000000LL)
+    journal_note_peer_holds(peer_records[peer],bid_prefix_bin,version);
+
   // Send an ack immediately if we already have this bundle (or newer), so that the
   // sender knows that they can start sending something else.
   // This in effect provides a positive ACK for reception of a new bundle.
@@ -216,7 +230,7 @@ int saw_piece(char *peer_prefix,int for_me,
 	      "We recently received %s* version %lld - ignoring piece.\n",
 	      bid_prefix,version);
       sync_tell_peer_we_have_bundle_by_id(peer,bid_prefix_bin,version);
-      return 0;      
+      return -2;      
     }
   }
   for(int i=0;i<bundle_count;i++) {
@@ -247,7 +261,7 @@ int saw_piece(char *peer_prefix,int for_me,
 							       piece_offset,piece_bytes);
 	}
 	
-	return 0;
+	return -2;
       } else {
 	// We have an older version.
 	// Remember the bundle number so that we can pre-fetch the body we have
@@ -268,62 +282,57 @@ int saw_piece(char *peer_prefix,int for_me,
 							 piece_offset,piece_bytes);
   }
   
-  int i;
-  int spare_record=random()%MAX_BUNDLES_IN_FLIGHT;
-  for(i=0;i<MAX_BUNDLES_IN_FLIGHT;i++) {
-    if (!partials[i].bid_prefix) {
-      if (spare_record==-1) spare_record=i;
-    } else {
-      if (!strcasecmp(partials[i].bid_prefix,bid_prefix))
-	{
-	  if (debug_pieces) printf("Saw another piece for BID=%s* from SID=%s: ",
-			 bid_prefix,peer_prefix);
-	  if (debug_pieces) printf("[%lld..%lld)\n",
-			 piece_offset,piece_offset+piece_bytes);
-
-	  break;
-	}
-      else {
-	if (debug_pieces) {
-	  printf("  this isn't the partial we are looking for.\n");
-	  printf("  piece is of %s*, but slot #%d has %s*\n",
-		 bid_prefix,i,
-		 partials[i].bid_prefix);
-	}
-      }
-    }
+  int i=partial_find(bid_prefix_bin);
+  if (i>=0) {
+    if (debug_pieces) printf("Saw another piece for BID=%s* from SID=%s: ",
+			     bid_prefix,peer_prefix);
+    if (debug_pieces) printf("[%lld..%lld)\n",
+			     piece_offset,piece_offset+piece_bytes);
   }
 
   if (debug_pieces)
     printf("Saw a piece of interesting bundle BID=%s*/%lld from SID=%s\n",
 	    bid_prefix,version, peer_prefix);
   
-  if (i==MAX_BUNDLES_IN_FLIGHT) {
-    if (spare_record>0) i=spare_record;
-    if (debug_pieces)
-      printf("Didn't find bundle in partials for this peer. first spare slot =%d\n",spare_record);
-    // Didn't find bundle in the progress list.
-    // Abort one of the ones in the list at random, and replace, unless there is
-    // a spare record slot to use.
-    if (spare_record==-1) {
-      i=random()%MAX_BUNDLES_IN_FLIGHT;
-      clear_partial(&partials[i]);
-    } else {
-      i=spare_record;
-      // Clear it just to make sure.
-      clear_partial(&partials[i]);
-    }
+  if (i<0) {
+    // Didn't find bundle in the progress list, so start a new one, giving up on
+    // the least promising one if there is no room.
+    i=partial_allocate(bid_prefix,bid_prefix_bin,version);
+    if (partial_spool_dir) partial_spool_create(&partials[i]);
     if (debug_pieces)
       printf("@@@   Using slot %d\n",i);
-
-    // Now prepare the partial record
-    partials[i].bid_prefix=strdup(bid_prefix);
-    partials[i].bundle_version=version;
-    partials[i].manifest_length=-1;
-    partials[i].body_length=-1;
   }
 
   partial_update_recent_senders(&partials[i],peer_prefix);
+  *bundle_number_out=bundle_number;
+
+  return i;
+}
+
+int saw_piece(char *peer_prefix,int for_me,
+	      char *bid_prefix, unsigned char *bid_prefix_bin,
+	      long long version,
+	      long long piece_offset,int piece_bytes,int is_end_piece,
+	      int is_manifest_piece,unsigned char *piece,
+
+	      char *prefix, char *servald_server, char *credential)
+{
+  int next_byte_would_be_useful=0;
+  int new_bytes_in_piece=0;
+
+  if (debug_pieces)
+  printf(">>> %s Saw a piece of BID=%s* from SID=%s*: %s [%lld,%lld) %s\n",
+	 timestamp_str(),bid_prefix,peer_prefix,
+	 is_manifest_piece?"manifest":"body",
+	 piece_offset,piece_offset+piece_bytes,
+	 is_end_piece?"END PIECE":"");
+
+  int peer,bundle_number;
+  int i=saw_piece_find_partial(peer_prefix,for_me,bid_prefix,bid_prefix_bin,version,
+			       piece_offset,piece_bytes,is_manifest_piece,
+			       &peer,&bundle_number);
+  if (i==-1) return -1;
+  if (i<0) return 0;
   
   int piece_end=piece_offset+piece_bytes;
 
@@ -345,18 +354,17 @@ int saw_piece(char *peer_prefix,int for_me,
     // for which we as yet have no body segments.  So fetch from Rhizome the content
     // that we do have, and prepopulate the body segment.
     fprintf(stderr,"%s:%d:My SID as hex is %s\n",__FILE__,__LINE__,my_sid_hex);
-    if (!prime_bundle_cache(bundle_number,my_sid_hex,servald_server,credential)) {
-      struct segment_list *s=calloc(1,sizeof(struct segment_list));
-      assert(s);
-      s->data=malloc(cached_body_len);
-      assert(s->data);
-      bcopy(cached_body,s->data,cached_body_len);
-      s->start_offset=0;
-      s->length=cached_body_len;
-      partials[i].body_segments=s;
+    // (fetched without displacing the bundle we are sending from the TX cache)
+    unsigned char *old_body=NULL;
+    int old_body_len=0;
+    if (!bundle_cache_fetch_body(bundle_number,my_sid_hex,servald_server,credential,
+				 &old_body,&old_body_len)) {
+      partials[i].body_segments=partial_segment_new(&partials[i],0,0,old_body_len,
+						    old_body);
+      bundle_cache_release_fetched_body(old_body,old_body_len);
       if (debug_pieces)
 	printf("Preloaded %d bytes from old version of journal bundle.\n",
-		cached_body_len);
+		old_body_len);
     } else {
       if (debug_pieces)
 	printf("Failed to preload bytes from old version of journal bundle. XFER will likely fail due to far end thinking it can skip the bytes we already have, so ignoring current piece.\n");
@@ -392,8 +400,9 @@ int saw_piece(char *peer_prefix,int for_me,
 		     piece_offset,piece_offset+piece_bytes,
 		     segment_start,segment_end);
 
-      struct segment_list *ns=calloc(1,sizeof(struct segment_list));
-      assert(ns);
+      // Set start and ends and copy in piece data
+      struct segment_list *ns=partial_segment_new(&partials[i],is_manifest_piece,
+						  piece_offset,piece_bytes,piece);
 
       // Link into the list
       ns->next=*s;
@@ -401,12 +410,6 @@ int saw_piece(char *peer_prefix,int for_me,
       if (*s) (*s)->prev=ns;
       *s=ns;
 
-      // Set start and ends and allocate and copy in piece data
-      ns->start_offset=piece_offset;
-      ns->length=piece_bytes;
-      ns->data=malloc(piece_bytes);
-      bcopy(piece,ns->data,piece_bytes);
-
       // This is data that is new, and the next byte would also be new, so
       // no need to tell the peer to change where they are sending from in the bundle.
       next_byte_would_be_useful=1;
@@ -452,25 +455,15 @@ int saw_piece(char *peer_prefix,int for_me,
       if (piece_start<segment_start) {
 	// Need to stick bytes on the start
 	int extra_bytes=segment_start-piece_start;
-	int new_length=(*s)->length+extra_bytes;
-	unsigned char *d=malloc(new_length);
-        assert(d);
-	bcopy(piece,d,extra_bytes);
-	bcopy((*s)->data,&d[extra_bytes],(*s)->length);
-	(*s)->start_offset=piece_start;
-	(*s)->length=new_length;
-	free((*s)->data); (*s)->data=d;
+	partial_segment_add_bytes(&partials[i],is_manifest_piece,*s,
+				  piece_start,extra_bytes,piece);
 	new_bytes_in_piece+=extra_bytes;
       }
       if (piece_end>segment_end) {
 	// Need to sick bytes on the end
 	int extra_bytes=piece_end-segment_end;
-	int new_length=(*s)->length+extra_bytes;
-	(*s)->data=realloc((*s)->data,new_length);
-        assert((*s)->data);
-	bcopy(&piece[piece_bytes-extra_bytes],&(*s)->data[(*s)->length],
-	      extra_bytes);
-	(*s)->length=new_length;
+	partial_segment_add_bytes(&partials[i],is_manifest_piece,*s,segment_end,
+				  extra_bytes,&piece[piece_bytes-extra_bytes]);
 	new_bytes_in_piece+=extra_bytes;
 
 	// We have extended beyond the end, so the next byte is most likely
@@ -484,12 +477,19 @@ int saw_piece(char *peer_prefix,int for_me,
     } 
   }
 
+  // Plain pieces also count towards decoding any coded pieces we have received,
+  // and may be all the decoder needed to reconstruct the rest of the body.
+  if ((!is_manifest_piece)&&partials[i].fountain)
+    partial_fountain_add_piece(&partials[i],piece_offset,piece_bytes,piece);
+
   merge_segments(&partials[i].manifest_segments);
   merge_segments(&partials[i].body_segments);
+  partial_spool_note_progress(&partials[i]);
   partial_update_request_bitmap(&partials[i]);
   fprintf(stderr,"(Piece was [%lld,%lld)\n",piece_offset,piece_offset+piece_bytes);
 
   partials[i].recent_bytes += piece_bytes;
+  if (new_bytes_in_piece) partials[i].last_progress_time=time(0);
   
   // Check if we have the whole bundle now
   // XXX - this breaks when we have nothing about the bundle, because then we think the length is zero, so we think we have it all, when really we have none.
@@ -656,7 +656,7 @@ int message_parser_50(struct peer_state *sender,char *sender_prefix,
 
   char bid_prefix[8*2+1];
   long long version;
-  unsigned int offset_compound;
+  long long offset_compound;
   long long piece_offset;
   int piece_bytes;
   int piece_is_manifest;
@@ -68,19 +68,11 @@ int saw_length(char *peer_prefix,char *bid_prefix,long long version,
   int peer=find_peer_by_prefix(peer_prefix);
   if (peer<0) return -1;
 
-  int i;
-  int spare_record=random()%MAX_BUNDLES_IN_FLIGHT;
-  for(i=0;i<MAX_BUNDLES_IN_FLIGHT;i++) {
-    if (!partials[i].bid_prefix) {
-      if (spare_record==-1) spare_record=i;
-    } else {
-      if (!strcasecmp(partials[i].bid_prefix,bid_prefix))
-	if (partials[i].bundle_version==version)
-	  {
-	    partials[i].body_length=body_length;
-	    return 0;
-	  }
-    }
+  int i=partial_find(bid_prefix_hex_to_bin(bid_prefix));
+  if ((i>=0)&&(partials[i].bundle_version==version)) {
+    partials[i].body_length=body_length;
+    partial_spool_note_progress(&partials[i]);
+    return 0;
   }
   return -1;
 }
@@ -0,0 +1,254 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2016 Serval Project Inc.
+
+This program monitors a local Rhizome database and attempts
+to synchronise it over low-bandwidth declarative transports,
+such as bluetooth name or wifi-direct service information
+messages.  It is intended to give a high priority to MeshMS
+converations among nearby nodes.
+
+The design is fully asynchronous, so a call to the update_my_message()
+function from time to time should be all that is required.
+
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+  Coded bundle body pieces.
+
+  Once we have sent every piece of a bundle body, any piece we resend is only
+  useful to the receivers that missed that particular piece.  When several peers
+  are listening, each has lost different pieces, so instead we send blocks coded
+  from the whole body (see src/fec/fountain.c), each of which helps every receiver
+  that still lacks part of the body.
+
+  'C' messages carry one or more coded blocks:
+  2 bytes : target SID prefix
+  8 bytes : BID prefix
+  8 bytes : version
+  4 bytes : body length
+  4 bytes : seed of first block (subsequent blocks use consecutive seeds)
+  1 byte  : number of blocks
+  then FOUNTAIN_BLOCK_SIZE bytes for each block.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#include "sync.h"
+#include "lbard.h"
+
+#define CODED_PIECE_HEADER_LEN (1+2+8+8+4+4+1)
+
+int fountain_pieces=0;
+
+int sync_bundle_can_be_coded(int bundle_number)
+{
+  if (!fountain_pieces) return 0;
+  // Journal bundles are sent from where the recipient's old copy ends, so coding
+  // the whole body would be a waste.
+  if (bundles[bundle_number].version<0x100000000LL) return 0;
+  int blocks=fountain_block_count(bundles[bundle_number].length);
+  return (blocks>0)&&(blocks<=FOUNTAIN_MAX_BLOCKS);
+}
+
+int sync_append_coded_bundle_blocks(int bundle_number,
+				    unsigned char *body,int body_len,
+				    int *offset,int mtu,unsigned char *msg,
+				    int target_peer)
+{
+  int blocks=fountain_block_count(body_len);
+  if ((blocks<1)||(blocks>FOUNTAIN_MAX_BLOCKS)) return -1;
+
+  int count=(mtu-(*offset)-CODED_PIECE_HEADER_LEN)/FOUNTAIN_BLOCK_SIZE;
+  if (count<1) return 0;
+  if (count>255) count=255;
+
+  // Seeds below the block count are the plain blocks, which the receivers have
+  // already had their chance at.  Pick the rest at random, so that anyone else
+  // sending this bundle is unlikely to send the same blocks as us.
+  unsigned int seed=blocks+(random()%(0x7fffffff-blocks-count));
+
+  msg[(*offset)++]='C';
+  msg[(*offset)++]=peer_records[target_peer]->sid_prefix_bin[0];
+  msg[(*offset)++]=peer_records[target_peer]->sid_prefix_bin[1];
+  for(int i=0;i<8;i++) msg[(*offset)++]=bundles[bundle_number].bid_bin[i];
+  for(int i=0;i<8;i++) msg[(*offset)++]=(cached_version>>(i*8))&0xff;
+  for(int i=0;i<4;i++) msg[(*offset)++]=(body_len>>(i*8))&0xff;
+  for(int i=0;i<4;i++) msg[(*offset)++]=(seed>>(i*8))&0xff;
+  msg[(*offset)++]=count;
+
+  for(int i=0;i<count;i++) {
+    fountain_encode_block(body,body_len,seed+i,&msg[*offset]);
+    (*offset)+=FOUNTAIN_BLOCK_SIZE;
+  }
+
+  printf(">>> %s I just sent %d coded blocks of %s* (%d blocks) for %s*.\n",
+	 timestamp_str(),count,bundles[bundle_number].bid_hex,blocks,
+	 peer_records[target_peer]->sid_prefix);
+
+  return count*FOUNTAIN_BLOCK_SIZE;
+}
+
+static int partial_fountain_adopt_body(struct partial_bundle *p)
+{
+  // Replace whatever body segments we had with the decoded body
+  while(p->body_segments) {
+    struct segment_list *s=p->body_segments;
+    p->body_segments=s->next;
+    if (!s->spooled) free(s->data);
+    free(s);
+  }
+
+  p->body_segments=partial_segment_new(p,0,0,p->body_length,
+				       fountain_decoder_body(p->fountain));
+
+  fountain_decoder_free(p->fountain);
+  p->fountain=NULL;
+
+  if (debug_pieces)
+    printf(">>> %s Decoded all %d bytes of %s* from coded pieces.\n",
+	   timestamp_str(),p->body_length,p->bid_prefix);
+  return 0;
+}
+
+int partial_fountain_add_piece(struct partial_bundle *p,long long piece_offset,
+			       int piece_bytes,unsigned char *piece)
+{
+  if (!p->fountain) return 0;
+  fountain_decoder_add_bytes(p->fountain,piece_offset,piece_bytes,piece);
+  if (!fountain_decoder_complete(p->fountain)) return 0;
+  partial_fountain_adopt_body(p);
+  return 1;
+}
+
+int saw_coded_piece(char *peer_prefix,int for_me,
+		    char *bid_prefix, unsigned char *bid_prefix_bin,
+		    long long version,int body_length,
+		    unsigned int seed,int count,unsigned char *blocks,
+		    char *prefix, char *servald_server, char *credential)
+{
+  if (version<0x100000000LL) return -1;
+  int block_count=fountain_block_count(body_length);
+  if ((block_count<1)||(block_count>FOUNTAIN_MAX_BLOCKS)) return -1;
+
+  int peer,bundle_number;
+  int i=saw_piece_find_partial(peer_prefix,for_me,bid_prefix,bid_prefix_bin,version,
+			       0,0,0,&peer,&bundle_number);
+  if (i==-1) return -1;
+  if (i<0) return 0;
+  struct partial_bundle *p=&partials[i];
+
+  if (p->body_length==-1) p->body_length=body_length;
+  if (p->body_length!=body_length) {
+    fprintf(stderr,"Coded piece of %s* says body is %d bytes, but we think it is %d bytes -- ignoring.\n",
+	    bid_prefix,body_length,p->body_length);
+    return -1;
+  }
+
+  if (!p->fountain) {
+    p->fountain=fountain_decoder_new(body_length);
+    if (!p->fountain) return -1;
+    // Everything we have received as plain pieces counts towards decoding
+    for(struct segment_list *s=p->body_segments;s;s=s->next)
+      fountain_decoder_add_bytes(p->fountain,s->start_offset,s->length,s->data);
+  }
+
+  int useful=0;
+  for(int b=0;b<count;b++)
+    if (fountain_decoder_add(p->fountain,seed+b,&blocks[b*FOUNTAIN_BLOCK_SIZE])>0)
+      useful++;
+  p->recent_bytes+=count*FOUNTAIN_BLOCK_SIZE;
+  if (useful) p->last_progress_time=time(0);
+
+  if (debug_pieces)
+    printf(">>> %s Saw %d coded blocks (%d useful) of %s* from %s*: have %d of %d blocks.\n",
+	   timestamp_str(),count,useful,bid_prefix,peer_prefix,
+	   fountain_decoder_rank(p->fountain),block_count);
+
+  if (!fountain_decoder_complete(p->fountain)) return 0;
+
+  // Let saw_piece() finish off the bundle, as though the whole body had arrived
+  // as a single piece.
+  partial_fountain_adopt_body(p);
+  return saw_piece(peer_prefix,for_me,bid_prefix,bid_prefix_bin,version,
+		   0,body_length,1,0,p->body_segments->data,
+		   prefix,servald_server,credential);
+}
+
+int message_parser_43(struct peer_state *sender,char *sender_prefix,
+		      char *servald_server, char *credential,
+		      unsigned char *msg,int length)
+{
+  int offset=0;
+  if (length<CODED_PIECE_HEADER_LEN) return -1;
+
+  // Skip header character
+  offset++;
+
+  int for_me=((my_sid[0]==msg[offset])&&(my_sid[1]==msg[offset+1]));
+  offset+=2;
+
+  char bid_prefix[8*2+1];
+  unsigned char *bid_prefix_bin=&msg[offset];
+  snprintf(bid_prefix,8*2+1,"%02x%02x%02x%02x%02x%02x%02x%02x",
+	   msg[offset+0],msg[offset+1],msg[offset+2],msg[offset+3],
+	   msg[offset+4],msg[offset+5],msg[offset+6],msg[offset+7]);
+  offset+=8;
+  long long version=0;
+  for(int i=0;i<8;i++) version|=((long long)msg[offset+i])<<(i*8LL);
+  offset+=8;
+  unsigned int body_length=0;
+  for(int i=0;i<4;i++) body_length|=((unsigned int)msg[offset+i])<<(i*8);
+  offset+=4;
+  unsigned int seed=0;
+  for(int i=0;i<4;i++) seed|=((unsigned int)msg[offset+i])<<(i*8);
+  offset+=4;
+  int count=msg[offset++];
+
+  if ((length-offset)<count*FOUNTAIN_BLOCK_SIZE) return -1;
+
+  if (monitor_mode)
+    {
+      char sender_prefix[128];
+      char monitor_log_buf[1024];
+      sprintf(sender_prefix,"%s*",sender->sid_prefix);
+      snprintf(monitor_log_buf,sizeof(monitor_log_buf),
+	       "Coded piece of bundle: BID=%s*, %d blocks of %d byte payload.",
+	       bid_prefix,count,body_length);
+
+      monitor_log(sender_prefix,NULL,monitor_log_buf);
+    }
+
+  if (body_length<=FOUNTAIN_MAX_BLOCKS*FOUNTAIN_BLOCK_SIZE)
+    saw_coded_piece(sender_prefix,for_me,
+		    bid_prefix,bid_prefix_bin,
+		    version,body_length,seed,count,&msg[offset],
+		    prefix,servald_server,credential);
+
+  offset+=count*FOUNTAIN_BLOCK_SIZE;
+  return offset;
+}
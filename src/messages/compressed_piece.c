@@ -0,0 +1,254 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2016 Serval Project Inc.
+
+This program monitors a local Rhizome database and attempts
+to synchronise it over low-bandwidth declarative transports,
+such as bluetooth name or wifi-direct service information
+messages.  It is intended to give a high priority to MeshMS
+converations among nearby nodes.
+
+The design is fully asynchronous, so a call to the update_my_message()
+function from time to time should be all that is required.
+
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+  Compressed bundle piece headers.
+
+  A plain piece message spends 21 bytes on saying who it is for, which bundle and
+  version it belongs to, and where it goes.  Most of that is the same for every
+  piece we send of a bundle, so instead we give each bundle we are sending a short
+  slot number, tell our peers once which bundle that is, and then just refer to
+  the slot.  This gets the header down to 11 bytes.
+
+  'K' messages bind a slot to a bundle (PIECE_CONTEXT_BINDING_LEN bytes):
+  1 byte : slot
+  8 bytes : BID prefix
+  8 bytes : version
+
+  'x' messages carry a piece:
+  1 byte : slot (low 4 bits), manifest (0x10), not end of item (0x20),
+           3 byte offset (0x40)
+  4 bytes : tag, a hash of the BID prefix and version, to catch use of a slot we
+            have the wrong binding for
+  2 bytes : target SID prefix
+  2 or 3 bytes : offset
+  1 byte : length
+  then the bytes of the piece.
+
+  Pieces arrive in whole packets or not at all, so the binding goes in the same
+  packet as the first few pieces that use a slot, and is then repeated every few
+  packets for the benefit of peers that missed it.  A peer that doesn't know the
+  binding for a slot simply ignores pieces from it, as though they were lost.
+  Offsets are sent in full rather than as a difference from the previous piece, as
+  a receiver that missed that piece would otherwise put the data in the wrong place.
+
+  Older versions of LBARD stop parsing a packet when they see a message type they
+  don't know, so we only use these once all our active peers have told us that
+  they understand them (see fec_choose_tx_level()).
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#include "sync.h"
+#include "lbard.h"
+
+// Announce a new binding in this many packets, and then at least this often
+#define PIECE_CONTEXT_REPEAT 4
+#define PIECE_CONTEXT_REFRESH 8
+
+struct piece_context_tx {
+  unsigned char bid_prefix_bin[8];
+  long long version;
+  int valid;
+  int assigned_at;
+  int announced_at;
+  int last_used;
+};
+
+struct piece_context_tx piece_context_tx[PIECE_CONTEXT_SLOTS];
+
+static uint32_t piece_context_tag(unsigned char *bid_prefix_bin,long long version)
+{
+  // 32-bit FNV-1a over the BID prefix and version
+  uint32_t h=0x811c9dc5;
+  for(int i=0;i<8;i++) { h^=bid_prefix_bin[i]; h*=0x01000193; }
+  for(int i=0;i<8;i++) { h^=(version>>(i*8))&0xff; h*=0x01000193; }
+  return h;
+}
+
+int piece_context_header_len(long long start_offset)
+{
+  return 1+1+4+2+(start_offset>0xffff?3:2)+1;
+}
+
+// Find or assign a slot for this bundle, and say if we need to (re)announce it in
+// this packet.
+int piece_context_slot(int bundle_number,long long version,int *announce)
+{
+  int slot=-1;
+  for(int i=0;i<PIECE_CONTEXT_SLOTS;i++)
+    if (piece_context_tx[i].valid
+	&&(piece_context_tx[i].version==version)
+	&&(!memcmp(piece_context_tx[i].bid_prefix_bin,bundles[bundle_number].bid_bin,8)))
+      { slot=i; break; }
+
+  if (slot==-1) {
+    // Reuse the slot that has gone unused for longest
+    slot=0;
+    for(int i=0;i<PIECE_CONTEXT_SLOTS;i++) {
+      if (!piece_context_tx[i].valid) { slot=i; break; }
+      if (piece_context_tx[i].last_used<piece_context_tx[slot].last_used) slot=i;
+    }
+    bcopy(bundles[bundle_number].bid_bin,piece_context_tx[slot].bid_prefix_bin,8);
+    piece_context_tx[slot].version=version;
+    piece_context_tx[slot].valid=1;
+    piece_context_tx[slot].assigned_at=message_counter;
+    piece_context_tx[slot].announced_at=message_counter-PIECE_CONTEXT_REFRESH;
+  }
+
+  struct piece_context_tx *c=&piece_context_tx[slot];
+  *announce=(c->announced_at!=message_counter)
+    &&(((message_counter-c->assigned_at)<PIECE_CONTEXT_REPEAT)
+       ||((message_counter-c->announced_at)>=PIECE_CONTEXT_REFRESH));
+  return slot;
+}
+
+int piece_context_append_piece(int slot,int announce,int target_peer,
+			       long long start_offset,int bytes,
+			       int is_manifest,int not_end_of_item,
+			       unsigned char *p,int *offset,unsigned char *msg)
+{
+  struct piece_context_tx *c=&piece_context_tx[slot];
+
+  if (announce) {
+    msg[(*offset)++]='K';
+    msg[(*offset)++]=slot;
+    for(int i=0;i<8;i++) msg[(*offset)++]=c->bid_prefix_bin[i];
+    for(int i=0;i<8;i++) msg[(*offset)++]=(c->version>>(i*8))&0xff;
+    c->announced_at=message_counter;
+  }
+  c->last_used=message_counter;
+
+  msg[(*offset)++]='x';
+  msg[(*offset)++]=slot|(is_manifest?0x10:0)|(not_end_of_item?0x20:0)
+    |(start_offset>0xffff?0x40:0);
+  uint32_t tag=piece_context_tag(c->bid_prefix_bin,c->version);
+  for(int i=0;i<4;i++) msg[(*offset)++]=(tag>>(i*8))&0xff;
+  msg[(*offset)++]=peer_records[target_peer]->sid_prefix_bin[0];
+  msg[(*offset)++]=peer_records[target_peer]->sid_prefix_bin[1];
+  msg[(*offset)++]=(start_offset>>0)&0xff;
+  msg[(*offset)++]=(start_offset>>8)&0xff;
+  if (start_offset>0xffff) msg[(*offset)++]=(start_offset>>16)&0xff;
+  msg[(*offset)++]=bytes;
+
+  bcopy(p,&msg[(*offset)],bytes);
+  (*offset)+=bytes;
+  return 0;
+}
+
+int message_parser_4B(struct peer_state *sender,char *sender_prefix,
+		      char *servald_server, char *credential,
+		      unsigned char *msg,int length)
+{
+  if (length<PIECE_CONTEXT_BINDING_LEN) return -1;
+  int slot=msg[1];
+  if (slot>=PIECE_CONTEXT_SLOTS) return PIECE_CONTEXT_BINDING_LEN;
+
+  struct piece_context_rx *c=&sender->piece_context[slot];
+  bcopy(&msg[2],c->bid_prefix_bin,8);
+  c->version=0;
+  for(int i=0;i<8;i++) c->version|=((long long)msg[10+i])<<(i*8LL);
+  c->valid=1;
+
+  return PIECE_CONTEXT_BINDING_LEN;
+}
+
+int message_parser_78(struct peer_state *sender,char *sender_prefix,
+		      char *servald_server, char *credential,
+		      unsigned char *msg,int length)
+{
+  int offset=0;
+  if (length<piece_context_header_len(0)) return -1;
+
+  // Skip header character
+  offset++;
+  int flags=msg[offset++];
+  int slot=flags&0x0f;
+  int is_manifest=flags&0x10;
+  int is_end_piece=!(flags&0x20);
+  uint32_t tag=0;
+  for(int i=0;i<4;i++) tag|=((uint32_t)msg[offset++])<<(i*8);
+  int for_me=((my_sid[0]==msg[offset])&&(my_sid[1]==msg[offset+1]));
+  offset+=2;
+  long long piece_offset=msg[offset]|(msg[offset+1]<<8);
+  offset+=2;
+  if (flags&0x40) piece_offset|=((long long)msg[offset++])<<16;
+  if (offset>=length) return -1;
+  int piece_bytes=msg[offset++];
+  if ((length-offset)<piece_bytes) return -1;
+
+  struct piece_context_rx *c=&sender->piece_context[slot];
+  if ((!c->valid)||(piece_context_tag(c->bid_prefix_bin,c->version)!=tag)) {
+    if (debug_pieces)
+      printf(">>> %s Ignoring piece from %s* for unknown slot #%d\n",
+	     timestamp_str(),sender->sid_prefix,slot);
+    return offset+piece_bytes;
+  }
+
+  char bid_prefix[8*2+1];
+  snprintf(bid_prefix,8*2+1,"%02x%02x%02x%02x%02x%02x%02x%02x",
+	   c->bid_prefix_bin[0],c->bid_prefix_bin[1],c->bid_prefix_bin[2],
+	   c->bid_prefix_bin[3],c->bid_prefix_bin[4],c->bid_prefix_bin[5],
+	   c->bid_prefix_bin[6],c->bid_prefix_bin[7]);
+
+  if (monitor_mode)
+    {
+      char sender_prefix[128];
+      char monitor_log_buf[1024];
+      sprintf(sender_prefix,"%s*",sender->sid_prefix);
+      snprintf(monitor_log_buf,sizeof(monitor_log_buf),
+	       "Piece of bundle: BID=%s*, [%lld--%lld) of %s.%s",
+	       bid_prefix,
+	       piece_offset,piece_offset+piece_bytes-1,
+	       is_manifest?"manifest":"payload",
+	       is_end_piece?" This is the last piece of that.":""
+	       );
+
+      monitor_log(sender_prefix,NULL,monitor_log_buf);
+    }
+
+  saw_piece(sender_prefix,for_me,
+	    bid_prefix,c->bid_prefix_bin,
+	    c->version,piece_offset,piece_bytes,is_end_piece,
+	    is_manifest,&msg[offset],
+	    prefix,servald_server,credential);
+
+  return offset+piece_bytes;
+}
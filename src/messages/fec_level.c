@@ -0,0 +1,94 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2015-2018 Serval Project Inc., Flinders University.
+
+This program monitors a local Rhizome database and attempts
+to synchronise it over low-bandwidth declarative transports, 
+such as bluetooth name or wifi-direct service information
+messages.  It is intended to give a high priority to MeshMS
+converations among nearby nodes.
+
+The design is fully asynchronous, so a call to the update_my_message()
+function from time to time should be all that is required.
+
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#include "sync.h"
+#include "lbard.h"
+
+int fec_level_request_peer=0;
+
+int append_fec_level_request(unsigned char *msg_out,int *offset,int mtu)
+{
+  // Ask the next active peer in turn to use the FEC level that suits how well we
+  // hear them.
+  if ((mtu-(*offset))<FEC_LEVEL_REQUEST_LEN) return -1;
+  
+  for(int i=0;i<peer_count;i++) {
+    int peer=(fec_level_request_peer+i)%peer_count;
+    struct peer_state *p=peer_records[peer];
+    if (!p) continue;
+    if ((time(0)-p->last_message_time)>peer_keepalive_interval) continue;
+
+    msg_out[(*offset)++]='E';
+    for(int j=0;j<4;j++) msg_out[(*offset)++]=p->sid_prefix_bin[j];
+    // (and say that we understand Golay protected packet headers, compressed
+    // piece headers and run-length progress reports)
+    msg_out[(*offset)++]=p->fec_level_wanted|FEC_LEVEL_FLAG_GOLAY_HEADER
+      |FEC_LEVEL_FLAG_COMPRESSED_PIECES|FEC_LEVEL_FLAG_PROGRESS_RUNS;
+    fec_level_request_peer=peer+1;
+    return 0;
+  }
+  return -1;
+}
+
+int message_parser_45(struct peer_state *sender,char *sender_prefix,
+		      char *servald_server, char *credential,
+		      unsigned char *msg,int length)
+{
+  if (length<FEC_LEVEL_REQUEST_LEN) return -1;
+
+  if (msg[5]&FEC_LEVEL_FLAG_GOLAY_HEADER) sender->golay_header_time=time(0);
+  if (msg[5]&FEC_LEVEL_FLAG_COMPRESSED_PIECES) sender->compressed_pieces_time=time(0);
+  if (msg[5]&FEC_LEVEL_FLAG_PROGRESS_RUNS) sender->progress_runs_time=time(0);
+  int level=msg[5]&FEC_LEVEL_MASK;
+
+  // Is it for us?
+  if (!memcmp(&msg[1],my_sid,4)) {
+    if (level<FEC_LEVEL_COUNT) {
+      if (debug_radio&&(sender->fec_level_requested!=level))
+	printf(">>> %s %s* asked us to use FEC level %d\n",
+	       timestamp_str(),sender->sid_prefix,level);
+      sender->fec_level_requested=level;
+      sender->fec_level_request_time=time(0);
+    }
+  }
+  
+  return FEC_LEVEL_REQUEST_LEN;
+}
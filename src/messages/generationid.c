@@ -81,9 +81,12 @@ int message_parser_47(struct peer_state *sender,char *sender_prefix,
       sender->sid_prefix=strdup(sender_prefix);
       sender->last_message_number=-1;
       sender->tx_bundle=-1;
+      sender->held_map_bundle=-1;
       sender->instance_id=peer_instance_id;
       printf("Peer %s* has restarted -- discarding stale knowledge of its state.\n",sender->sid_prefix);
       peer_records[peer_index]=sender;
+      sender->last_message_time=time(0);
+      peer_note_heard(peer_index);
 #endif
     }
   }
@@ -48,39 +48,23 @@ int sync_schedule_progress_report_bitmap(int peer, int partial)
 
   // find first required body offset
 
-  int slot=report_queue_length;
-
-  for(int i=0;i<report_queue_length;i++) {
-    // BITMAP reports are broadcast, so not per-peer
-    //    if (report_queue_peers[i]==peer_records[peer]) {
-      // We already want to tell this peer something.
-      // We should only need to tell a peer one thing at a time.
-      slot=i; break;
-      //    }
-  }
-  
-  if (slot>=REPORT_QUEUE_LEN) slot=random()%REPORT_QUEUE_LEN;
-
-  // Mark utilisation of slot, so that we can flush out stale messages
-  report_queue_partials[slot]=partial;
-  report_queue_peers[slot]=peer_records[peer];
+  // BITMAP reports are broadcast, so replace any queued for this bundle, whoever
+  // it was for.
+  int slot=report_queue_slot(peer,
+			     partials[partial].bid_prefix_bin,
+			     REPORT_TYPE_BITMAP,partial,"progress report (BITMAP)");
+  if (slot<0) return -1;
 
   int ofs=0;
 
-  if (!monitor_mode) {
-    if (report_queue_message[slot]) {
-      fprintf(stderr,"Replacing report_queue message '%s' with 'progress report' (BITMAP)\n",
-	      slot>=0?(report_queue_message[slot]?report_queue_message[slot]:"< report_queue_message=slot >"):"< slot<0 >");
-      free(report_queue_message[slot]);
-      report_queue_message[slot]=NULL;
-    } else {
-      fprintf(stderr,"Setting report_queue message to 'progress report' (BITMAP)\n");
-    }
-  }
-  report_queue_message[slot]=strdup("progress report");
-  
   // Announce progress bitmap to all recipients.
   partial_update_request_bitmap(&partials[partial]);
+
+  // For bundles bigger than the bitmap, say everything we hold, if everyone
+  // understands that.
+  if (progress_runs_tx&&(partials[partial].body_length>32*8*64))
+    if (!sync_build_progress_runs_in_slot(slot,partial)) return 0;
+
   report_queue[slot][ofs++]='M';
   
   // BID prefix
@@ -108,7 +92,6 @@ int sync_schedule_progress_report_bitmap(int peer, int partial)
 
   report_lengths[slot]=ofs;
   assert(ofs<MAX_REPORT_LEN);
-  if (slot>=report_queue_length) report_queue_length=slot+1;
 
   return 0;
 }
@@ -129,6 +112,11 @@ int sync_parse_progress_bitmap(struct peer_state *p,unsigned char *msg_in,int *o
   unsigned char *bitmap=&msg[15];
   int bundle=lookup_bundle_by_prefix(bid_prefix,8);
   int manifest_offset=1024;    
+
+  // The bitmap starts at the first byte they lack, so for a journal, that is how
+  // much of it they have.
+  if ((body_offset>=0)&&journal_bundle_p(bundle))
+    journal_note_peer_holds(p,bundles[bundle].bid_bin,body_offset);
   
   if (p->tx_bundle==bundle) {
     // We are sending this bundle to them, so update our info
@@ -0,0 +1,273 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2016 Serval Project Inc.
+
+This program monitors a local Rhizome database and attempts
+to synchronise it over low-bandwidth declarative transports,
+such as bluetooth name or wifi-direct service information
+messages.  It is intended to give a high priority to MeshMS
+converations among nearby nodes.
+
+The design is fully asynchronous, so a call to the update_my_message()
+function from time to time should be all that is required.
+
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+  Run-length progress reports for large bundles.
+
+  A progress bitmap ('M') covers only the 16KB of the body from the first byte
+  that we are missing, so for a large bundle, the sender knows nothing of what
+  we hold beyond that, and will resend it.  So for bundles larger than that, we
+  instead describe everything we hold, as alternating runs of blocks that we
+  hold and are missing, starting with a (possibly empty) run that we hold.
+  Anything after the last run is missing.  Each run length is a number of
+  blocks, 7 bits per byte, least significant first, with the top bit set on
+  every byte but the last.
+
+  Blocks are normally 64 bytes, to match the bitmaps, but if the runs don't fit
+  we double the block size until they do.  A block counts as held only if we
+  hold all of it, so a coarser report just means that the sender resends a
+  little more than it needs to.  The smallest block size can be raised with
+  the progressblock= option.
+
+  'H' messages (PROGRESS_RUNS_HEADER_LEN bytes + runs):
+  8 bytes : BID prefix
+  2 bytes : manifest bitmap, as for 'M' messages
+  1 byte : log2 of the block size
+  1 byte : number of bytes of runs
+  then the runs.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#include "sync.h"
+#include "lbard.h"
+
+#define PROGRESS_RUNS_HEADER_LEN (1+8+2+1+1)
+#define PROGRESS_RUNS_MAX_BYTES (MAX_REPORT_LEN-PROGRESS_RUNS_HEADER_LEN-1)
+#define PROGRESS_RUNS_MAX_SHIFT 24
+
+int progress_runs_min_block_shift=6;
+
+struct held_interval {
+  int start;
+  int end;
+};
+
+static int held_interval_compare(const void *a,const void *b)
+{
+  const struct held_interval *x=a;
+  const struct held_interval *y=b;
+  return x->start-y->start;
+}
+
+static int progress_runs_put(unsigned char *out,int *n,int max_bytes,int count)
+{
+  do {
+    if ((*n)>=max_bytes) return -1;
+    out[(*n)++]=(count&0x7f)|((count>0x7f)?0x80:0);
+    count>>=7;
+  } while(count);
+  return 0;
+}
+
+/*
+  Encode the runs of body blocks held in a partial bundle, using the smallest
+  block size that fits.  Returns the number of bytes of runs, and sets *shift.
+ */
+static int progress_runs_encode(struct partial_bundle *p,unsigned char *out,
+				int max_bytes,int *shift)
+{
+  int length=p->body_length;
+  int segment_count=0;
+  for(struct segment_list *s=p->body_segments;s;s=s->next) segment_count++;
+  struct held_interval *held=calloc(segment_count+1,sizeof(struct held_interval));
+  if (!held) return -1;
+
+  // Work out the byte ranges we hold, in order, and merge any that touch
+  int count=0;
+  for(struct segment_list *s=p->body_segments;s;s=s->next) {
+    held[count].start=s->start_offset;
+    held[count].end=s->start_offset+s->length;
+    if (held[count].end>length) held[count].end=length;
+    if (held[count].end>held[count].start) count++;
+  }
+  qsort(held,count,sizeof(struct held_interval),held_interval_compare);
+  int merged=0;
+  for(int i=0;i<count;i++) {
+    if (merged&&(held[i].start<=held[merged-1].end)) {
+      if (held[i].end>held[merged-1].end) held[merged-1].end=held[i].end;
+    } else held[merged++]=held[i];
+  }
+
+  int n=-1;
+  for(*shift=progress_runs_min_block_shift;(*shift)<=PROGRESS_RUNS_MAX_SHIFT;(*shift)++) {
+    int block_size=1<<(*shift);
+    int blocks=(length+block_size-1)>>(*shift);
+    int position=0;
+    int held_run=0;
+    n=0;
+    for(int i=0;(i<merged)&&(n>=0);i++) {
+      int first=(held[i].start+block_size-1)>>(*shift);
+      int last=(held[i].end>=length)?blocks:(held[i].end>>(*shift));
+      if (last<=first) continue;
+      if (first>position) {
+	// Finish the run we hold, then the run we are missing
+	if (progress_runs_put(out,&n,max_bytes,held_run)
+	    ||progress_runs_put(out,&n,max_bytes,first-position)) n=-1;
+	held_run=0;
+      }
+      held_run+=last-first;
+      position=last;
+    }
+    if ((n>=0)&&held_run&&progress_runs_put(out,&n,max_bytes,held_run)) n=-1;
+    if (n>=0) break;
+  }
+  free(held);
+  return n;
+}
+
+int sync_build_progress_runs_in_slot(int slot,int partial)
+{
+  struct partial_bundle *p=&partials[partial];
+  if (p->body_length<=0) return -1;
+
+  int shift;
+  unsigned char runs[PROGRESS_RUNS_MAX_BYTES];
+  int n=progress_runs_encode(p,runs,PROGRESS_RUNS_MAX_BYTES,&shift);
+  if (n<0) return -1;
+
+  int ofs=0;
+  report_queue[slot][ofs++]='H';
+  bcopy(p->bid_prefix_bin,&report_queue[slot][ofs],8);
+  ofs+=8;
+  report_queue[slot][ofs++]=p->request_manifest_bitmap[0];
+  report_queue[slot][ofs++]=p->request_manifest_bitmap[1];
+  report_queue[slot][ofs++]=shift;
+  report_queue[slot][ofs++]=n;
+  bcopy(runs,&report_queue[slot][ofs],n);
+  ofs+=n;
+
+  report_lengths[slot]=ofs;
+  assert(ofs<MAX_REPORT_LEN);
+
+  if (debug_bitmap)
+    printf(">>> %s Scheduling run-length progress report of %s* in %d byte blocks (%d bytes).\n",
+	   timestamp_str(),p->bid_prefix,1<<shift,ofs);
+  return 0;
+}
+
+// Find the first byte at or after offset, that the peer has not told us they hold
+int peer_held_map_next_missing(struct peer_state *p,int bundle,int offset)
+{
+  if (p->held_map_bundle!=bundle) return offset;
+  for(int i=0;i<p->held_range_count;i++)
+    if ((offset>=p->held_ranges[i][0])&&(offset<p->held_ranges[i][1]))
+      offset=p->held_ranges[i][1];
+  return offset;
+}
+
+int peer_held_map_holds(struct peer_state *p,int bundle,int start,int end)
+{
+  if (p->held_map_bundle!=bundle) return 0;
+  if (end>bundles[bundle].length) end=bundles[bundle].length;
+  for(int i=0;i<p->held_range_count;i++)
+    if ((start>=p->held_ranges[i][0])&&(end<=p->held_ranges[i][1])) return 1;
+  return 0;
+}
+
+int message_parser_48(struct peer_state *sender,char *sender_prefix,
+		      char *servald_server, char *credential,
+		      unsigned char *msg,int length)
+{
+  if (length<PROGRESS_RUNS_HEADER_LEN) return -1;
+  int shift=msg[11];
+  int n=msg[12];
+  if ((length-PROGRESS_RUNS_HEADER_LEN)<n) return -1;
+  int consumed=PROGRESS_RUNS_HEADER_LEN+n;
+
+  int bundle=lookup_bundle_by_prefix(&msg[1],8);
+  if ((bundle<0)||(sender->tx_bundle!=bundle)) return consumed;
+  if ((shift<6)||(shift>PROGRESS_RUNS_MAX_SHIFT)) return consumed;
+  int body_length=bundles[bundle].length;
+
+  // Decode the runs into the byte ranges that they hold.  If there are more
+  // than we have room for, we just treat the rest as missing.
+  sender->held_map_bundle=bundle;
+  sender->held_range_count=0;
+  long long position=0;
+  // Nothing past the end of the body means anything, so stop there, rather than
+  // let corrupt run lengths push position<<shift out of range.
+  long long limit=(body_length>>shift)+1;
+  int held=1;
+  int offset=PROGRESS_RUNS_HEADER_LEN;
+  while((offset<consumed)&&(position<limit)) {
+    long long count=0;
+    int bits=0;
+    while((offset<consumed)&&(bits<35)) {
+      count|=((long long)(msg[offset]&0x7f))<<bits;
+      bits+=7;
+      if (!(msg[offset++]&0x80)) break;
+    }
+    if (count>limit-position) count=limit-position;
+    long long start=position<<shift;
+    position+=count;
+    long long end=position<<shift;
+    if (end>body_length) end=body_length;
+    if (held&&(end>start)&&(sender->held_range_count<MAX_HELD_RANGES)) {
+      sender->held_ranges[sender->held_range_count][0]=start;
+      sender->held_ranges[sender->held_range_count][1]=end;
+      sender->held_range_count++;
+    }
+    held=!held;
+  }
+
+  // Point the bitmap window at the first block they are missing, and fill it in
+  // from what they hold.
+  int first_missing=peer_held_map_next_missing(sender,bundle,0)&(~63);
+  sender->request_bitmap_bundle=bundle;
+  sender->request_bitmap_offset=first_missing;
+  bzero(sender->request_bitmap,32);
+  for(int i=0;i<32*8;i++)
+    if (peer_held_map_holds(sender,bundle,first_missing+i*64,first_missing+i*64+64))
+      sender->request_bitmap[i>>3]|=1<<(i&7);
+
+  memcpy(sender->request_manifest_bitmap,&msg[9],2);
+  int manifest_offset=1024;
+  for(int i=0;i<16;i++)
+    if (!(msg[9+(i>>3)]&(1<<(i&7)))) { manifest_offset=i*64; break; }
+  sender->tx_bundle_manifest_offset=manifest_offset;
+
+  if (debug_bitmap)
+    printf(">>> %s %s* holds %d ranges of bundle #%d, first missing byte is %d.\n",
+	   timestamp_str(),sender->sid_prefix,sender->held_range_count,bundle,
+	   first_missing);
+
+  return consumed;
+}
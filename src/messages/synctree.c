@@ -50,13 +50,24 @@ int sync_tree_send_message(int *offset,int mtu, unsigned char *msg_out)
   int bytes_available=mtu-SYNC_MSG_HEADER_LEN-(*offset);
   if (bytes_available<1) return -1;
   
-  /* Send sync status message */
-  msg[len++]='S'; // Sync message
+  /* Send sync status message.
+     By default we use the compact encoding, which packs the tree records into
+     a bit stream, and only sends the key bits that differ from the previous
+     record. */
+  int legacy=option_flags&FLAG_LEGACY_SYNC_MESSAGES;
+  if (legacy)
+    msg[len++]='S'; // Sync message
+  else
+    msg[len++]='s'; // Compact sync message
   int length_byte_offset=len;
   msg[len++]=0; // place holder for length
   assert(len==SYNC_MSG_HEADER_LEN);
 
-  int used=sync_build_message(sync_state,&msg[len],bytes_available);
+  int used;
+  if (legacy)
+    used=sync_build_message(sync_state,&msg[len],bytes_available);
+  else
+    used=sync_build_compact_message(sync_state,&msg[len],bytes_available);
 
   if (debug_sync_keys) {
     char filename[1024];
@@ -80,12 +91,14 @@ int sync_tree_send_message(int *offset,int mtu, unsigned char *msg_out)
   return 0;
 }
 
+#define message_parser_73 message_parser_53
+
 int message_parser_53(struct peer_state *sender,char *sender_prefix,
 		      char *servald_server, char *credential,
 		      unsigned char *msg,int length)
 {
   int offset=0;
-  // Sync-tree synchronisation message
+  // Sync-tree synchronisation message ('S', or 's' for the compact encoding)
   
   // process the message
   sync_tree_receive_message(sender,&msg[offset]);
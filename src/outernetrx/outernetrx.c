@@ -49,6 +49,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "serial.h"
 #include "version.h"
 #include "radios.h"
+#include "erasure.h"
 #include "code_instrumentation.h"
 
 int outernet_socket=-1;
@@ -61,13 +62,15 @@ extern char *credential;
   See also drv_outernet.c, and outernet_uplink_build_packet()
   in particular.
 
-  The packets we send are protected by RAID-5 like parity,
-  which can be used to reconstruct a single missing packet
-  from each parity zone.  The initial implementation uses 
-  a parity zone of four packets, with 1/4 of the data being
-  parity, that is the parity expands the dataa to 4/3 the
-  original size, and thus allows one in four packets to be
-  lost, without loss of data.
+  The packets we send are protected by an erasure code over
+  each parity zone (see src/fec/erasure.c), which can be used
+  to reconstruct up to a set number of missing packets from
+  each zone.  By default a zone is four packets, with 1/4 of
+  the data being parity, that is the parity expands the data
+  to 4/3 the original size, and thus allows one in four packets
+  to be lost, without loss of data.  The size of the zone and
+  the number of packets that can be lost from it are given in
+  every packet.
 
   There are five lanes of transfer simultaneously, so we
   need to keep track of those.
@@ -77,6 +80,7 @@ extern char *credential;
   lane number - one byte
   sequence number + stop and start markers - two bytes
   logical MTU - one byte
+  zone geometry - one byte: (packets per zone - 1) << 4 | losses tolerated
   data - variable length
   parity stripe - variable length
 
@@ -94,10 +98,11 @@ struct outernet_rx_bundle {
   unsigned char *data;
   time_t rx_start_time;
 #define MAX_DATA_BYTES 256
-  unsigned char parity_zone[MAX_DATA_BYTES*4];
-  unsigned char parity_bytes[MAX_DATA_BYTES];
-  unsigned char parity_zone_bitmap;
-  unsigned char data_bytes;  
+  unsigned char parity_zone[MAX_DATA_BYTES*ERASURE_MAX_ZONE_PACKETS];
+  unsigned char parity_bytes[MAX_DATA_BYTES*ERASURE_MAX_ZONE_PACKETS];
+  unsigned int parity_zone_bitmap;
+  // Layout of the parity zones of the bundle we are receiving
+  struct erasure_zone zone;
   unsigned char waitingForStart;
 };
 
@@ -201,14 +206,14 @@ int outernet_rx_lane_commit_parity_zone(int lane)
   LOG_ENTRY;
 
   do {
+    int zone_bytes=outernet_rx_bundles[lane].zone.packets
+      *outernet_rx_bundles[lane].zone.data_bytes;
     LOG_NOTE("Commiting parity zone at offset %d for lane #%d",
-	     outernet_rx_bundles[lane].parity_zone_number
-	     *4*outernet_rx_bundles[lane].data_bytes,lane);
+	     outernet_rx_bundles[lane].parity_zone_number*zone_bytes,lane);
 
     if ((!outernet_rx_bundles[lane].data)
 	||(outernet_rx_bundles[lane].data_size
-	   < ( outernet_rx_bundles[lane].parity_zone_number + 1)
-	   * 4 * outernet_rx_bundles[lane].data_bytes))
+	   < ( outernet_rx_bundles[lane].parity_zone_number + 1) * zone_bytes))
       {
 	// Insufficient space allocated, realloc.
 	
@@ -235,13 +240,10 @@ int outernet_rx_lane_commit_parity_zone(int lane)
     
     // Copy the parity zone into place
     dump_bytes(stderr,"Parity zone in commit",
-	       outernet_rx_bundles[lane].parity_zone,
-	       4*outernet_rx_bundles[lane].data_bytes);	       
+	       outernet_rx_bundles[lane].parity_zone,zone_bytes);
     memcpy(&outernet_rx_bundles[lane].data
-	   [outernet_rx_bundles[lane].parity_zone_number
-	    *4*outernet_rx_bundles[lane].data_bytes],
-	   outernet_rx_bundles[lane].parity_zone,
-	   4*outernet_rx_bundles[lane].data_bytes);
+	   [outernet_rx_bundles[lane].parity_zone_number*zone_bytes],
+	   outernet_rx_bundles[lane].parity_zone,zone_bytes);
     
     // Prepare for receiving the next parity zone
     outernet_rx_bundles[lane].last_parity_zone_number=
@@ -261,97 +263,18 @@ int outernet_rx_lane_update_parity_zone(int lane)
   LOG_ENTRY;
 
   do {
-    unsigned char *pz=outernet_rx_bundles[lane].parity_zone;
-    unsigned char *pb=outernet_rx_bundles[lane].parity_bytes;
-    int data_bytes=(unsigned char)outernet_rx_bundles[lane].data_bytes;
-    int parity_bytes=data_bytes/3;
-
-    // Handy macros to make it easier to decode
-#define PZ(A,B) (&pz[A*data_bytes+B*parity_bytes])
-#define PB(A) (&pb[A*parity_bytes])
-#define COPY(FROM,TO) { LOG_NOTE("COPY(%p -> %p) (data_bytes=%d)",FROM,TO,data_bytes); memcpy(TO,FROM,parity_bytes); }
-#define XOR(THIS,ONTO) { for(int i=0;i<parity_bytes;i++) ONTO[i]^=THIS[i]; }
-    
-    switch (outernet_rx_bundles[lane].parity_zone_bitmap)
-      {
-      case 0x0: case 0x1: case 0x2: case 0x3:
-      case 0x4: case 0x5: case 0x6: case 0x8:
-      case 0x9: case 0xa: case 0xc:
-	// Do nothing if we don't have enough pieces of this parity zone
-	// Less than 3 pieces received from last parity zone
-	retVal=-1;
-	break;
-      case 0x7:
-	// Missing piece 3
-
-	
-	// Copy the parity slices to the missing spot
-	COPY(PB(0),PZ(3,0));
-	COPY(PB(1),PZ(3,1));
-	COPY(PB(2),PZ(3,2));
-
-	// Reveal the original data
-	XOR(PZ(1,0),PZ(3,0)); XOR(PZ(2,0),PZ(3,0));
-	XOR(PZ(0,0),PZ(3,1)); XOR(PZ(2,1),PZ(3,1));
-	XOR(PZ(0,1),PZ(3,2)); XOR(PZ(1,1),PZ(3,2));
-
-	outernet_rx_lane_commit_parity_zone(lane);
-	
-	break;	
-      case 0xb:
-	// missing piece 2
-
-	// Copy the parity slices to the missing spot
-	COPY(PB(0),PZ(2,0));
-	COPY(PB(1),PZ(2,1));
-	COPY(PB(2),PZ(2,2));
-
-	// Reveal the original data
-	XOR(PZ(1,0),PZ(2,0)); XOR(PZ(3,0),PZ(2,0));
-	XOR(PZ(0,0),PZ(2,1)); XOR(PZ(3,1),PZ(2,1));
-	XOR(PZ(0,2),PZ(2,2)); XOR(PZ(1,2),PZ(2,2));
-
-	outernet_rx_lane_commit_parity_zone(lane);
-
-	break;
-      case 0xd:
-	// missing piece 1
-
-	// Copy the parity slices to the missing spot
-	COPY(PB(0),PZ(1,0));
-	COPY(PB(1),PZ(1,1));
-	COPY(PB(2),PZ(1,2));
-
-	// Reveal the original data
-	XOR(PZ(2,0),PZ(1,0)); XOR(PZ(3,0),PZ(1,0));
-	XOR(PZ(0,1),PZ(1,1)); XOR(PZ(3,2),PZ(1,1));
-	XOR(PZ(0,2),PZ(1,2)); XOR(PZ(2,2),PZ(1,2));
-
-	outernet_rx_lane_commit_parity_zone(lane);
-
-	break;
-      case 0xe:
-	// missing piece 0
-
-	// Copy the parity slices to the missing spot
-	COPY(PB(0),PZ(0,0));
-	COPY(PB(1),PZ(0,1));
-	COPY(PB(2),PZ(0,2));
-
-	// Reveal the original data
-	XOR(PZ(2,1),PZ(0,0)); XOR(PZ(3,1),PZ(0,0));
-	XOR(PZ(1,1),PZ(0,1)); XOR(PZ(3,2),PZ(0,1));
-	XOR(PZ(1,2),PZ(0,2)); XOR(PZ(2,2),PZ(0,2));
-
-	outernet_rx_lane_commit_parity_zone(lane);
-
-	break;
-      case 0xf:	
-	// We have all four pieces, so life is easy.
-	outernet_rx_lane_commit_parity_zone(lane);
-	break;
+    // Recover any missing packets, if we have received enough of the zone to
+    // do so.  Else do nothing, and wait for more.
+    if (erasure_zone_decode(&outernet_rx_bundles[lane].zone,
+			    outernet_rx_bundles[lane].parity_zone,
+			    outernet_rx_bundles[lane].parity_bytes,
+			    outernet_rx_bundles[lane].parity_zone_bitmap)) {
+      retVal=-1;
+      break;
     }
 
+    outernet_rx_lane_commit_parity_zone(lane);
+
   } while(0);
 
   LOG_EXIT;
@@ -365,8 +288,15 @@ int outernet_rx_saw_packet(unsigned char *buffer,int bytes)
 
   do {
 
+    if (bytes<OUTERNET_HEADER_LEN) {
+      LOG_ERROR("Outernet packet is too short (%d bytes)",bytes);
+      retVal=-1;
+      break;
+    }
+
     unsigned int lane=buffer[0];
     unsigned int packet_mtu=buffer[3];
+    unsigned int zone_geometry=buffer[4];
 
     if (lane>=MAX_LANES) {
       LOG_ERROR("Outernet packet is for lane #%d (we only support 0 -- %d)",
@@ -375,12 +305,19 @@ int outernet_rx_saw_packet(unsigned char *buffer,int bytes)
       break;
     }
     
-    // 3/4 of the usable bytes are available for data
-    int data_bytes=(packet_mtu-3)*3/4;
-    int parity_bytes=data_bytes/3;
-    if (parity_bytes*3!=data_bytes) {
-      LOG_ERROR("Parity stripe size problem. MTU=%d, data_bytes=%d, parity_bytes=%d",
-		packet_mtu,data_bytes,parity_bytes);
+    struct erasure_zone z;
+    if ((packet_mtu<OUTERNET_HEADER_LEN)
+	||erasure_zone_setup(&z,(zone_geometry>>4)+1,zone_geometry&0xf,
+			     packet_mtu-OUTERNET_HEADER_LEN)) {
+      LOG_ERROR("Parity zone problem. MTU=%d, zone geometry=0x%02x",
+		packet_mtu,zone_geometry);
+      retVal=-1;
+      break;
+    }
+    int data_bytes=z.data_bytes;
+    int parity_bytes=z.parity_bytes;
+    if (bytes<OUTERNET_HEADER_LEN+data_bytes+parity_bytes) {
+      LOG_ERROR("Outernet packet is too short (%d bytes, MTU=%d)",bytes,packet_mtu);
       retVal=-1;
       break;
     }
@@ -392,14 +329,14 @@ int outernet_rx_saw_packet(unsigned char *buffer,int bytes)
     if (buffer[2]&0x40) start_flag=1;
     if (buffer[2]&0x80) end_flag=1;
 
-    int parity_zone_size=data_bytes*4;
+    int parity_zone_size=data_bytes*z.packets;
     int parity_zone_offset=(sequence_number*data_bytes)%parity_zone_size;
     // int parity_zone_start=(sequence_number*data_bytes)-parity_zone_offset;
-    int parity_zone_number=sequence_number/4;
-    int parity_zone_slice=sequence_number&3;
+    int parity_zone_number=sequence_number/z.packets;
+    int parity_zone_slice=sequence_number%z.packets;
     
-    unsigned char *data=&buffer[4];
-    unsigned char *parity=&buffer[4+data_bytes];
+    unsigned char *data=&buffer[OUTERNET_HEADER_LEN];
+    unsigned char *parity=&buffer[OUTERNET_HEADER_LEN+data_bytes];
 
     LOG_NOTE("Received bundle piece in lane #%d, sequence #%d (start=%d, end=%d) (parity zone #%d, packet %d, expected parity zone #%d)",
 	     lane,
@@ -409,31 +346,40 @@ int outernet_rx_saw_packet(unsigned char *buffer,int bytes)
     dump_bytes(stderr,"Bundle bytes",data,data_bytes);
     dump_bytes(stderr,"Parity bytes",parity,parity_bytes);
 
-    // Start receiving if we see a start sequence, or if we see sequence #1 while waiting
-    // for a start (since we can recover the missing start)
-    if (start_flag||((sequence_number==1)&&outernet_rx_bundles[lane].waitingForStart)) {
+    // Start receiving if we see a start sequence, or if we see an early enough
+    // sequence number while waiting for a start (since we can recover the missing
+    // start)
+    if (start_flag||((sequence_number<=z.parity)&&outernet_rx_bundles[lane].waitingForStart)) {
       // Erase whatever was sitting in this lane.
       LOG_NOTE("Clearing lane #%d RX state for new bundle",lane);
       outernet_rx_lane_init(lane,1);
 
       outernet_rx_bundles[lane].waitingForStart=0;
       outernet_rx_bundles[lane].rx_start_time=time(0);
+      outernet_rx_bundles[lane].zone=z;
     }
 
     // If we are waiting for a new start flag, ignore whatever
     // we see in the meantime.
-    // If we see a sequence #1, then we might have missed
-    // only sequence #0, which we can recover via parity, if we
-    // don't miss the next two packets.  So we should handle that
-    // special case.
+    // If we see one of the first few sequence numbers, then we might
+    // have missed only packets that we can recover via parity, if we
+    // don't miss too many more from the first zone.  So we should handle
+    // that special case.
     if (outernet_rx_bundles[lane].waitingForStart
-	&&(sequence_number>1)) {
+	&&(sequence_number>z.parity)) {
       LOG_NOTE("Ignoring piece while waiting for start");
       break;
     }
 
-    // Can only happen if we are on sequence #0 or #1, which in either
-    // case counts as a start.
+    // The zone layout can't change part way through a bundle
+    if (memcmp(&z,&outernet_rx_bundles[lane].zone,sizeof(z))) {
+      LOG_NOTE("Clearing lane #%d RX state because the parity zone layout changed",lane);
+      outernet_rx_lane_init(lane,1);
+      break;
+    }
+
+    // Can only happen if we are on one of the first few sequence numbers,
+    // which in any case counts as a start.
     outernet_rx_bundles[lane].waitingForStart=0;
 
     if ((parity_zone_number < outernet_rx_bundles[lane].parity_zone_number)
@@ -451,22 +397,19 @@ int outernet_rx_saw_packet(unsigned char *buffer,int bytes)
 	// Parity zone has advanced by exactly one.
 	// We need to check that the previous parity zone was completed.
 	// If not, then we need to stop receiving.
-      switch (outernet_rx_bundles[lane].parity_zone_bitmap)
-	{
-	case 0x0: case 0x1: case 0x2: case 0x3:
-	case 0x4: case 0x5: case 0x6: case 0x8:
-	case 0x9: case 0xa: case 0xc:
-	  // Less than 3 pieces received from last parity zone
-	  LOG_NOTE("Clearing lane #%d RX state because parity_zone_number advanced, but we havn't received at least 3/4 packets from the last one.",lane);
-	  outernet_rx_lane_init(lane,1);
-	  break;
-	default:
-	  // We have 3 or more pieces in the last parity zone,
-	  // so commit it. Really this should never happen, because
-	  // we should commit a parity zone after adding to it
-	  // each time
-	  outernet_rx_lane_update_parity_zone(lane);
-	}
+      if (erasure_zone_received_count(outernet_rx_bundles[lane].parity_zone_bitmap)
+	  <(z.packets-z.parity)) {
+	// Too few pieces received from last parity zone
+	LOG_NOTE("Clearing lane #%d RX state because parity_zone_number advanced, but we havn't received at least %d/%d packets from the last one.",
+		 lane,z.packets-z.parity,z.packets);
+	outernet_rx_lane_init(lane,1);
+      } else {
+	// We have enough pieces in the last parity zone,
+	// so commit it. Really this should never happen, because
+	// we should commit a parity zone after adding to it
+	// each time
+	outernet_rx_lane_update_parity_zone(lane);
+      }
       }
     else if (parity_zone_number==outernet_rx_bundles[lane].parity_zone_number)  {
       // Okay, the packet is for this parity zone.
@@ -487,7 +430,6 @@ int outernet_rx_saw_packet(unsigned char *buffer,int bytes)
       
       // Update bitmap
       outernet_rx_bundles[lane].parity_zone_bitmap|=(1<<parity_zone_slice);
-      outernet_rx_bundles[lane].data_bytes=data_bytes;
       
       // See if we have enough received to commit the parity zone
       outernet_rx_lane_update_parity_zone(lane);
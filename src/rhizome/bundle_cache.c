@@ -38,6 +38,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <dirent.h>
 #include <assert.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 #include "sync.h"
 #include "lbard.h"
@@ -67,6 +69,108 @@ unsigned char *cached_manifest_encoded=NULL;
 int cached_body_len=0;
 unsigned char *cached_body=NULL;
 
+/*
+  The body is kept in a private mapping of the file that servald gave it to us
+  in, rather than read into memory, so that bundles of any size can be sent, and
+  only the pages around the parts we are actually sending need be in RAM.
+*/
+static void bundle_cache_release_body(void)
+{
+  if (cached_body) munmap(cached_body,cached_body_len);
+  cached_body=NULL;
+  cached_body_len=0;
+}
+
+static int bundle_cache_map_file(char *filename,unsigned char **body,int *body_len)
+{
+  *body=NULL;
+  *body_len=0;
+  int fd=open(filename,O_RDONLY);
+  if (fd<0) {
+    fprintf(stderr,"could read file '%s'.\n",filename);
+    perror("open");
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd,&st)||(st.st_size>0x7fffffff)) {
+    close(fd);
+    return -1;
+  }
+  if (st.st_size) {
+    unsigned char *map=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    if (map==MAP_FAILED) {
+      perror("mmap");
+      close(fd);
+      return -1;
+    }
+    *body=map;
+    *body_len=st.st_size;
+  }
+  else fprintf(stderr,"WARNING:Body len = 0 bytes!\n");
+  // The mapping keeps the file for as long as we need it
+  close(fd);
+  return 0;
+}
+
+static int bundle_cache_fetch_body_file(int bundle_number,char *filename,
+					char *servald_server, char *credential)
+{
+  char path[8192];
+  snprintf(path,8192,"/restful/rhizome/%s/raw.bin",
+	   bundles[bundle_number].bid_hex);
+  unlink(filename);
+  FILE *f=fopen(filename,"w");
+  if (!f) {
+    fprintf(stderr,"could not open output file '%s'.\n",filename);
+    perror("fopen");
+    return -1;
+  }
+  int result_code=http_get_simple(servald_server,
+				  credential,path,f,5000,NULL,0);
+  fclose(f);
+  if(result_code!=200) {
+    fprintf(stderr,"http request failed (%d). URLPATH:%s\n",result_code,path);
+    unlink(filename);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+  Fetch the body of one of our bundles without disturbing the bundle cache, which
+  is busy with whatever we are sending.  This is how we get the start of a journal
+  bundle that a peer is sending us the rest of.
+*/
+int bundle_cache_fetch_body(int bundle_number,char *sid_prefix_hex,
+			    char *servald_server, char *credential,
+			    unsigned char **body,int *body_len)
+{
+  if (bundle_number<0) return -1;
+
+  // (unless it is already in the cache)
+  if (bid_of_cached_bundle
+      &&(!strcasecmp(bundles[bundle_number].bid_hex,bid_of_cached_bundle))
+      &&(cached_version==bundles[bundle_number].version)) {
+    *body=cached_body;
+    *body_len=cached_body_len;
+    return 0;
+  }
+
+  char filename[1024];
+  snprintf(filename,1024,"%d.%s.journal",getpid(),sid_prefix_hex);
+  if (bundle_cache_fetch_body_file(bundle_number,filename,servald_server,credential))
+    return -1;
+  int map_result=bundle_cache_map_file(filename,body,body_len);
+  unlink(filename);
+  return map_result;
+}
+
+int bundle_cache_release_fetched_body(unsigned char *body,int body_len)
+{
+  if (body&&(body!=cached_body)) munmap(body,body_len);
+  return 0;
+}
+
 int prime_bundle_cache(int bundle_number,char *sid_prefix_hex,
 		       char *servald_server, char *credential)
 {
@@ -89,7 +193,7 @@ int prime_bundle_cache(int bundle_number,char *sid_prefix_hex,
       free(bid_of_cached_bundle); bid_of_cached_bundle=NULL;
       free(cached_manifest); cached_manifest=NULL;
       free(cached_manifest_encoded); cached_manifest_encoded=NULL;
-      free(cached_body); cached_body=NULL;
+      bundle_cache_release_body();
     }
 
     // Load bundle into cache
@@ -153,50 +257,22 @@ int prime_bundle_cache(int bundle_number,char *sid_prefix_hex,
       cached_manifest_encoded_len = cached_manifest_len;	
     }        
     
-    snprintf(path,8192,"/restful/rhizome/%s/raw.bin",
-	     bundles[bundle_number].bid_hex);
     snprintf(filename,1024,"%d.%s.raw",getpid(),sid_prefix_hex);
-    unlink(filename);
-    f=fopen(filename,"w");
-    if (!f) {
-      fprintf(stderr,"could not open output file '%s'.\n",filename);
-      perror("fopen");
-      return -1;
-    }
-    result_code=http_get_simple(servald_server,
-				credential,path,f,5000,NULL,0);
-    fclose(f); f=NULL;
-    if(result_code!=200) {
-      fprintf(stderr,"http request failed (%d). URLPATH:%s\n",result_code,path);
+    if (bundle_cache_fetch_body_file(bundle_number,filename,servald_server,credential))
       return -1;
-    }
     long long t3=gettime_ms();
 
     if (0)
       fprintf(stderr,"  HTTP pre-fetching of next bundle to send took %lldms + %lldms\n",
 	      t2-t1,t3-t2);
     
-    // XXX - This transport only allows bundles upto 5MB!
-    // (and that is probably pushing it a bit for a mesh extender with only 32MB RAM
-    // for everything!)
-    f=fopen(filename,"r");
-    if (!f) {
-      fprintf(stderr,"could read file '%s'.\n",filename);
-      perror("fopen");
-      return -1;
-    }
-    if (cached_body) free(cached_body);
-    cached_body=malloc(5*1024*1024);
-    assert(cached_body);
-    // XXX - Should check that we read all the bytes
-    cached_body_len=fread(cached_body,1,5*1024*1024,f);    
-    cached_body=realloc(cached_body,cached_body_len);
-    if (cached_body_len) assert(cached_body); else fprintf(stderr,"WARNING:Body len = 0 bytes!\n");
-    fclose(f);
+    bundle_cache_release_body();
+    int map_result=bundle_cache_map_file(filename,&cached_body,&cached_body_len);
     unlink(filename);
+    if (map_result) return -1;
     if (1)
-      fprintf(stderr,"  body is %d bytes long. result_code=%d\n",
-	      cached_body_len,result_code);
+      fprintf(stderr,"  body is %d bytes long.\n",
+	      cached_body_len);
 
     bid_of_cached_bundle=strdup(bundles[bundle_number].bid_hex);
 
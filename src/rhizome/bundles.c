@@ -32,6 +32,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <unistd.h>
 #include <stdlib.h>
 #include <strings.h>
+#include <ctype.h>
 #include <string.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -102,6 +103,49 @@ struct bundle_record bundles[MAX_BUNDLES];
 int bundle_count=0;
 int ignored_bundles=0;
 
+// Sum of bundle_list_entry_hash() over every bundle we hold, so that we can tell
+// whether the bundle list that servald reports is the same set of bundles and
+// versions as ours, without comparing them one by one.
+unsigned long long bundle_list_digest=0;
+
+unsigned long long bundle_list_entry_hash(char *bid,long long version)
+{
+  // 64-bit FNV-1a over the BID (ignoring case) and version.
+  unsigned long long h=0xcbf29ce484222325ULL;
+  for(int i=0;bid[i];i++) {
+    h^=(unsigned char)toupper(bid[i]);
+    h*=0x100000001b3ULL;
+  }
+  for(int i=0;i<8;i++) {
+    h^=(version>>(i*8))&0xff;
+    h*=0x100000001b3ULL;
+  }
+  return h;
+}
+
+// Returns 1 if we keep bundles of this service and version, else 0 with *reason
+// saying why not.  Also used when checking servald's bundle list against ours,
+// so that both count the same bundles.
+int bundle_acceptable(char *service,long long version,char **reason)
+{
+  // Ignore non-meshms bundles when in meshms-only mode.
+  // (actually, accepts both meshms (SMS-like service) and meshmb (micro-blogging service)
+  if (meshms_only&&strncasecmp("meshm",service,5)) {
+    *reason="Rejected non-meshms bundle seen while meshms_only=1";
+    return 0;
+  }
+  // Ignore bundles that are too old
+  // (except if MeshMS2, since that uses journal bundles, and so the version does
+  // not represent the age of a bundle.)
+  if ((version<min_version)&&strncasecmp("meshms2",service,7)) {
+    *reason="Rejected bundle because it was too old (version<min_version), and service!=meshms2";
+    return 0;
+  }
+  return 1;
+}
+
+uint8_t bundle_tree_salt[SYNC_SALT_LEN]={0xa9,0x1b,0x8d,0x11,0xdd,0xee,0x20,0xd0};
+
 int register_bundle(char *service,
 		    char *bid,
 		    char *version,
@@ -113,19 +157,45 @@ int register_bundle(char *service,
 		    char *recipient,
 		    char *name)
 {
-  int i;
-
-  // XXX - Find and store feed name (= subscriber public name) for displaying when
-  // explaining a MeshMS or MeshMB transfer on :21506 status page.
-  
   // Calculate the key required for the bundle tree used to efficiently determine which
   // bundles a pair of peers have in common, and thus also the bundles each needs to
   // send to the other.
   sync_key_t bundle_sync_key;
-  uint8_t bundle_tree_salt[SYNC_SALT_LEN]={0xa9,0x1b,0x8d,0x11,0xdd,0xee,0x20,0xd0};
-  
-  bundle_calculate_tree_key(&bundle_sync_key,bundle_tree_salt,
-			    bid,strtoll(version,NULL,10),length,filehash);   
+  uint8_t sync_digest[SYNC_DIGEST_LEN];
+  long long versionll=strtoll(version,NULL,10);
+
+  bundle_calculate_sync_digest(sync_digest,bid,versionll,length,filehash);
+  if (sync_salt_rotation_interval)
+    bundle_tree_key_from_digest(&bundle_sync_key,bundle_tree_salt,sync_digest,
+				bid,versionll,length,service);
+  else
+    bundle_calculate_tree_key(&bundle_sync_key,bundle_tree_salt,
+			      bid,versionll,length,filehash,service);
+
+  return register_bundle_with_key(bundle_sync_key,sync_digest,service,bid,version,author,
+				  originated_here,length,filehash,sender,recipient,
+				  name);
+}
+
+// As register_bundle(), but for when we already know the sync tree key of the
+// bundle, e.g., when restoring from a bundle snapshot.
+int register_bundle_with_key(sync_key_t bundle_sync_key,
+			     uint8_t sync_digest[SYNC_DIGEST_LEN],
+			     char *service,
+			     char *bid,
+			     char *version,
+			     char *author,
+			     char *originated_here,
+			     long long length,
+			     char *filehash,
+			     char *sender,
+			     char *recipient,
+			     char *name)
+{
+  int i;
+
+  // XXX - Find and store feed name (= subscriber public name) for displaying when
+  // explaining a MeshMS or MeshMB transfer on :21506 status page.
 
   if (debug_bundles)
     printf(">>> %s We now have bundle %s*,"
@@ -145,46 +215,22 @@ int register_bundle(char *service,
     process_ota_bundle(bid,version);
   }
   
-  // Ignore non-meshms bundles when in meshms-only mode.
-  // (actually, accepts both meshms (SMS-like service) and meshmb (micro-blogging service)
-  if (meshms_only) {
-    if (strncasecmp("meshm",service,5)) {
-      rhizome_log(service,bid,version,author,originated_here,length,filehash,sender,recipient,
-		  "Rejected non-meshms bundle seen while meshms_only=1");
-      ignored_bundles++;
-      return 0;
-    }
-  }
-  
   long long versionll=strtoll(version,NULL,10);
+  char *reason=NULL;
 
-  // Ignore bundles that are too old
-  // (except if MeshMS2, since that uses journal bundles, and so the version does
-  // not represent the age of a bundle.)
-  if ((versionll<min_version)&&strncasecmp("meshms2",service,7)) {
+  if (!bundle_acceptable(service,versionll,&reason)) {
     rhizome_log(service,bid,version,author,originated_here,length,filehash,sender,recipient,
-		"Rejected bundle because it was too old (version<min_version), and service!=meshms2");
+		reason);
     ignored_bundles++;
     return 0;
   }
   
   // Remove bundle from partial lists of all peers if we have other transmissions
   // to us in progress of this bundle
-  // XXX - Linear searches! Replace with hash table etc
-  for(i=0;i<MAX_BUNDLES_IN_FLIGHT;i++) {
-    if (partials[i].bid_prefix) {
-      // Here is a bundle in flight
-      char *bid_prefix=partials[i].bid_prefix;
-      long long bid_version=partials[i].bundle_version;
-      
-      if (versionll>=bid_version)
-	if (!strncasecmp(bid,bid_prefix,strlen(bid_prefix)))
-	  {
-	    fprintf(stderr,"--- Culling in-progress transfer for bundle that has shown up in Rhizome.\n");
-	    clear_partial(&partials[i]);
-	    break;
-	  }
-    }
+  i=partial_find(bid_prefix_hex_to_bin(bid));
+  if ((i>=0)&&(versionll>=partials[i].bundle_version)) {
+    fprintf(stderr,"--- Culling in-progress transfer for bundle that has shown up in Rhizome.\n");
+    clear_partial(&partials[i]);
   }
   
   // XXX - Linear search through bundles!
@@ -208,6 +254,8 @@ int register_bundle(char *service,
       ignored_bundles++;
       return 0;
     }
+
+    bundle_list_digest-=bundle_list_entry_hash(bid,bundles[bundle_number].version);
     
     free(bundles[bundle_number].service);
     bundles[bundle_number].service=NULL;
@@ -248,10 +296,14 @@ int register_bundle(char *service,
     bundles[bundle_number].last_offset_announced=0;
     bundles[bundle_number].last_version_of_manifest_announced=0;
     bundles[bundle_number].last_announced_time=0;
+#ifndef SYNC_BY_BAR
+    bundle_lacks_clear(bundle_number);
+#endif
   }
   
   bundles[bundle_number].service=strdup(service);
   bundles[bundle_number].version=strtoll(version,NULL,10);
+  bundle_list_digest+=bundle_list_entry_hash(bid,versionll);
   bundles[bundle_number].author=strdup(author);
   bundles[bundle_number].originated_here_p=atoi(originated_here);
   bundles[bundle_number].length=length;
@@ -259,8 +311,10 @@ int register_bundle(char *service,
   bundles[bundle_number].sender=strdup(sender);
   bundles[bundle_number].recipient=strdup(recipient);
   bundles[bundle_number].sync_key=bundle_sync_key;
+  bcopy(sync_digest,bundles[bundle_number].sync_digest,SYNC_DIGEST_LEN);
   
   bundles[bundle_number].index=bundle_number;
+  bundle_priority_changed(bundle_number);
   
   // Add bundle to the sync tree 
   sync_add_key(sync_state,&bundle_sync_key,&bundles[bundle_number]);
@@ -293,6 +347,9 @@ int register_bundle(char *service,
   // Add it to the list of bundles that have been added/updated,
   // for link types that need it (currently only Outernet uplink)
   note_new_or_updated_bundle(bundle_number); 
+
+  // Our bundle list has changed, so the snapshot needs updating
+  bundle_snapshot_dirty=1;
   
   // Now work out if the bundle is our over-the-air update bundle.
   // If so, then download the bundle to disk, and mark it for update
@@ -44,6 +44,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 int free_peer(struct peer_state *p)
 {
+  if (p->sid_prefix) bundle_priority_peer_changed(p->sid_prefix);
   if (p->sid_prefix) { free(p->sid_prefix); } p->sid_prefix=NULL;
   for(int i=0;i<4;i++) p->sid_prefix_bin[i]=0;
 #ifdef SYNC_BY_BAR
@@ -54,6 +55,11 @@ int free_peer(struct peer_state *p)
   free(p->versions); p->versions=NULL;
   free(p->size_bytes); p->size_bytes=NULL;
   free(p->insert_failures); p->insert_failures=NULL;
+#endif
+  peer_note_inactive(p);
+#ifndef SYNC_BY_BAR
+  peer_queue_free_tx(p);
+  peer_lacks_forget(p);
 #endif
   sync_free_peer_state(sync_state, p);
   free(p);
@@ -207,67 +213,101 @@ int hex_to_val(int c)
 
 int last_peer_requested=0;
 
-int random_active_peer()
+/*
+  The set of peers that we have heard from recently.  Peers join it when we hear
+  from them, and active_peers_serviceloop() expires those that have gone quiet, so
+  that counting or choosing active peers never has to look at every peer we have
+  ever seen, nor call time().
+
+  random_active_peer() hands out the active peers in deficit round-robin order:
+  each peer in turn gets a quantum of picks according to how much we have queued
+  for it, so that busier peers get more, but every active peer gets at least one
+  pick per round.
+*/
+int active_peers[MAX_PEERS];
+int active_peer_total=0;
+static int active_peer_cursor=0;
+static int active_peer_deficit=0;
+// No peer gets more than this many picks in a row
+#define ACTIVE_PEER_MAX_QUANTUM 4
+
+void peer_note_heard(int peer)
 {
-  int peer;
-  int the_peer=-1;
+  struct peer_state *p=peer_records[peer];
+  if (!p) return;
+  if (p->active_slot) {
+    assert(active_peers[p->active_slot-1]==peer);
+    return;
+  }
+  active_peers[active_peer_total++]=peer;
+  p->active_slot=active_peer_total;
+#ifndef SYNC_BY_BAR
+  peer_lacks_set_counted(p,1);
+#endif
+}
 
-  // Work out who to ask next?
-  // (consider all peers in round-robin)
-  peer=last_peer_requested+1;
-  if (peer>=peer_count) peer=0;
-  if (peer<0) peer=0;
-  
-  for(;peer<peer_count;peer++)
-    {
-      if (!peer_records[peer]) continue;
-      if ((time(0)-peer_records[peer]->last_message_time)>peer_keepalive_interval) {
-	continue;
-      }
-      the_peer=peer;
-      break;
-    }
-  if (the_peer==-1)
-    for(peer=0;(peer<=last_peer_requested)&&(peer<peer_count);peer++)
-      {
-	if (!peer_records[peer]) continue;
-	if ((time(0)-peer_records[peer]->last_message_time)>peer_keepalive_interval) {
-	  continue;
-	}
-	the_peer=peer;
-	break;
-      }
+void peer_note_inactive(struct peer_state *p)
+{
+  if (!p->active_slot) return;
+  int slot=p->active_slot-1;
+  p->active_slot=0;
+  // Move the last peer into the gap
+  active_peer_total--;
+  if (slot<active_peer_total) {
+    active_peers[slot]=active_peers[active_peer_total];
+    peer_records[active_peers[slot]]->active_slot=slot+1;
+  }
+  // Don't give the peer that takes this slot the rest of the departed peer's quantum
+  if (slot==active_peer_cursor) active_peer_deficit=0;
+#ifndef SYNC_BY_BAR
+  peer_lacks_set_counted(p,0);
+#endif
+}
 
-#if 0  
-  char active_peers[1024];
-  int apl=0;
-  for(peer=0;(peer<peer_count);peer++)
-    {
-      if (!peer_records[peer]) continue;
-      if ((time(0)-peer_records[peer]->last_message_time)>peer_keepalive_interval)
-	continue;
-      snprintf(&active_peers[apl],1024-apl,"%d, ",peer);
-      apl=strlen(active_peers);
-      printf("     active_peers='%s'\n",active_peers);
-    }
-  if (apl>1) active_peers[apl-2]=0;
-  else strcpy(active_peers,"<none>");
-  printf("T+%lldms : Random peer is %d (active peer(s) = %s, last requested = %d)\n",gettime_ms()-start_time,peer,active_peers,last_peer_requested);
+int active_peers_serviceloop(void)
+{
+  static time_t last_check=0;
+  time_t now=time(0);
+  if (now==last_check) return 0;
+  last_check=now;
+
+  for(int i=active_peer_total-1;i>=0;i--) {
+    struct peer_state *p=peer_records[active_peers[i]];
+    if ((now-p->last_message_time)>peer_keepalive_interval)
+      peer_note_inactive(p);
+  }
+  return 0;
+}
+
+int random_active_peer()
+{
+  if (!active_peer_total) return -1;
+  if (active_peer_cursor>=active_peer_total) {
+    active_peer_cursor=0;
+    active_peer_deficit=0;
+  }
+
+  int peer=active_peers[active_peer_cursor];
+  if (active_peer_deficit<=0) {
+    int quantum=1;
+#ifndef SYNC_BY_BAR
+    // Weight by how much we have waiting to send them
+    struct peer_state *p=peer_records[peer];
+    quantum+=p->tx_queue_len+((p->tx_bundle>=0)?1:0);
 #endif
-  
-  peer=the_peer;
-  if (peer>=-1) last_peer_requested=peer;
-  
+    if (quantum>ACTIVE_PEER_MAX_QUANTUM) quantum=ACTIVE_PEER_MAX_QUANTUM;
+    active_peer_deficit=quantum;
+  }
+  active_peer_deficit--;
+  if (!active_peer_deficit) active_peer_cursor++;
+
+  last_peer_requested=peer;
   return peer;
 }
 
 int active_peer_count()
 {
-  int count=0;
-  for(int peer=0;peer<peer_count;peer++)
-    if ((time(0)-peer_records[peer]->last_message_time)<=peer_keepalive_interval)
-      count++;
-  return count;
+  return active_peer_total;
 }
 
 
@@ -419,7 +459,7 @@ int peer_queue_list_dump(struct peer_state *p)
 	 (p->tx_bundle>-1)?
 	 bundles[p->tx_bundle].bid_hex:"",
 	 p->tx_bundle_priority);
-  printf("& %d more queued\n",p->tx_queue_len);
+  printf("& %d more queued (in heap order)\n",p->tx_queue_len);
   for(int i=0;i<p->tx_queue_len;i++) {
     int bundle=p->tx_queue_bundles[i];
     int priority=p->tx_queue_priorities[i];
@@ -430,61 +470,3 @@ int peer_queue_list_dump(struct peer_state *p)
   return 0;
 }
 
-int peer_queue_bundle_tx(struct peer_state *p,struct bundle_record *b, int priority)
-{
-  int i;
-  int pn=-1;
-
-  for(i=0;i<pn;i++) if (p==peer_records[i]) pn=i;
-
-  printf("Queueing bundle #%d ",b->index);
-  if (pn>-1)
-    describe_bundle(RESOLVE_SIDS,stdout,NULL,b->index,pn,-1,-1);
-  printf(" for transmission to %s*\n",p->sid_prefix);
-  
-  // Don't queue if already in the queue
-  for(i=0;i<p->tx_queue_len;i++) 
-    {
-      if (p->tx_queue_bundles[i]==b->index) return 0;
-    }
-  
-  // Find point of insertion
-  for(i=0;i<p->tx_queue_len;i++) 
-    if (p->tx_queue_priorities[i]<priority) { break; }
-
-  if (i<MAX_TXQUEUE_LEN) {    
-    // Shift rest of list down
-    if (i<(p->tx_queue_len-1)) {
-      bcopy(&p->tx_queue_priorities[i],
-	    &p->tx_queue_priorities[i+1],
-	    sizeof(int)*(p->tx_queue_len-i-1));
-      bcopy(&p->tx_queue_bundles[i],
-	    &p->tx_queue_bundles[i+1],
-	    sizeof(int)*(p->tx_queue_len-i-1));
-    }
-    
-    // Write new entry
-    p->tx_queue_bundles[i]=b->index;
-    p->tx_queue_priorities[i]=priority;
-    if (i>=p->tx_queue_len)
-      p->tx_queue_len=i+1;
-
-    // printf("After queueing new bundle:\n"); fflush(stdout);
-    // peer_queue_list_dump(p);
-    
-    return 0;
-  } else {
-    // Fail on insertion if the queue is already full of higher priority stuff.
-    
-    /* Remember that TX queue has overflowed, so that when the TX queue is 
-       empitied, we know that we need to re-sync our tree with them to
-       rediscover the bundles that should be sent.
-       XXX - Eventually this will be replaced with Jeremy's new sync tree
-       enumeration code, that will allow us to rediscover the missing bundles,
-       without throwing away all sync state.
-    */
-    
-    p->tx_queue_overflow=1;
-    return -1;
-  }
-}
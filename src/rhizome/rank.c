@@ -108,6 +108,25 @@ int lengthToPriority(long long value)
   return (result<<4)|part;
 }
 
+// We only know our peers by a prefix of their SID
+static int recipient_is_peer_p(char *recipient,char *sid_prefix)
+{
+  int len=strlen(sid_prefix);
+  if (!len) return 0;
+  return !strncasecmp(recipient,sid_prefix,len);
+}
+
+// (this is called for every bundle whenever keys or priorities are calculated,
+// so only say so once)
+static int prioritisation_disabled(void)
+{
+  static int warned=0;
+  if (!debug_noprioritisation) return 0;
+  if (!warned) printf("WARNING: Rhizome bundle prioritisation disabled.\n");
+  warned=1;
+  return 1;
+}
+
 long long calculate_bundle_intrinsic_priority(char *bid,
 					      long long length,
 					      long long version,
@@ -118,10 +137,7 @@ long long calculate_bundle_intrinsic_priority(char *bid,
 
   // Allow disabling of bundle prioritisation for comparison of effect
   // of prioritisation 
-  if (debug_noprioritisation) {
-     printf("WARNING: Rhizome bundle prioritisation disabled.\n");
-     return 1;
-  }
+  if (prioritisation_disabled()) return 1;
 
   // Start with length
   long long this_bundle_priority = lengthToPriority(length);
@@ -138,9 +154,7 @@ long long calculate_bundle_intrinsic_priority(char *bid,
   int addressed_to_peer=0;
   if (recipient) {
     for(j=0;j<peer_count;j++) {
-      if (!strncmp(recipient,
-		   peer_records[j]->sid_prefix,
-		   (8*2))) {
+      if (recipient_is_peer_p(recipient,peer_records[j]->sid_prefix)) {
 	// Bundle is addressed to a peer.
 	// Increase priority if we do not have positive confirmation that peer
 	// has this version of this bundle.
@@ -188,27 +202,132 @@ long long calculate_bundle_intrinsic_priority(char *bid,
   return this_bundle_priority;
 }
 
+// Map a bundle to one of 16 coarse priority classes, 0 being the most urgent,
+// for partitioning the sync tree key space.  Only the intrinsic properties of
+// the bundle are used, so that every peer puts the bundle in the same class.
+int bundle_priority_class(char *bid,long long length,long long version,char *service)
+{
+  long long priority=calculate_bundle_intrinsic_priority(bid,length,version,service,NULL,0);
+
+  if (priority>=2*BUNDLE_PRIORITY_IS_MESHMS) return 0;
+  if (priority>=BUNDLE_PRIORITY_IS_MESHMS) return 1;
+
+  // Remaining classes are by size, smallest first.
+  int size_class=2+((0x3ff-(priority&0x3ff))>>6);
+  if (size_class>15) size_class=15;
+  return size_class;
+}
+
+/*
+  The intrinsic priorities of the bundles we hold are cached in their bundle
+  records, and recalculated only when a bundle changes, or when a peer that it is
+  addressed to arrives or leaves.  So that we can find the bundles addressed to a
+  peer quickly, bundles are indexed by a hash of the start of their recipient SID.
+  Both arrays hold bundle number + 1, so that zero means the end of the chain.
+*/
+#define RECIPIENT_INDEX_SIZE 1024
+// The length of the SID prefixes we know our peers by
+#define RECIPIENT_INDEX_PREFIX_LEN (6*2)
+static int recipient_index_heads[RECIPIENT_INDEX_SIZE];
+static int recipient_index_next[MAX_BUNDLES];
+// Which chain each bundle is on, plus one, or zero if it isn't on one
+static int recipient_index_chain[MAX_BUNDLES];
+
+static int recipient_index_hash(char *sid_hex)
+{
+  if ((!sid_hex)||(strlen(sid_hex)<RECIPIENT_INDEX_PREFIX_LEN)) return -1;
+  unsigned int h=0;
+  for(int i=0;i<RECIPIENT_INDEX_PREFIX_LEN;i++) {
+    h=(h<<4)^(h>>20)^hex_to_val(sid_hex[i]);
+  }
+  return h%RECIPIENT_INDEX_SIZE;
+}
+
+static void recipient_index_remove(int bundle)
+{
+  if (!recipient_index_chain[bundle]) return;
+  int *link=&recipient_index_heads[recipient_index_chain[bundle]-1];
+  while (*link) {
+    if ((*link)==(bundle+1)) {
+      *link=recipient_index_next[bundle];
+      break;
+    }
+    link=&recipient_index_next[(*link)-1];
+  }
+  recipient_index_next[bundle]=0;
+  recipient_index_chain[bundle]=0;
+}
+
+int bundle_priority_changed(int bundle)
+{
+  // The bundle has a new version, so forget what we knew, and index it by its
+  // (possibly new) recipient.
+  bundles[bundle].intrinsic_priority_valid=0;
+  bundles[bundle].priority_class_valid=0;
+  recipient_index_remove(bundle);
+  int h=recipient_index_hash(bundles[bundle].recipient);
+  if (h>=0) {
+    recipient_index_next[bundle]=recipient_index_heads[h];
+    recipient_index_heads[h]=bundle+1;
+    recipient_index_chain[bundle]=h+1;
+  }
+  return 0;
+}
+
+int bundle_priority_peer_changed(char *sid_prefix)
+{
+  // A peer has arrived or left, so the bundles addressed to it need their
+  // priorities recalculated.
+  int h=recipient_index_hash(sid_prefix);
+  if (h<0) return 0;
+  int count=0;
+  for(int n=recipient_index_heads[h];n;n=recipient_index_next[n-1]) {
+    if (recipient_is_peer_p(bundles[n-1].recipient,sid_prefix)) {
+      bundles[n-1].intrinsic_priority_valid=0;
+      count++;
+    }
+  }
+  return count;
+}
+
+long long bundle_intrinsic_priority(int bundle)
+{
+  if (debug_noprioritisation||(!bundles[bundle].intrinsic_priority_valid)) {
+    bundles[bundle].intrinsic_priority=
+      calculate_bundle_intrinsic_priority(bundles[bundle].bid_hex,
+					  bundles[bundle].length,
+					  bundles[bundle].version,
+					  bundles[bundle].service,
+					  bundles[bundle].recipient,
+					  0 /* it is a bundle in rhizome, so
+					       insert_failures is meaningless here. */
+					  );
+    bundles[bundle].intrinsic_priority_valid=1;
+  }
+  return bundles[bundle].intrinsic_priority;
+}
+
+int bundle_cached_priority_class(int bundle)
+{
+  if (debug_noprioritisation||(!bundles[bundle].priority_class_valid)) {
+    bundles[bundle].priority_class=
+      bundle_priority_class(bundles[bundle].bid_hex,bundles[bundle].length,
+			    bundles[bundle].version,bundles[bundle].service);
+    bundles[bundle].priority_class_valid=1;
+  }
+  return bundles[bundle].priority_class;
+}
+
 int calculate_stored_bundle_priority(int i,int versus)
 {    
   // Allow disabling of bundle prioritisation for comparison of effect
   // of prioritisation 
-  if (debug_noprioritisation) {
-     printf("WARNING: Rhizome bundle prioritisation disabled.\n");
-     return 1;
-  }
+  if (prioritisation_disabled()) return 1;
 
   // Start with intrinsic priority of the bundle based on size, service,
   // who it is addressed to, and whether we have had problems inserting it
   // into rhizome.
-  long long this_bundle_priority=
-    calculate_bundle_intrinsic_priority(bundles[i].bid_hex,
-					bundles[i].length,
-					bundles[i].version,
-					bundles[i].service,
-					bundles[i].recipient,
-					0 /* it is a bundle in rhizome, so
-					     insert_failures is meaningless here. */
-					);
+  long long this_bundle_priority=bundle_intrinsic_priority(i);
   
   long long time_delta=0;
   
@@ -236,6 +355,9 @@ int calculate_stored_bundle_priority(int i,int versus)
 					 bundles[i].version))
 	num_peers_that_dont_have_it++;
   }
+#else
+  // Kept up to date as the sync tree tells us who has what
+  num_peers_that_dont_have_it=bundles[i].num_peers_that_dont_have_it;
 #endif
   
   // We only apply the less-recently-sent priority flag if there are peers who
@@ -275,6 +397,101 @@ int calculate_stored_bundle_priority(int i,int versus)
   return this_bundle_priority;
 }
 
+#ifndef SYNC_BY_BAR
+/*
+  The number of active peers that lack each bundle is maintained as the sync tree
+  tells us that a peer lacks or has a bundle, with a bit per bundle for each peer,
+  so that we never have to go looking.  Peers that go quiet stop being counted,
+  and are counted again if we hear from them (see peer_note_heard()).
+*/
+static void peer_lacks_bit_grow(struct peer_state *p,int bundle)
+{
+  if ((bundle>>3)<p->lacks_bitmap_bytes) return;
+  int bytes=p->lacks_bitmap_bytes?p->lacks_bitmap_bytes:128;
+  while (bytes<=(bundle>>3)) bytes*=2;
+  if (bytes>((MAX_BUNDLES+7)>>3)) bytes=(MAX_BUNDLES+7)>>3;
+  p->lacks_bitmap=realloc(p->lacks_bitmap,bytes);
+  assert(p->lacks_bitmap);
+  bzero(&p->lacks_bitmap[p->lacks_bitmap_bytes],bytes-p->lacks_bitmap_bytes);
+  p->lacks_bitmap_bytes=bytes;
+}
+
+static void peer_lacks_count(struct peer_state *p,int delta)
+{
+  for(int i=0;i<p->lacks_bitmap_bytes;i++) {
+    if (!p->lacks_bitmap[i]) continue;
+    for(int j=0;j<8;j++)
+      if (p->lacks_bitmap[i]&(1<<j))
+	bundles[i*8+j].num_peers_that_dont_have_it+=delta;
+  }
+}
+
+int peer_note_lacks_bundle(struct peer_state *p,int bundle,int lacks)
+{
+  if ((bundle<0)||(bundle>=MAX_BUNDLES)) return -1;
+  peer_lacks_bit_grow(p,bundle);
+  unsigned char bit=1<<(bundle&7);
+  int had=(p->lacks_bitmap[bundle>>3]&bit)?1:0;
+  if (had==lacks) return 0;
+
+  if (lacks) p->lacks_bitmap[bundle>>3]|=bit;
+  else p->lacks_bitmap[bundle>>3]&=~bit;
+
+  if (p->lacks_counted) {
+    if (lacks) {
+      bundles[bundle].num_peers_that_dont_have_it++;
+      // Another peer needs this bundle, so reset the last sent time for it.
+      bundles[bundle].last_announced_time=0;
+    } else
+      bundles[bundle].num_peers_that_dont_have_it--;
+  }
+  return 0;
+}
+
+void peer_lacks_forget(struct peer_state *p)
+{
+  if (p->lacks_counted) peer_lacks_count(p,-1);
+  free(p->lacks_bitmap);
+  p->lacks_bitmap=NULL;
+  p->lacks_bitmap_bytes=0;
+  p->lacks_counted=0;
+}
+
+void peer_lacks_set_counted(struct peer_state *p,int counted)
+{
+  // Start or stop counting the peer as they become active or go quiet
+  if (counted==p->lacks_counted) return;
+  peer_lacks_count(p,counted?1:-1);
+  p->lacks_counted=counted;
+}
+
+void bundle_lacks_clear(int bundle)
+{
+  // What peers told us about the old version of a bundle says nothing about
+  // whether they have the new one, so start again from scratch.
+  unsigned char bit=1<<(bundle&7);
+  for(int i=0;i<peer_count;i++) {
+    struct peer_state *p=peer_records[i];
+    if (p&&((bundle>>3)<p->lacks_bitmap_bytes))
+      p->lacks_bitmap[bundle>>3]&=~bit;
+  }
+  bundles[bundle].num_peers_that_dont_have_it=0;
+}
+
+void peer_lacks_forget_all(void)
+{
+  // Used when the sync tree is rebuilt, which makes our peers start syncing with
+  // us again from scratch.
+  for(int i=0;i<peer_count;i++) {
+    struct peer_state *p=peer_records[i];
+    if (!p) continue;
+    int counted=p->lacks_counted;
+    peer_lacks_forget(p);
+    peer_lacks_set_counted(p,counted);
+  }
+}
+#endif
+
 int find_highest_priority_bundle()
 {
   long long this_bundle_priority=0;
@@ -76,14 +76,52 @@ int rhizome_log(char *service,
 }
 
 int load_rhizome_db_socket=-1;
+
+/*
+  The newsince listing should tell us about every bundle that arrives, but as
+  insurance against missing something, e.g., if servald's database was replaced, we
+  periodically check that we are still in step with servald.  Most checks only read
+  the first row of the full bundle list, which is sorted newest first and so carries
+  the token of the newest bundle, and compare it with our token.  That cannot see a
+  bundle missed or deleted further down the list, so every RHIZOME_DB_VERIFY_INTERVAL
+  checks we instead read the whole list without registering it, and compare the
+  number of bundles and the sum of their bundle_list_entry_hash() values with those
+  of the bundles we hold.  A bundle can arrive between our newsince request and the
+  check, so we only reload the whole list if a check fails twice in a row.
+*/
+#define RHIZOME_DB_CHECK_INTERVAL 32
+#define RHIZOME_DB_VERIFY_INTERVAL 8
+#define RHIZOME_DB_CHECK_HEAD 1
+#define RHIZOME_DB_CHECK_VERIFY 2
+int load_rhizome_db_checking=0;
+int load_rhizome_db_polls_until_check=RHIZOME_DB_CHECK_INTERVAL;
+int load_rhizome_db_checks_until_verify=RHIZOME_DB_VERIFY_INTERVAL;
+int load_rhizome_db_check_failures=0;
+int load_rhizome_db_reload=0;
+int load_rhizome_db_verify_count=0;
+unsigned long long load_rhizome_db_verify_digest=0;
+
 int load_rhizome_db_async_start(char *servald_server,
 				char *credential, char *token)
 {
   char path[8192];
+
+  load_rhizome_db_checking=0;
   
   // We use the new-since-time version once we have a token
   // to make this much faster.
-  if ((!token)||(!token[0])||(!(random()&0x1f))) {
+  if ((!token)||(!token[0])||load_rhizome_db_reload) {
+      load_rhizome_db_reload=0;
+      snprintf(path,8192,"/restful/rhizome/bundlelist.json");
+  } else if ((--load_rhizome_db_polls_until_check)<=0) {
+      load_rhizome_db_polls_until_check=RHIZOME_DB_CHECK_INTERVAL;
+      if ((--load_rhizome_db_checks_until_verify)<=0) {
+	load_rhizome_db_checks_until_verify=RHIZOME_DB_VERIFY_INTERVAL;
+	load_rhizome_db_checking=RHIZOME_DB_CHECK_VERIFY;
+	load_rhizome_db_verify_count=0;
+	load_rhizome_db_verify_digest=0;
+      } else
+	load_rhizome_db_checking=RHIZOME_DB_CHECK_HEAD;
       snprintf(path,8192,"/restful/rhizome/bundlelist.json");
   } else
     snprintf(path,8192,"/restful/rhizome/newsince/%s/bundlelist.json",
@@ -94,6 +132,23 @@ int load_rhizome_db_async_start(char *servald_server,
   return load_rhizome_db_socket;
 }
 
+// Returns 1 if we should give up on the check for now, or 0 if we have really
+// diverged from servald and need to reload the whole list.
+int load_rhizome_db_check_failed(void)
+{
+  load_rhizome_db_check_failures++;
+  if (load_rhizome_db_check_failures<2) {
+    // Give newsince a chance to catch up, then check again the same way.
+    load_rhizome_db_polls_until_check=2;
+    if (load_rhizome_db_checking==RHIZOME_DB_CHECK_VERIFY)
+      load_rhizome_db_checks_until_verify=1;
+    return 1;
+  }
+  fprintf(stderr,"Bundle list out of step with servald, reloading it in full.\n");
+  load_rhizome_db_check_failures=0;
+  return 0;
+}
+
 char load_rhizome_db_line[1024];
 int load_rhizome_db_line_bytes=0;
 long long load_rhizome_db_socket_timeout=0;
@@ -126,6 +181,20 @@ int load_rhizome_db_async(char *servald_server,
       // End of JSON
       close(load_rhizome_db_socket);
       load_rhizome_db_socket=-1;
+      if (load_rhizome_db_checking==RHIZOME_DB_CHECK_VERIFY) {
+	if ((load_rhizome_db_verify_count==bundle_count)
+	    &&(load_rhizome_db_verify_digest==bundle_list_digest))
+	  load_rhizome_db_check_failures=0;
+	else {
+	  fprintf(stderr,"servald lists %d bundles, digest %016llx, but we hold %d, digest %016llx.\n",
+		  load_rhizome_db_verify_count,load_rhizome_db_verify_digest,
+		  bundle_count,bundle_list_digest);
+	  // We did not register the rows while verifying, so the reload has to be
+	  // another request.
+	  if (!load_rhizome_db_check_failed()) load_rhizome_db_reload=1;
+	}
+	load_rhizome_db_checking=0;
+      }
       return 0;
     }
     
@@ -136,6 +205,30 @@ int load_rhizome_db_async(char *servald_server,
 
 	char fields[14][8192];
 	int n=parse_json_line(load_rhizome_db_line,fields,14);
+	if ((n==14)&&(load_rhizome_db_checking==RHIZOME_DB_CHECK_VERIFY)) {
+	  // Tally the bundles we would have kept, without registering them.
+	  long long version=strtoll(fields[4],NULL,10);
+	  char *reason;
+	  if (bundle_acceptable(fields[2],version,&reason)) {
+	    load_rhizome_db_verify_count++;
+	    load_rhizome_db_verify_digest+=bundle_list_entry_hash(fields[3],version);
+	  }
+	  n=0;
+	}
+	if ((n==14)&&(load_rhizome_db_checking==RHIZOME_DB_CHECK_HEAD)) {
+	  // This is the newest bundle that servald has.
+	  int up_to_date=!strcmp(fields[0],token);
+	  if (up_to_date) load_rhizome_db_check_failures=0;
+	  if (up_to_date||load_rhizome_db_check_failed()) {
+	    // No need (yet) to read the rest of the list.
+	    load_rhizome_db_checking=0;
+	    close(load_rhizome_db_socket);
+	    load_rhizome_db_socket=-1;
+	    return 0;
+	  }
+	  // We really have diverged from servald, so read the whole list.
+	  load_rhizome_db_checking=0;
+	}
 	if (n==14) {
 	  if (strcmp(fields[0],"null")) {
 	    // We have a token that will allow us to ask for only newer bundles in a
@@ -164,6 +257,12 @@ int load_rhizome_db_async(char *servald_server,
       break;
     case 1: // end of connection, socket already closed
       load_rhizome_db_socket=-1;
+      if (load_rhizome_db_checking==RHIZOME_DB_CHECK_VERIFY) {
+	// We did not see the whole list, so try again soon.
+	load_rhizome_db_polls_until_check=2;
+	load_rhizome_db_checks_until_verify=1;
+	load_rhizome_db_checking=0;
+      }
       return 0;
       break;
     case -1: // EAGAIN, so keep trying, but return for now
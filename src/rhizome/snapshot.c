@@ -0,0 +1,289 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2016 Serval Project Inc.
+
+This program monitors a local Rhizome database and attempts
+to synchronise it over low-bandwidth declarative transports,
+such as bluetooth name or wifi-direct service information
+messages.  It is intended to give a high priority to MeshMS
+converations among nearby nodes.
+
+The design is fully asynchronous, so a call to the update_my_message()
+function from time to time should be all that is required.
+
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+  Bundle list snapshots.
+
+  On start up we would otherwise have to fetch the entire bundle list from servald,
+  and calculate the sync key for every bundle, before we can usefully talk to our
+  peers. On slow hardware with a large Rhizome store this can take a long time, so
+  instead we periodically write our list of bundles, their sync keys and the
+  newsince token to a file.  On start up we load that, and then only need to ask
+  servald for the bundles that have arrived since the snapshot was written.
+
+  The file is a fixed header followed by fixed-size records, so that it can be
+  simply mapped into memory when loading.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sync.h"
+#include "lbard.h"
+
+#define BUNDLE_SNAPSHOT_MAGIC "LBARDSN2"
+// Don't rewrite the snapshot more often than this
+#define BUNDLE_SNAPSHOT_INTERVAL 60
+
+struct bundle_snapshot_header {
+  char magic[8];
+  uint32_t record_size;
+  uint32_t bundle_count;
+  // The sync key scheme in use when the snapshot was written
+  uint32_t priority_keys;
+  uint8_t salt[SYNC_SALT_LEN];
+  char token[1024];
+};
+
+struct bundle_snapshot_record {
+  sync_key_t sync_key;
+  uint8_t sync_digest[SYNC_DIGEST_LEN];
+  long long version;
+  long long length;
+  int originated_here_p;
+  char service[40];
+  char bid_hex[32*2+1];
+  char author[32*2+1];
+  char filehash[64*2+1];
+  char sender[32*2+1];
+  char recipient[32*2+1];
+  // Feed name of MeshMB1 bundles, which is otherwise only in the manifest
+  char name[128];
+};
+
+char *bundle_snapshot_filename=NULL;
+int bundle_snapshot_dirty=0;
+time_t bundle_snapshot_last_save=0;
+
+extern int load_rhizome_db_socket;
+
+#define SNAPSHOT_COPY_FIELD(D,S) do { \
+    if (!(S)||strlen(S)>=sizeof(D)) return -1;	\
+    strcpy(D,S); } while(0)
+
+#define SNAPSHOT_FIELD_OK(F) (memchr(F,0,sizeof(F))!=NULL)
+
+static int bundle_snapshot_fill_record(struct bundle_snapshot_record *r,int bundle)
+{
+  bzero(r,sizeof(struct bundle_snapshot_record));
+  r->sync_key=bundles[bundle].sync_key;
+  bcopy(bundles[bundle].sync_digest,r->sync_digest,SYNC_DIGEST_LEN);
+  r->version=bundles[bundle].version;
+  r->length=bundles[bundle].length;
+  r->originated_here_p=bundles[bundle].originated_here_p;
+  SNAPSHOT_COPY_FIELD(r->service,bundles[bundle].service);
+  SNAPSHOT_COPY_FIELD(r->bid_hex,bundles[bundle].bid_hex);
+  SNAPSHOT_COPY_FIELD(r->author,bundles[bundle].author);
+  SNAPSHOT_COPY_FIELD(r->filehash,bundles[bundle].filehash);
+  SNAPSHOT_COPY_FIELD(r->sender,bundles[bundle].sender);
+  SNAPSHOT_COPY_FIELD(r->recipient,bundles[bundle].recipient);
+  // (an overlong feed name just isn't restored, as it is only for display and ranking)
+  if (!strcmp(bundles[bundle].service,"MeshMB1")) {
+    char *name=find_sender_name(bundles[bundle].sender);
+    if (name&&(strlen(name)<sizeof(r->name))) strcpy(r->name,name);
+  }
+  return 0;
+}
+
+int bundle_snapshot_save(char *filename,char *token)
+{
+  char tmpname[1024];
+  snprintf(tmpname,1024,"%s.tmp",filename);
+
+  struct bundle_snapshot_header h;
+  bzero(&h,sizeof(h));
+  memcpy(h.magic,BUNDLE_SNAPSHOT_MAGIC,sizeof(h.magic));
+  h.record_size=sizeof(struct bundle_snapshot_record);
+  h.bundle_count=bundle_count;
+  h.priority_keys=sync_tree_priority_keys;
+  memcpy(h.salt,bundle_tree_salt,SYNC_SALT_LEN);
+  if (strlen(token)>=sizeof(h.token)) return -1;
+  strcpy(h.token,token);
+
+  FILE *f=fopen(tmpname,"w");
+  if (!f) {
+    perror("fopen");
+    fprintf(stderr,"Could not write bundle snapshot to '%s'\n",tmpname);
+    return -1;
+  }
+  int retVal=0;
+  if (fwrite(&h,sizeof(h),1,f)!=1) retVal=-1;
+  for(int i=0;(retVal==0)&&(i<bundle_count);i++) {
+    struct bundle_snapshot_record r;
+    if (bundle_snapshot_fill_record(&r,i)) {
+      fprintf(stderr,"Bundle %s* has fields too long for the bundle snapshot.\n",
+	      bundles[i].bid_hex);
+      retVal=-1;
+    }
+    else if (fwrite(&r,sizeof(r),1,f)!=1) retVal=-1;
+  }
+  if (fclose(f)) retVal=-1;
+
+  // Only replace the old snapshot once the new one is complete, so that a power
+  // failure while writing leaves us with the previous one.
+  if ((!retVal)&&rename(tmpname,filename)) {
+    perror("rename");
+    retVal=-1;
+  }
+  if (retVal) {
+    unlink(tmpname);
+    return -1;
+  }
+
+  if (debug_bundles)
+    printf(">>> %s Wrote snapshot of %d bundles to '%s'\n",
+	   timestamp_str(),bundle_count,filename);
+  return 0;
+}
+
+int bundle_snapshot_load(char *filename,char *token)
+{
+  int fd=open(filename,O_RDONLY);
+  if (fd<0) return -1;
+
+  struct stat st;
+  if (fstat(fd,&st)||(st.st_size<sizeof(struct bundle_snapshot_header))) {
+    close(fd);
+    return -1;
+  }
+
+  unsigned char *map=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (map==MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+
+  int retVal=-1;
+  struct bundle_snapshot_header *h=(struct bundle_snapshot_header *)map;
+  struct bundle_snapshot_record *records
+    =(struct bundle_snapshot_record *)(map+sizeof(struct bundle_snapshot_header));
+
+  do {
+    // Make sure that the snapshot is one we understand, is complete, and was made
+    // using the same sync key scheme as we are now using.
+    if (memcmp(h->magic,BUNDLE_SNAPSHOT_MAGIC,sizeof(h->magic))) break;
+    if (h->record_size!=sizeof(struct bundle_snapshot_record)) break;
+    if (h->bundle_count>MAX_BUNDLES) break;
+    if (st.st_size!=sizeof(struct bundle_snapshot_header)
+	+h->bundle_count*sizeof(struct bundle_snapshot_record)) break;
+    // (With rotating salts, we recalculate the keys from the digests anyway)
+    if ((!sync_salt_rotation_interval)&&(h->priority_keys!=sync_tree_priority_keys))
+      break;
+    if ((!sync_salt_rotation_interval)&&memcmp(h->salt,bundle_tree_salt,SYNC_SALT_LEN))
+      break;
+    if (!SNAPSHOT_FIELD_OK(h->token)) break;
+
+    int bad=0;
+    for(int i=0;i<h->bundle_count;i++) {
+      struct bundle_snapshot_record *r=&records[i];
+      if (!(SNAPSHOT_FIELD_OK(r->service)&&SNAPSHOT_FIELD_OK(r->bid_hex)
+	    &&SNAPSHOT_FIELD_OK(r->author)&&SNAPSHOT_FIELD_OK(r->filehash)
+	    &&SNAPSHOT_FIELD_OK(r->sender)&&SNAPSHOT_FIELD_OK(r->recipient)
+	    &&SNAPSHOT_FIELD_OK(r->name)
+	    &&(strlen(r->bid_hex)==32*2))) {
+	bad=1; break;
+      }
+    }
+    if (bad) break;
+
+    // Spot check the first and last sync keys and digests, to catch any change
+    // to the way they are calculated that isn't reflected above.
+    if (h->bundle_count) {
+      int check[2]={0,h->bundle_count-1};
+      for(int i=0;i<2;i++) {
+	struct bundle_snapshot_record *r=&records[check[i]];
+	uint8_t digest[SYNC_DIGEST_LEN];
+	bundle_calculate_sync_digest(digest,r->bid_hex,r->version,r->length,r->filehash);
+	if (memcmp(digest,r->sync_digest,SYNC_DIGEST_LEN)) bad=1;
+	if (sync_salt_rotation_interval) continue;
+	sync_key_t key;
+	bundle_calculate_tree_key(&key,bundle_tree_salt,r->bid_hex,r->version,
+				  r->length,r->filehash,r->service);
+	if (memcmp(&key,&r->sync_key,sizeof(key))) bad=1;
+      }
+    }
+    if (bad) break;
+
+    for(int i=0;i<h->bundle_count;i++) {
+      struct bundle_snapshot_record *r=&records[i];
+      char version[32];
+      char originated_here[16];
+      snprintf(version,32,"%lld",r->version);
+      snprintf(originated_here,16,"%d",r->originated_here_p);
+      sync_key_t key=r->sync_key;
+      if (sync_salt_rotation_interval)
+	bundle_tree_key_from_digest(&key,bundle_tree_salt,r->sync_digest,r->bid_hex,
+				    r->version,r->length,r->service);
+      register_bundle_with_key(key,r->sync_digest,r->service,r->bid_hex,version,r->author,
+			       originated_here,r->length,r->filehash,r->sender,
+			       r->recipient,r->name);
+    }
+
+    // Now we only need to ask servald for what has changed since the snapshot.
+    strcpy(token,h->token);
+    retVal=h->bundle_count;
+  } while(0);
+
+  munmap(map,st.st_size);
+
+  if (retVal<0)
+    fprintf(stderr,"Ignoring invalid or incompatible bundle snapshot '%s'\n",filename);
+  else {
+    fprintf(stderr,"Restored %d bundles from snapshot '%s'\n",retVal,filename);
+    // Everything we just loaded is already in the snapshot
+    bundle_snapshot_dirty=0;
+    bundle_snapshot_last_save=time(0);
+  }
+  return retVal;
+}
+
+int bundle_snapshot_serviceloop(char *token)
+{
+  if (!bundle_snapshot_filename) return 0;
+  if (!bundle_snapshot_dirty) return 0;
+  if ((time(0)-bundle_snapshot_last_save)<BUNDLE_SNAPSHOT_INTERVAL) return 0;
+  // Don't snapshot part way through reading a bundle list from servald, as the
+  // token may already describe bundles we have not yet seen.
+  if (load_rhizome_db_socket>=0) return 0;
+
+  bundle_snapshot_last_save=time(0);
+  if (bundle_snapshot_save(bundle_snapshot_filename,token)) return -1;
+  bundle_snapshot_dirty=0;
+  return 0;
+}
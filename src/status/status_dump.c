@@ -397,6 +397,14 @@ int status_dump_radioinfo(FILE *f, char *topic)
     fprintf(f,"Last heartbeat received at T-%lld.\n",radio_last_heartbeat_time);
   if (radio_temperature!=9999)
     fprintf(f," Radio temperature %dC\n",radio_temperature);
+  fprintf(f," Sending %d byte frames.\n",radio_frame_size());
+  if (packet_fill_capacity)
+    fprintf(f," Packets sent are %lld%% full on average (%d%% recently).\n",
+	    packet_fill_bytes*100/packet_fill_capacity,packet_fill_average*100/256);
+  if (packet_fill_bytes)
+    fprintf(f," Reports are %lld%% of bytes sent (%lld bytes).  %lld bytes of reports were replaced by newer ones, %lld dropped from a full queue, and %lld dropped as out of date before sending.\n",
+	    report_bytes_sent*100/packet_fill_bytes,report_bytes_sent,
+	    report_bytes_superseded,report_bytes_evicted,report_bytes_stale);
 
   // And EEPROM data (copy from /tmp/eeprom.data)
   char buffer[16384];
@@ -434,9 +442,10 @@ int status_dump_radiolinks(FILE *f, char *topic)
     else if (percent_received<80) colour="#c0c0c0";
     
     if (age<=30) {
-      fprintf(f,"<tr><td>%s*</td><td bgcolor=\"%s\">%lld sec, %d/%d received (%2.1f%% loss), mean RSSI = %.0f</td>\n",
+      fprintf(f,"<tr><td>%s*</td><td bgcolor=\"%s\">%lld sec, %d/%d received (%2.1f%% loss, %d failed FEC), mean RSSI = %.0f</td>\n",
 	      peer_records[i]->sid_prefix,colour,
-	      age,received_packets,received_packets+missed_packets,100-percent_received,mean_rssi);
+	      age,received_packets,received_packets+missed_packets,100-percent_received,
+	      peer_records[i]->fec_failed_packet_count,mean_rssi);
       fprintf(f,"<td>\n");
       log_rssi_graph(f,peer_records[i]);
       fprintf(f,"</td>\n");
@@ -453,6 +462,7 @@ int status_dump_radiolinks(FILE *f, char *topic)
     
     // Reset packet RX stats for next round
     peer_records[i]->missed_packet_count=0;
+    peer_records[i]->fec_failed_packet_count=0;
     peer_records[i]->rssi_counter=0;
     peer_records[i]->rssi_accumulator=0;
   }
@@ -486,6 +496,9 @@ int status_dump_bundlerx(FILE *f,char *topic)
     }
   }
   fprintf(f,"</table>\n");
+  if (partial_lookups)
+    fprintf(f,"<p>%lld of %lld lookups found the bundle already in flight.  %lld bundles in flight were given up on to make room for others, discarding %lld bytes.\n",
+	    partial_lookup_hits,partial_lookups,partial_evictions,partial_evicted_bytes);
   fflush(f);
   
   fprintf(f,"<h3>Announced material</h3>\n<table border=1 padding=2 spacing=2><tr><th>Time</th><th>Announced content</th></tr>\n");
@@ -45,19 +45,75 @@ extern char *my_sid_hex;
 #include "sha1.h"
 #include "util.h"
 
-int report_queue_length=0;
-uint8_t report_queue[REPORT_QUEUE_LEN][MAX_REPORT_LEN];
-uint8_t report_lengths[REPORT_QUEUE_LEN];
-struct peer_state *report_queue_peers[REPORT_QUEUE_LEN];
-int report_queue_partials[REPORT_QUEUE_LEN];
-char *report_queue_message[REPORT_QUEUE_LEN];
+int sync_tree_priority_keys=0;
+// If set, derive a new salt every this many seconds (see sync_tree_rotate_salt())
+int sync_salt_rotation_interval=0;
+long long sync_salt_epoch=-1;
+
+int bundle_calculate_sync_digest(uint8_t digest[SYNC_DIGEST_LEN],
+				 char *bid,
+				 long long version,
+				 long long length,
+				 char *filehash)
+{
+  // Everything that goes into the sync key, except for the salt
+  char lengthstring[80];
+  snprintf(lengthstring,80,"%llx:%llx",length,version);
+
+  struct sha1nfo sha1;
+  sha1_init(&sha1);
+  sha1_write(&sha1,bid,strlen(bid));
+  sha1_write(&sha1,filehash,strlen(filehash));
+  sha1_write(&sha1,lengthstring,strlen(lengthstring));
+  bcopy(sha1_result(&sha1),digest,SYNC_DIGEST_LEN);
+  return 0;
+}
+
+static void bundle_tree_key_set_priority(sync_key_t *bundle_tree_key,
+					 char *bid,long long version,
+					 long long length,char *service)
+{
+  if (sync_tree_priority_keys) {
+    /*
+      The sync tree reconciles the children of a node in order, so replacing the
+      top 4 bits of the key, i.e., the first four levels below the root of the
+      (binary) tree, with the priority class of the bundle means that differences
+      among MeshMS and small bundles are found first, instead of being scattered
+      randomly among thousands of large bundles.  The class must not depend on
+      anything that differs between peers, else the two sides would calculate
+      different keys for the same bundle.
+    */
+    int priority_class=bundle_priority_class(bid,length,version,service);
+    bundle_tree_key->key[0]=(bundle_tree_key->key[0]&0x0f)|(priority_class<<4);
+  }
+}
+
+int bundle_tree_key_from_digest(sync_key_t *bundle_tree_key,
+				uint8_t sync_tree_salt[SYNC_SALT_LEN],
+				uint8_t digest[SYNC_DIGEST_LEN],
+				char *bid,
+				long long version,
+				long long length,
+				char *service)
+{
+  // Salt + digest fits in a single SHA1 block, so this is cheap enough to
+  // rekey thousands of bundles in a few milliseconds.
+  struct sha1nfo sha1;
+  sha1_init(&sha1);
+  sha1_write(&sha1,(const char *)sync_tree_salt,SYNC_SALT_LEN);
+  sha1_write(&sha1,(const char *)digest,SYNC_DIGEST_LEN);
+  bcopy(sha1_result(&sha1),bundle_tree_key->key,KEY_LEN);
+  bundle_tree_key_set_priority(bundle_tree_key,bid,version,length,service);
+  return 0;
+}
 
 int bundle_calculate_tree_key(sync_key_t *bundle_tree_key,
 			      uint8_t sync_tree_salt[SYNC_SALT_LEN],
 			      char *bid,
 			      long long version,
 			      long long length,
-			      char *filehash)
+			      char *filehash,
+			      char *service)
 {
   /*
     Calculate a sync key for this bundle.
@@ -92,10 +148,21 @@ int bundle_calculate_tree_key(sync_key_t *bundle_tree_key,
     ... HOWEVER, we need both sides of a conversation to have the same salt, which
     wouldn't work under that scheme.
 
-    So for now we will employ a salt, but it will probably be fixed until we decide on
-    a good solution to this set of problems.
+    So by default we employ a fixed salt.  With the syncsaltrotate= option, the salt
+    is instead derived from the current time, so that all peers with roughly
+    synchronised clocks agree on it, and it changes every so often.  To make that
+    cheap, we then hash the salt last, with a digest of the other inputs that we
+    calculate once per bundle (see sync_tree_rotate_salt()).  These keys are not
+    the same as the fixed salt keys, so all peers must use the same option.
   */
 
+  if (sync_salt_rotation_interval) {
+    uint8_t digest[SYNC_DIGEST_LEN];
+    bundle_calculate_sync_digest(digest,bid,version,length,filehash);
+    return bundle_tree_key_from_digest(bundle_tree_key,sync_tree_salt,digest,
+				       bid,version,length,service);
+  }
+
   char lengthstring[80];
   snprintf(lengthstring,80,"%llx:%llx",length,version);
   
@@ -107,9 +174,53 @@ int bundle_calculate_tree_key(sync_key_t *bundle_tree_key,
   sha1_write(&sha1,lengthstring,strlen(lengthstring));
   unsigned char *res=sha1_result(&sha1);
   bcopy(res,bundle_tree_key->key,KEY_LEN);
+
+  bundle_tree_key_set_priority(bundle_tree_key,bid,version,length,service);
   return 0;  
 }
 
+/*
+  Change to the salt for the current epoch, if we are rotating salts, and it has
+  changed.  Every key is then recalculated from the cached digests, and the sync
+  tree rebuilt, which also discards what we knew of our peers' trees.  Peers whose
+  clocks differ from ours will briefly see all of our bundles as different around
+  each change, so the interval should be long compared with likely clock error.
+*/
+int sync_tree_rotate_salt(void)
+{
+  if (!sync_salt_rotation_interval) return 0;
+  long long epoch=time(0)/sync_salt_rotation_interval;
+  if (epoch==sync_salt_epoch) return 0;
+
+  long long start=gettime_ms();
+  // Each epoch's salt is derived from the fixed salt
+  static uint8_t base_salt[SYNC_SALT_LEN];
+  if (sync_salt_epoch==-1) bcopy(bundle_tree_salt,base_salt,SYNC_SALT_LEN);
+  unsigned char epoch_bytes[8];
+  for(int i=0;i<8;i++) epoch_bytes[i]=(epoch>>(i*8))&0xff;
+  struct sha1nfo sha1;
+  sha1_init(&sha1);
+  sha1_write(&sha1,(const char *)base_salt,SYNC_SALT_LEN);
+  sha1_write(&sha1,(const char *)epoch_bytes,8);
+  bcopy(sha1_result(&sha1),bundle_tree_salt,SYNC_SALT_LEN);
+  sync_salt_epoch=epoch;
+
+  for(int i=0;i<bundle_count;i++)
+    bundle_tree_key_from_digest(&bundles[i].sync_key,bundle_tree_salt,
+				bundles[i].sync_digest,bundles[i].bid_hex,
+				bundles[i].version,bundles[i].length,
+				bundles[i].service);
+  sync_free_state(sync_state);
+  sync_setup();
+  sync_tree_populate_with_our_bundles();
+  // Our peers' lacks were reported against the old tree
+  peer_lacks_forget_all();
+
+  fprintf(stderr,"Rotated sync tree salt, and rekeyed %d bundles in %lldms.\n",
+	  bundle_count,gettime_ms()-start);
+  return 1;
+}
+
 int sync_tree_receive_message(struct peer_state *p,unsigned char *msg)
 {
   int len=msg[1];
@@ -131,12 +242,15 @@ int sync_tree_receive_message(struct peer_state *p,unsigned char *msg)
   }
 
   if (debug_sync) {
-    printf(">>> %s Calling sync_recv_message(len=%d)\n",
-	   timestamp_str(),sync_bytes);
+    printf(">>> %s Calling sync_recv_message(len=%d, type='%c')\n",
+	   timestamp_str(),sync_bytes,msg[0]);
     dump_bytes(stdout,"Sync message",&msg[SYNC_MSG_HEADER_LEN], sync_bytes);
   }
   
-  sync_recv_message(sync_state,(void *)p,&msg[SYNC_MSG_HEADER_LEN], sync_bytes);
+  if (msg[0]=='s')
+    sync_recv_compact_message(sync_state,(void *)p,&msg[SYNC_MSG_HEADER_LEN], sync_bytes);
+  else
+    sync_recv_message(sync_state,(void *)p,&msg[SYNC_MSG_HEADER_LEN], sync_bytes);
   if (debug_sync) 
     printf(">>> %s sync_recv_message() returned.\n",timestamp_str());
   
@@ -209,7 +323,9 @@ int sync_announce_bundle_piece(int peer,int *offset,int mtu,
   // detect the end of the bundle when the last piece is received.
   if (peer_records[peer]->tx_bundle_manifest_offset>=cached_manifest_encoded_len) {
     // Send length of body?
-    if (((!peer_records[peer]->tx_bundle_body_offset)
+    // (coded pieces carry the length themselves)
+    if (peer_records[peer]->tx_bundle_coded) ;
+    else if (((!peer_records[peer]->tx_bundle_body_offset)
 	 ||(peer_records[peer]->tx_bundle_body_offset
 	    ==peer_records[peer]->tx_bundle_body_offset_hard_lower_bound)
 	 )
@@ -223,7 +339,8 @@ int sync_announce_bundle_piece(int peer,int *offset,int mtu,
 	announce_bundle_length(mtu,msg,offset,bundles[bundle_number].bid_bin,cached_version,bundles[bundle_number].length);
       }
   }
-  {
+  // (For journals, wait until we know how much of the body they already have)
+  if (!journal_tx_body_deferred(peer_records[peer])) {
     // Send some of the body
     // (but never from an offset before the hard lower bound communicated in an ACK('A') message
     if (!(option_flags&FLAG_NO_HARD_LOWER)) {
@@ -248,13 +365,18 @@ int sync_announce_bundle_piece(int peer,int *offset,int mtu,
 	      );
     int start_offset=peer_records[peer]->tx_bundle_body_offset;
     
-    int bytes =
-      sync_append_some_bundle_bytes(bundle_number,start_offset,cached_body_len,
-				    &cached_body[start_offset],0,
-				    offset,mtu,msg,peer);
+    if (peer_records[peer]->tx_bundle_coded&&sync_bundle_can_be_coded(bundle_number))
+      sync_append_coded_bundle_blocks(bundle_number,cached_body,cached_body_len,
+				      offset,mtu,msg,peer);
+    else {
+      int bytes =
+	sync_append_some_bundle_bytes(bundle_number,start_offset,cached_body_len,
+				      &cached_body[start_offset],0,
+				      offset,mtu,msg,peer);
     
-    if (bytes>0)
-      peer_records[peer]->tx_bundle_body_offset+=bytes;      
+      if (bytes>0)
+	peer_records[peer]->tx_bundle_body_offset+=bytes;      
+    }
   }
   
   // If we have sent to the end of the bundle, then start again from the beginning,
@@ -263,9 +385,19 @@ int sync_announce_bundle_piece(int peer,int *offset,int mtu,
   // (the _hard_lower_bound values are used to advance the loop-back point from the
   // beginning of the bundle to the appropriate place, if partial reception has been
   // acknowledged.
+  // If coded pieces are enabled, we instead keep sending coded blocks from then on,
+  // since each one can fill a different hole for every peer that hears it.
   if ((peer_records[peer]->tx_bundle_body_offset>=bundles[bundle_number].length)
-      &&(peer_records[peer]->tx_bundle_manifest_offset>=cached_manifest_encoded_len))
+      &&(peer_records[peer]->tx_bundle_manifest_offset>=cached_manifest_encoded_len)
+      &&(!peer_records[peer]->tx_bundle_coded))
     {
+      if (sync_bundle_can_be_coded(bundle_number)) {
+	fprintf(stderr,"T+%lldms : Sending coded pieces of bundle %s from now on.\n",
+		gettime_ms()-start_time,
+		bundles[bundle_number].bid_hex);
+	peer_records[peer]->tx_bundle_coded=1;
+	return 0;
+      }
       peer_records[peer]->tx_bundle_body_offset=0;
       peer_records[peer]->tx_bundle_manifest_offset=0;
       fprintf(stderr,"T+%lldms : Resending bundle %s from the start.\n",
@@ -297,75 +429,6 @@ int sync_tree_send_data(int *offset,int mtu, unsigned char *msg_out,int peer,
   return 0;
 }
 
-int sync_by_tree_stuff_packet(int *offset,int mtu, unsigned char *msg_out,
-			      char *sid_prefix_hex,
-			      char *servald_server,char *credential)
-{
-  // Stuff packet as full as we can with data for as many peers as we can.
-  // In practice, we will likely fill it on the first peer, but let's not
-  // waste a packet if we have something we can stuff in.
-
-  // First of all, tell any peers any acknowledgement messages that are required.
-  while (report_queue_length&&((*offset)<(mtu-MAX_REPORT_LEN))) {
-    report_queue_length--;
-    if (append_bytes(offset,mtu,msg_out,report_queue[report_queue_length],
-		     report_lengths[report_queue_length])) {
-      fprintf(stderr,"Tried to send report_queue message '%s' to %s*, but append_bytes reported no more space.\n",
-	      report_queue_message[report_queue_length],
-	      report_queue_peers[report_queue_length]->sid_prefix);
-      report_queue_length++;
-    } else {
-      fprintf(stderr,">>> %s Flushing %d byte report from queue, %d remaining.\n",
-	      timestamp_str(),	      
-	      report_lengths[report_queue_length],
-	      report_queue_length);
-      fprintf(stderr,"T+%lldms : Flushing %d byte report from queue, %d remaining.\n",
-	      gettime_ms()-start_time,
-	      report_lengths[report_queue_length],
-	      report_queue_length);
-      fprintf(stderr,"Sent report_queue message '%s' to %s*\n",
-	      report_queue_message[report_queue_length],
-	      report_queue_peers[report_queue_length]->sid_prefix);
-      dump_bytes(stderr,"report_queue message",
-		 (unsigned char *)report_queue_message[report_queue_length],
-		 report_lengths[report_queue_length]);
-		 
-      free(report_queue_message[report_queue_length]);
-      report_queue_message[report_queue_length]=NULL;
-    }
-  }
-  
-  int count=10; if (count>peer_count) count=peer_count;
-
-  /* Try sending something new.
-     Sync trees, and if space remains (because we have synchronised trees),
-     then try sending a piece of a bundle, if any */
-  int sync_not_sent=1;
-  if (random()&1) {
-    sync_not_sent=0;
-    sync_tree_send_message(offset,mtu,msg_out);
-  }
-  
-  while((*offset)<(mtu-16)) {
-    if ((count--)<0) break;
-    int peer=random_active_peer();
-    if (peer<0) break;
-    int space=mtu-(*offset);
-    if (space>10) {
-      sync_tree_send_data(offset,mtu,msg_out,peer,
-			  sid_prefix_hex,servald_server,credential);
-    } else {
-      // No space -- can't do anything
-    }
-  }  
-
-  if (sync_not_sent)
-    // Don't waste any space: sync what we can
-    sync_tree_send_message(offset,mtu,msg_out);
-  
-  return 0;
-}
-
 int sync_tree_populate_with_our_bundles()
 {
   for(int i=0;i<bundle_count;i++)
@@ -381,37 +444,11 @@ int sync_tell_peer_we_have_this_bundle(int peer, int bundle)
   
 int sync_tell_peer_we_have_bundle_by_id(int peer,unsigned char *bid,long long version)
 {
-  int slot=report_queue_length;
-
-  for(int i=0;i<report_queue_length;i++) {
-    if (report_queue_peers[i]==peer_records[peer]) {
-      // We already want to tell this peer something.
-      // We should only need to tell a peer one thing at a time.
-      slot=i; break;
-    }
-  }
-  
-  if (slot>=REPORT_QUEUE_LEN) slot=random()%REPORT_QUEUE_LEN;
-
-  // Mark utilisation of slot, so that we can flush out stale messages
-  report_queue_partials[slot]=-1;
-  report_queue_peers[slot]=peer_records[peer];
+  int slot=report_queue_slot(peer,bid,REPORT_TYPE_BAR,-1,"BAR");
+  if (slot<0) return -1;
 
   sync_build_bar_in_slot(slot,bid,version);
 
-  if (!monitor_mode) {
-    if (report_queue_message[slot]) {
-      fprintf(stderr,"Replacing report_queue message '%s' with 'BAR'\n",
-	      slot>=0?(report_queue_message[slot]?report_queue_message[slot]:"< report_queue_message=slot >"):"< slot<0 >");
-      free(report_queue_message[slot]);
-      report_queue_message[slot]=NULL;
-    } else
-      fprintf(stderr,"Setting report_queue message to 'BAR'\n");
-    report_queue_message[slot]=strdup("BAR");
-  }
-  
-  if (slot>=report_queue_length) report_queue_length=slot+1;
-
   return 0;
 }
 
@@ -429,7 +466,7 @@ int sync_tell_peer_we_have_the_bundle_of_this_partial(int peer, int partial)
 {
 
   return sync_tell_peer_we_have_bundle_by_id
-    (peer,bid_prefix_hex_to_bin(partials[partial].bid_prefix),
+    (peer,partials[partial].bid_prefix_bin,
      partials[partial].bundle_version);  
 }
 
@@ -515,12 +552,10 @@ int sync_queue_bundle(struct peer_state *p,int bundle)
 {
   struct bundle_record *b=&bundles[bundle];
 
-  int priority=calculate_bundle_intrinsic_priority(b->bid_hex,
-						   b->length,
-						   b->version,
-						   b->service,
-						   b->recipient,
-						   0);
+  int priority=bundle_intrinsic_priority(bundle);
+
+  // Already sending it to them
+  if (bundle==p->tx_bundle) return 0;
 
   // TX queue has something in it.
   if (p->tx_bundle>=0) {
@@ -532,6 +567,8 @@ int sync_queue_bundle(struct peer_state *p,int bundle)
 		p->tx_bundle,bundles[p->tx_bundle].index);
 	bundles[p->tx_bundle].index=p->tx_bundle;
       }
+      // Remember how far we got, so that we can carry on from there later
+      tx_resume_save(p);
       peer_queue_bundle_tx(p,&bundles[p->tx_bundle],
 			   p->tx_bundle_priority);
       p->tx_bundle=-1;
@@ -545,6 +582,8 @@ int sync_queue_bundle(struct peer_state *p,int bundle)
   // (also used to putting new bundle in the current TX slot if there was something
   // lower priority in there previously.)
   if (p->tx_bundle==-1) {
+    peer_unqueue_bundle_tx(p,bundle);
+
     // Start body transmission at a random point, so that if we are sending the
     // bundle to multiple peers, we at least have a chance of not sending the same
     // piece to each in a redundant manner. It would be even better to have some
@@ -553,6 +592,21 @@ int sync_queue_bundle(struct peer_state *p,int bundle)
     // re-transmission, since it will start requesting from the earliest byte that it
     // lacks.
 
+    // If we were part way through sending it to them before, carry on from there
+    if (tx_resume_restore(p,bundle)) {
+      p->tx_bundle_priority=priority;
+      return 0;
+    }
+
+    // Journals are instead sent from where the peer's copy ends, since that is
+    // all that they can be missing.
+    if (journal_bundle_p(bundle)) {
+      p->tx_bundle=bundle;
+      p->tx_bundle_priority=priority;
+      journal_begin_tx(p,bundle);
+      return 0;
+    }
+
     for(int i=0;i<peer_count;i++)
       if ((p!=peer_records[i])&&(peer_records[i]->tx_bundle==bundle)) {
 	// We are already sending this bundle to someone else -- try to keep
@@ -560,6 +614,8 @@ int sync_queue_bundle(struct peer_state *p,int bundle)
 	p->tx_bundle=bundle;
 	p->tx_bundle_body_offset=peer_records[i]->tx_bundle_body_offset;
 	p->tx_bundle_manifest_offset=peer_records[i]->tx_bundle_manifest_offset;
+	p->tx_bundle_coded=peer_records[i]->tx_bundle_coded;
+	p->tx_bundle_journal_wait=0;
 	p->tx_bundle_priority=priority;
 	fprintf(stderr,"Beginning transmission from same offset as for another peer (m=%d, b= %d)\n",
 		p->tx_bundle_manifest_offset,p->tx_bundle_body_offset);
@@ -574,6 +630,8 @@ int sync_queue_bundle(struct peer_state *p,int bundle)
     }
     p->tx_bundle_manifest_offset_hard_lower_bound=0;
     p->tx_bundle_body_offset_hard_lower_bound=0;
+    p->tx_bundle_coded=0;
+    p->tx_bundle_journal_wait=0;
     if (bundles[bundle].length)
       p->tx_bundle_body_offset=(random()%bundles[bundle].length)&0xffffff00;
     else
@@ -613,68 +671,35 @@ int sync_dequeue_bundle(struct peer_state *p,int bundle)
   printf(") to %s*\n",p->sid_prefix);
   
   
+  tx_resume_forget(p,bundle);
+
   if (bundle==p->tx_bundle) {
     // Delete this entry in queue
     p->tx_bundle=-1;
     // Advance next in queue, if there is anything
-    if (p->tx_queue_len) {
+    int next,next_priority;
+    if (!peer_queue_pop_tx(p,&next,&next_priority)) {
       if (debug_ack)
 	fprintf(stderr,"HARDLOWER: DEQUEUING:\n     %d more bundles in the queue. Next is bundle #%d\n",
-		p->tx_queue_len,p->tx_queue_bundles[0]);
-      p->tx_bundle=p->tx_queue_bundles[0];
-      p->tx_bundle_priority=p->tx_queue_priorities[0];
+		p->tx_queue_len,next);
+      p->tx_bundle=next;
+      p->tx_bundle_priority=next_priority;
       p->tx_bundle_manifest_offset=0;
       p->tx_bundle_body_offset=0;      
       p->tx_bundle_manifest_offset_hard_lower_bound=0;
       p->tx_bundle_body_offset_hard_lower_bound=0;
+      p->tx_bundle_coded=0;
+      p->tx_bundle_journal_wait=0;
+      if (!tx_resume_restore(p,p->tx_bundle)&&journal_bundle_p(p->tx_bundle))
+	journal_begin_tx(p,p->tx_bundle);
       if (!(option_flags&FLAG_NO_HARD_LOWER)) {
 	if (debug_ack)
 	  fprintf(stderr,"HARDLOWER: Resetting hard lower start point to 0,0\n");
       }
-      bcopy(&p->tx_queue_bundles[1],
-	    &p->tx_queue_bundles[0],
-	    sizeof(int)*p->tx_queue_len-1);
-      bcopy(&p->tx_queue_priorities[1],
-	    &p->tx_queue_priorities[0],
-	    sizeof(int)*p->tx_queue_len-1);
-      p->tx_queue_len--;
-    } else {
-      if (p->tx_queue_overflow) {
-	/* TX queue overflowed at some point, and now we have
-	   emptied the queue. This means that we need to restart
-	   the tree synchronisation with this peer.  
-	   XXX - In time, Jeremy will implement sync tree enumeration,
-	   which will be a more efficient solution to this problem.
-	   In the meantime, we will just change our instance ID, and also
-	   the instance ID we have recorded for this peer, so that we
-	   force a re-sync.
-	*/
-	p->instance_id=0xffffffff;
-	my_instance_id=0;
-	while(my_instance_id==0)
-	  urandombytes((unsigned char *)&my_instance_id,sizeof(unsigned int));
-      }
     }
   } else {
     // Wasn't the bundle on the list right now, so delete from in list.
-    for(int i=0;i<p->tx_queue_len;i++) {
-      if (bundle==p->tx_queue_bundles[i]) {
-	// printf("Before deletion from in queue:\n");
-	// peer_queue_list_dump(p);
-	// Delete this entry in queue
-	bcopy(&p->tx_queue_bundles[i+1],
-	      &p->tx_queue_bundles[i],
-	      sizeof(int)*p->tx_queue_len-i-1);
-	bcopy(&p->tx_queue_priorities[i+1],
-	      &p->tx_queue_priorities[i],
-	      sizeof(int)*p->tx_queue_len-i-1);
-	p->tx_queue_len--;
-	// printf("After deletion from in queue:\n");
-	// peer_queue_list_dump(p);
-	return 0;
-      }
-    }
-    
+    peer_unqueue_bundle_tx(p,bundle);
   }
 
   return 0;
@@ -723,6 +748,7 @@ void peer_now_has_this_key(void *context, void *peer_context,void *key_context,
 	   ((unsigned char *)key)[0],((unsigned char *)key)[1],
 	   b->service,b->version,b->sender,b->recipient);
   
+  peer_note_lacks_bundle(p,b->index,0);
   sync_dequeue_bundle(p,b->index);
 
 }
@@ -757,6 +783,10 @@ void peer_does_not_have_this_key(void *context, void *peer_context,void *key_con
 	    b->bid_hex,b->version);
     fclose(f);
   }
+
+  // (but don't count them as lacking the current version if it is an older one)
+  if (!memcmp(&b->sync_key,key,sizeof(sync_key_t)))
+    peer_note_lacks_bundle(p,b->index,1);
     
   sync_queue_bundle(p,b->index);
   
@@ -0,0 +1,138 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2016 Serval Project Inc.
+
+This program monitors a local Rhizome database and attempts
+to synchronise it over low-bandwidth declarative transports,
+such as bluetooth name or wifi-direct service information
+messages.  It is intended to give a high priority to MeshMS
+converations among nearby nodes.
+
+The design is fully asynchronous, so a call to the update_my_message()
+function from time to time should be all that is required.
+
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+  Sending only the new tail of journal bundles.
+
+  Journal bundles (such as MeshMS2 conversations) only ever grow at the end, and
+  their version is their length.  A peer that has an older version already has
+  everything up to its length, so we need only send them what has been appended
+  since.
+
+  We remember how much of each journal bundle each peer holds, from the versions
+  of journals they send us, and from the ACKs and progress bitmaps they send
+  about them.  When we start sending a journal bundle to a peer, we start from
+  where their copy ends if we know it.  If we don't, we send the manifest first,
+  and hold off on the body until we have heard from them, since the receiver
+  reports how much it already has as soon as it sees the first piece.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sync.h"
+#include "lbard.h"
+
+int journal_bundle_p(int bundle)
+{
+  if ((bundle<0)||(bundle>=bundle_count)) return 0;
+  return bundles[bundle].version<0x100000000LL;
+}
+
+int journal_note_peer_holds(struct peer_state *p,unsigned char *bid_prefix_bin,
+			    long long length)
+{
+  if ((!p)||(length<0)) return -1;
+
+  // Replace what we knew about this bundle, or else the oldest entry
+  int slot=0;
+  for(int i=0;i<JOURNAL_HELD_SLOTS;i++) {
+    if (p->journal_held[i].last_time
+	&&(!memcmp(p->journal_held[i].bid_prefix_bin,bid_prefix_bin,8))) {
+      slot=i; break;
+    }
+    if (p->journal_held[i].last_time<p->journal_held[slot].last_time) slot=i;
+  }
+  bcopy(bid_prefix_bin,p->journal_held[slot].bid_prefix_bin,8);
+  p->journal_held[slot].length=length;
+  p->journal_held[slot].last_time=time(0);
+
+  // If we were waiting to hear this before sending them the body, start now
+  if (p->tx_bundle_journal_wait&&(p->tx_bundle>=0)
+      &&(!memcmp(bundles[p->tx_bundle].bid_bin,bid_prefix_bin,8))) {
+    p->tx_bundle_journal_wait=0;
+    if (length<=bundles[p->tx_bundle].length) {
+      p->tx_bundle_body_offset=length;
+      p->tx_bundle_body_offset_hard_lower_bound=length;
+    }
+  }
+  return 0;
+}
+
+long long journal_peer_held_length(struct peer_state *p,int bundle)
+{
+  for(int i=0;i<JOURNAL_HELD_SLOTS;i++)
+    if (p->journal_held[i].last_time
+	&&(!memcmp(p->journal_held[i].bid_prefix_bin,bundles[bundle].bid_bin,8))) {
+      // If they somehow have more than we do, we don't know what they need
+      if (p->journal_held[i].length>bundles[bundle].length) return -1;
+      return p->journal_held[i].length;
+    }
+  return -1;
+}
+
+int journal_begin_tx(struct peer_state *p,int bundle)
+{
+  p->tx_bundle_manifest_offset=0;
+  p->tx_bundle_manifest_offset_hard_lower_bound=0;
+  p->tx_bundle_coded=0;
+
+  long long held=journal_peer_held_length(p,bundle);
+  if (held>=0) {
+    p->tx_bundle_body_offset=held;
+    p->tx_bundle_body_offset_hard_lower_bound=held;
+    p->tx_bundle_journal_wait=0;
+  } else {
+    p->tx_bundle_body_offset=0;
+    p->tx_bundle_body_offset_hard_lower_bound=0;
+    p->tx_bundle_journal_wait=1;
+  }
+  fprintf(stderr,"Beginning transmission of journal bundle #%d to %s* from %lld%s\n",
+	  bundle,p->sid_prefix,(long long)p->tx_bundle_body_offset,
+	  p->tx_bundle_journal_wait?" (once they tell us how much they have)":"");
+  return 0;
+}
+
+int journal_tx_body_deferred(struct peer_state *p)
+{
+  if (!p->tx_bundle_journal_wait) return 0;
+  // If they still haven't said anything by the time we have sent them the whole
+  // manifest, they probably don't have any of it.
+  if (p->tx_bundle_manifest_offset>=cached_manifest_encoded_len) {
+    p->tx_bundle_journal_wait=0;
+    return 0;
+  }
+  return 1;
+}
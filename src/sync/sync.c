@@ -455,22 +455,181 @@ static void copy_message(uint8_t *buff, const key_message_t *message)
   }
 }
 
+/*
+  Compact record encoding.
+  Records are packed MSB first into a bit stream, rather than taking a fixed
+  MESSAGE_BYTES each:
+
+    1 bit   stored
+    1 bit   leaf (prefix_len == KEY_LEN_BITS)
+    gamma   min_prefix_len, as a signed delta from the previous record
+    gamma   prefix_len - min_prefix_len (only present if not a leaf)
+    5 bits  number of leading key bits that are the same as the previous record
+    n bits  the remaining key bits
+
+  Records are usually queued in tree order, so successive records tend to share
+  leading key bits, and sit at similar depths in the tree, which we then don't
+  need to send again. The first record in a message is compared against an all
+  zero key with min_prefix_len of zero. The message is zero padded to a whole
+  byte, which is always less than the smallest possible record, so the receiver
+  knows when to stop.
+*/
+#define COMPACT_SHARED_BITS 5
+#define COMPACT_MAX_SHARED ((1<<COMPACT_SHARED_BITS)-1)
+#define COMPACT_MIN_RECORD_BITS (1+1+1+COMPACT_SHARED_BITS+KEY_LEN_BITS-COMPACT_MAX_SHARED)
+
+static uint8_t key_bit(const sync_key_t *key, unsigned bit)
+{
+  return (key->key[bit>>3]>>(7-(bit&7)))&1;
+}
+
+static void set_key_bit(sync_key_t *key, unsigned bit, uint8_t value)
+{
+  if (value)
+    key->key[bit>>3] |= 0x80>>(bit&7);
+  else
+    key->key[bit>>3] &= ~(0x80>>(bit&7));
+}
+
+static void write_bits(uint8_t *buff, size_t *bit_offset, unsigned value, uint8_t bits)
+{
+  while(bits--){
+    if ((value>>bits)&1)
+      buff[*bit_offset>>3] |= 0x80>>(*bit_offset&7);
+    else
+      buff[*bit_offset>>3] &= ~(0x80>>(*bit_offset&7));
+    (*bit_offset)++;
+  }
+}
+
+static unsigned read_bits(const uint8_t *buff, size_t *bit_offset, uint8_t bits)
+{
+  unsigned value=0;
+  while(bits--){
+    value = (value<<1) | ((buff[*bit_offset>>3]>>(7-(*bit_offset&7)))&1);
+    (*bit_offset)++;
+  }
+  return value;
+}
+
+// Elias gamma code of value+1, so that small values, including zero, are cheap.
+static uint8_t gamma_bits(unsigned value)
+{
+  uint8_t n=0;
+  value++;
+  while(value>>(n+1))
+    n++;
+  return n*2+1;
+}
+
+static void write_gamma(uint8_t *buff, size_t *bit_offset, unsigned value)
+{
+  uint8_t n=gamma_bits(value)>>1;
+  write_bits(buff, bit_offset, 0, n);
+  write_bits(buff, bit_offset, value+1, n+1);
+}
+
+// returns -1 if the code is malformed or runs past len_bits
+static int read_gamma(const uint8_t *buff, size_t *bit_offset, size_t len_bits)
+{
+  uint8_t n=0;
+  while(1){
+    if (*bit_offset>=len_bits || n>8)
+      return -1;
+    if (read_bits(buff, bit_offset, 1))
+      break;
+    n++;
+  }
+  if (*bit_offset + n > len_bits)
+    return -1;
+  return ((1<<n) | read_bits(buff, bit_offset, n)) - 1;
+}
+
+// map signed deltas onto 0, 1, 2 ... as 0, -1, 1, -2 ...
+#define ZIGZAG(D) ((D)<0 ? (unsigned)(-2*(D)-1) : (unsigned)(2*(D)))
+#define UNZIGZAG(V) (((V)&1) ? -(int)(((V)+1)>>1) : (int)((V)>>1))
+
+static uint8_t shared_key_bits(const sync_key_t *first, const sync_key_t *second)
+{
+  uint8_t bits=0;
+  while(bits<COMPACT_MAX_SHARED && key_bit(first, bits)==key_bit(second, bits))
+    bits++;
+  return bits;
+}
+
+// Output buffer state while building a message in either encoding
+struct message_writer{
+  uint8_t *buff;
+  size_t len_bits;
+  size_t bit_offset;
+  uint8_t compact;
+  sync_key_t previous;
+  uint8_t previous_min_prefix_len;
+};
+
+// append one record, returns -1 if it doesn't fit.
+static int append_message(struct message_writer *w, const key_message_t *message)
+{
+  if (!w->compact){
+    if (w->bit_offset + (MESSAGE_BYTES<<3) > w->len_bits)
+      return -1;
+    copy_message(&w->buff[w->bit_offset>>3], message);
+    w->bit_offset += MESSAGE_BYTES<<3;
+    return 0;
+  }
+  
+  key_message_t empty;
+  if (!message){
+    bzero(&empty, sizeof empty);
+    empty.stored = 1;
+    empty.prefix_len = KEY_LEN_BITS+1;
+    message = &empty;
+  }
+  
+  uint8_t leaf = (message->prefix_len == KEY_LEN_BITS);
+  uint8_t shared = shared_key_bits(&message->key, &w->previous);
+  unsigned min_delta = ZIGZAG((int)message->min_prefix_len - (int)w->previous_min_prefix_len);
+  unsigned len_delta = message->prefix_len - message->min_prefix_len;
+  size_t bits = 1 + 1 + gamma_bits(min_delta) + (leaf?0:gamma_bits(len_delta))
+    + COMPACT_SHARED_BITS + (KEY_LEN_BITS - shared);
+  if (w->bit_offset + bits > w->len_bits)
+    return -1;
+  
+  write_bits(w->buff, &w->bit_offset, message->stored, 1);
+  write_bits(w->buff, &w->bit_offset, leaf, 1);
+  write_gamma(w->buff, &w->bit_offset, min_delta);
+  if (!leaf)
+    write_gamma(w->buff, &w->bit_offset, len_delta);
+  write_bits(w->buff, &w->bit_offset, shared, COMPACT_SHARED_BITS);
+  for (unsigned i=shared;i<KEY_LEN_BITS;i++)
+    write_bits(w->buff, &w->bit_offset, key_bit(&message->key, i), 1);
+  
+  w->previous_min_prefix_len = message->min_prefix_len;
+  w->previous = message->key;
+  return 0;
+}
+
 // prepare a network packet buffer, with as many queued outgoing messages that we can fit
-size_t sync_build_message(struct sync_state *state, uint8_t *buff, size_t len)
+static size_t build_message(struct sync_state *state, uint8_t *buff, size_t len, uint8_t compact)
 {
-  size_t offset=0;
+  struct message_writer writer;
+  bzero(&writer, sizeof writer);
+  writer.buff = buff;
+  writer.len_bits = len<<3;
+  writer.compact = compact;
+  
   state->sent_messages++;
   state->progress++;
   
   struct node *tail = state->transmit_ptr;
   
-  while(tail && offset + MESSAGE_BYTES<=len){
+  while(tail){
     struct node *head = tail->transmit_next;
     assert(head->transmit_prev == tail);
     
     if (head->send_state == QUEUED){
-      copy_message(&buff[offset], &head->message);
-      offset+=MESSAGE_BYTES;
+      if (append_message(&writer, &head->message)==-1)
+	break;
       head->sent_count++;
       state->sent_record_count++;
       if (head->sent_count>=SYNC_MAX_RETRIES)
@@ -504,17 +663,30 @@ size_t sync_build_message(struct sync_state *state, uint8_t *buff, size_t len)
   state->transmit_ptr = tail;
   
   // If we don't have anything else to send, always send our root tree node
-  if(offset + MESSAGE_BYTES<=len && offset==0){
-    state->sent_root++;
-    copy_message(&buff[offset], state->root ? &state->root->message : NULL);
-    offset+=MESSAGE_BYTES;
-    state->sent_record_count++;
+  if(writer.bit_offset==0){
+    if (append_message(&writer, state->root ? &state->root->message : NULL)==0){
+      state->sent_root++;
+      state->sent_record_count++;
+    }
   }
   
-
+  size_t offset = (writer.bit_offset+7)>>3;
+  // zero any padding bits
+  if (writer.bit_offset&7)
+    write_bits(buff, &writer.bit_offset, 0, 8-(writer.bit_offset&7));
   return offset;
 }
 
+size_t sync_build_message(struct sync_state *state, uint8_t *buff, size_t len)
+{
+  return build_message(state, buff, len, 0);
+}
+
+size_t sync_build_compact_message(struct sync_state *state, uint8_t *buff, size_t len)
+{
+  return build_message(state, buff, len, 1);
+}
+
 // Add a tree node into our transmission queue
 // the node can be added to the head or tail of the list.
 static void queue_node(struct sync_state *state, struct node *node, uint8_t head)
@@ -868,11 +1040,8 @@ static int recv_key(struct sync_state *state, struct sync_peer_state *peer_state
   }
 }
 
-// Process all incoming messages from this packet buffer
-int sync_recv_message(struct sync_state *state, void *peer_context, const uint8_t *buff, size_t len)
+static struct sync_peer_state *find_peer_state(struct sync_state *state, void *peer_context)
 {
-  assert(peer_context);
-  
   struct sync_peer_state *peer_state = state->peers;
   while(peer_state && peer_state->peer_context != peer_context){
     peer_state = peer_state->next;
@@ -884,6 +1053,15 @@ int sync_recv_message(struct sync_state *state, void *peer_context, const uint8_
     peer_state->next = state->peers;
     state->peers = peer_state;
   }
+  return peer_state;
+}
+
+// Process all incoming messages from this packet buffer
+int sync_recv_message(struct sync_state *state, void *peer_context, const uint8_t *buff, size_t len)
+{
+  assert(peer_context);
+  
+  struct sync_peer_state *peer_state = find_peer_state(state, peer_context);
   
   size_t offset=0;
   if (len%MESSAGE_BYTES)
@@ -906,3 +1084,54 @@ int sync_recv_message(struct sync_state *state, void *peer_context, const uint8_
   return 0;
 }
 
+// Process all incoming messages from a packet buffer using the compact encoding
+int sync_recv_compact_message(struct sync_state *state, void *peer_context, const uint8_t *buff, size_t len)
+{
+  assert(peer_context);
+  
+  struct sync_peer_state *peer_state = find_peer_state(state, peer_context);
+  
+  size_t len_bits = len<<3;
+  size_t offset=0;
+  sync_key_t previous;
+  bzero(&previous, sizeof previous);
+  int previous_min_prefix_len=0;
+  
+  while(offset + COMPACT_MIN_RECORD_BITS<=len_bits){
+    key_message_t message;
+    bzero(&message, sizeof message);
+    
+    message.stored = read_bits(buff, &offset, 1);
+    uint8_t leaf = read_bits(buff, &offset, 1);
+    int min_delta = read_gamma(buff, &offset, len_bits);
+    if (min_delta<0)
+      return -1;
+    int min_prefix_len = previous_min_prefix_len + UNZIGZAG(min_delta);
+    if (min_prefix_len<0 || min_prefix_len>KEY_LEN_BITS)
+      return -1;
+    message.min_prefix_len = min_prefix_len;
+    previous_min_prefix_len = min_prefix_len;
+    if (leaf)
+      message.prefix_len = KEY_LEN_BITS;
+    else{
+      int len_delta = read_gamma(buff, &offset, len_bits);
+      if (len_delta<0 || min_prefix_len + len_delta > KEY_LEN_BITS+1)
+	return -1;
+      message.prefix_len = min_prefix_len + len_delta;
+    }
+    if (offset + COMPACT_SHARED_BITS > len_bits)
+      return -1;
+    uint8_t shared = read_bits(buff, &offset, COMPACT_SHARED_BITS);
+    if (offset + KEY_LEN_BITS - shared > len_bits)
+      return -1;
+    
+    message.key = previous;
+    for (unsigned i=shared;i<KEY_LEN_BITS;i++)
+      set_key_bit(&message.key, i, read_bits(buff, &offset, 1));
+    previous = message.key;
+    
+    if (recv_key(state, peer_state, &message)==-1)
+      return -1;
+  }
+  return 0;
+}
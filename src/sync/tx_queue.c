@@ -0,0 +1,177 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2016 Serval Project Inc.
+
+This program monitors a local Rhizome database and attempts
+to synchronise it over low-bandwidth declarative transports,
+such as bluetooth name or wifi-direct service information
+messages.  It is intended to give a high priority to MeshMS
+converations among nearby nodes.
+
+The design is fully asynchronous, so a call to the update_my_message()
+function from time to time should be all that is required.
+
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+  Per-peer queues of bundles waiting to be sent.
+
+  Each peer's queue is a binary max-heap on bundle priority, that grows as
+  required, so that we never have to forget about bundles that a peer needs.
+  tx_queue_position[] maps each bundle number to one more than its position in
+  the heap, or zero if it isn't queued, so that a bundle can be found, removed or
+  have its priority changed in O(log n).
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sync.h"
+#include "lbard.h"
+
+static void tx_queue_set(struct peer_state *p,int i,int bundle,int priority)
+{
+  p->tx_queue_bundles[i]=bundle;
+  p->tx_queue_priorities[i]=priority;
+  p->tx_queue_position[bundle]=i+1;
+}
+
+static void tx_queue_sift_up(struct peer_state *p,int i)
+{
+  int bundle=p->tx_queue_bundles[i];
+  int priority=p->tx_queue_priorities[i];
+  while (i>0) {
+    int parent=(i-1)/2;
+    if (p->tx_queue_priorities[parent]>=priority) break;
+    tx_queue_set(p,i,p->tx_queue_bundles[parent],p->tx_queue_priorities[parent]);
+    i=parent;
+  }
+  tx_queue_set(p,i,bundle,priority);
+}
+
+static void tx_queue_sift_down(struct peer_state *p,int i)
+{
+  int bundle=p->tx_queue_bundles[i];
+  int priority=p->tx_queue_priorities[i];
+  while (1) {
+    int child=i*2+1;
+    if (child>=p->tx_queue_len) break;
+    if ((child+1<p->tx_queue_len)
+	&&(p->tx_queue_priorities[child+1]>p->tx_queue_priorities[child]))
+      child++;
+    if (p->tx_queue_priorities[child]<=priority) break;
+    tx_queue_set(p,i,p->tx_queue_bundles[child],p->tx_queue_priorities[child]);
+    i=child;
+  }
+  tx_queue_set(p,i,bundle,priority);
+}
+
+static void tx_queue_remove_at(struct peer_state *p,int i)
+{
+  p->tx_queue_position[p->tx_queue_bundles[i]]=0;
+  p->tx_queue_len--;
+  if (i==p->tx_queue_len) return;
+  // Move the last entry into the hole, and then put it where it belongs
+  tx_queue_set(p,i,p->tx_queue_bundles[p->tx_queue_len],
+	       p->tx_queue_priorities[p->tx_queue_len]);
+  tx_queue_sift_up(p,i);
+  tx_queue_sift_down(p,p->tx_queue_position[p->tx_queue_bundles[i]]-1);
+}
+
+int peer_queue_bundle_tx(struct peer_state *p,struct bundle_record *b, int priority)
+{
+  int bundle=b->index;
+  if ((bundle<0)||(bundle>=MAX_BUNDLES)) return -1;
+
+  if (debug_ack)
+    printf("Queueing bundle #%d for transmission to %s* (priority=%d, %d already queued)\n",
+	   bundle,p->sid_prefix,priority,p->tx_queue_len);
+
+  if (bundle>=p->tx_queue_position_alloc) {
+    int alloc=p->tx_queue_position_alloc?p->tx_queue_position_alloc:1024;
+    while (alloc<=bundle) alloc*=2;
+    if (alloc>MAX_BUNDLES) alloc=MAX_BUNDLES;
+    p->tx_queue_position=realloc(p->tx_queue_position,alloc*sizeof(int));
+    assert(p->tx_queue_position);
+    bzero(&p->tx_queue_position[p->tx_queue_position_alloc],
+	  (alloc-p->tx_queue_position_alloc)*sizeof(int));
+    p->tx_queue_position_alloc=alloc;
+  }
+
+  // Already queued, so just update its priority
+  if (p->tx_queue_position[bundle])
+    return peer_queue_reprioritise_tx(p,bundle,priority);
+
+  if (p->tx_queue_len>=p->tx_queue_alloc) {
+    int alloc=p->tx_queue_alloc?p->tx_queue_alloc*2:64;
+    p->tx_queue_bundles=realloc(p->tx_queue_bundles,alloc*sizeof(int));
+    p->tx_queue_priorities=realloc(p->tx_queue_priorities,alloc*sizeof(int));
+    assert(p->tx_queue_bundles&&p->tx_queue_priorities);
+    p->tx_queue_alloc=alloc;
+  }
+
+  tx_queue_set(p,p->tx_queue_len++,bundle,priority);
+  tx_queue_sift_up(p,p->tx_queue_len-1);
+  return 0;
+}
+
+int peer_queue_reprioritise_tx(struct peer_state *p,int bundle,int priority)
+{
+  if ((bundle<0)||(bundle>=p->tx_queue_position_alloc)) return -1;
+  int i=p->tx_queue_position[bundle]-1;
+  if (i<0) return -1;
+  int old_priority=p->tx_queue_priorities[i];
+  p->tx_queue_priorities[i]=priority;
+  if (priority>old_priority) tx_queue_sift_up(p,i);
+  else tx_queue_sift_down(p,i);
+  return 0;
+}
+
+int peer_unqueue_bundle_tx(struct peer_state *p,int bundle)
+{
+  if ((bundle<0)||(bundle>=p->tx_queue_position_alloc)) return -1;
+  int i=p->tx_queue_position[bundle]-1;
+  if (i<0) return -1;
+  tx_queue_remove_at(p,i);
+  return 0;
+}
+
+int peer_queue_pop_tx(struct peer_state *p,int *bundle,int *priority)
+{
+  if (!p->tx_queue_len) return -1;
+  *bundle=p->tx_queue_bundles[0];
+  *priority=p->tx_queue_priorities[0];
+  tx_queue_remove_at(p,0);
+  return 0;
+}
+
+void peer_queue_free_tx(struct peer_state *p)
+{
+  free(p->tx_queue_bundles); p->tx_queue_bundles=NULL;
+  free(p->tx_queue_priorities); p->tx_queue_priorities=NULL;
+  free(p->tx_queue_position); p->tx_queue_position=NULL;
+  p->tx_queue_len=0;
+  p->tx_queue_alloc=0;
+  p->tx_queue_position_alloc=0;
+}
@@ -0,0 +1,127 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2016 Serval Project Inc.
+
+This program monitors a local Rhizome database and attempts
+to synchronise it over low-bandwidth declarative transports,
+such as bluetooth name or wifi-direct service information
+messages.  It is intended to give a high priority to MeshMS
+converations among nearby nodes.
+
+The design is fully asynchronous, so a call to the update_my_message()
+function from time to time should be all that is required.
+
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+  Resuming bundle transmissions that were displaced by higher priority bundles.
+
+  When a higher priority bundle comes along, the one we were sending goes back in
+  the TX queue.  Without this, when it came back out of the queue we would start
+  sending it from the beginning again, resending everything the peer had already
+  acknowledged.  So we keep where we had got to with each displaced bundle, and
+  what the peer last told us they had of it, for a few bundles per peer.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sync.h"
+#include "lbard.h"
+
+static struct tx_resume *tx_resume_find(struct peer_state *p,int bundle)
+{
+  for(int i=0;i<TX_RESUME_SLOTS;i++)
+    if (p->tx_resume[i].last_time&&(p->tx_resume[i].bundle==bundle))
+      return &p->tx_resume[i];
+  return NULL;
+}
+
+int tx_resume_save(struct peer_state *p)
+{
+  int bundle=p->tx_bundle;
+  if (bundle<0) return -1;
+
+  // Reuse the entry for this bundle if there is one, else the oldest
+  struct tx_resume *r=tx_resume_find(p,bundle);
+  if (!r) {
+    r=&p->tx_resume[0];
+    for(int i=1;i<TX_RESUME_SLOTS;i++)
+      if (p->tx_resume[i].last_time<r->last_time) r=&p->tx_resume[i];
+  }
+
+  r->bundle=bundle;
+  r->version=bundles[bundle].version;
+  r->manifest_offset=p->tx_bundle_manifest_offset;
+  r->body_offset=p->tx_bundle_body_offset;
+  r->manifest_offset_hard_lower_bound=p->tx_bundle_manifest_offset_hard_lower_bound;
+  r->body_offset_hard_lower_bound=p->tx_bundle_body_offset_hard_lower_bound;
+  r->coded=p->tx_bundle_coded;
+  r->have_request_bitmap=(p->request_bitmap_bundle==bundle);
+  if (r->have_request_bitmap) {
+    r->request_bitmap_offset=p->request_bitmap_offset;
+    memcpy(r->request_bitmap,p->request_bitmap,32);
+    memcpy(r->request_manifest_bitmap,p->request_manifest_bitmap,2);
+  }
+  r->last_time=time(0);
+  return 0;
+}
+
+int tx_resume_restore(struct peer_state *p,int bundle)
+{
+  /* Make bundle the current tx_bundle, continuing from where we left off if we
+     had sent some of it before.  Returns 1 if we did, or 0 if there was nothing
+     to resume, in which case the caller chooses where to start.
+  */
+  struct tx_resume *r=tx_resume_find(p,bundle);
+  if (!r) return 0;
+  r->last_time=0;
+  // A newer version is a different body, so what they had is no longer useful
+  if (r->version!=bundles[bundle].version) return 0;
+
+  p->tx_bundle=bundle;
+  p->tx_bundle_manifest_offset=r->manifest_offset;
+  p->tx_bundle_body_offset=r->body_offset;
+  p->tx_bundle_manifest_offset_hard_lower_bound=r->manifest_offset_hard_lower_bound;
+  p->tx_bundle_body_offset_hard_lower_bound=r->body_offset_hard_lower_bound;
+  p->tx_bundle_coded=r->coded;
+  p->tx_bundle_journal_wait=0;
+  // Unless they have told us about this bundle since, their last bitmap for it
+  // is still the best we know.
+  if (r->have_request_bitmap&&(p->request_bitmap_bundle!=bundle)) {
+    p->request_bitmap_bundle=bundle;
+    p->request_bitmap_offset=r->request_bitmap_offset;
+    memcpy(p->request_bitmap,r->request_bitmap,32);
+    memcpy(p->request_manifest_bitmap,r->request_manifest_bitmap,2);
+  }
+  fprintf(stderr,"Resuming transmission of bundle #%d to %s* from m=%d, p=%d\n",
+	  bundle,p->sid_prefix,p->tx_bundle_manifest_offset,p->tx_bundle_body_offset);
+  return 1;
+}
+
+int tx_resume_forget(struct peer_state *p,int bundle)
+{
+  struct tx_resume *r=tx_resume_find(p,bundle);
+  if (r) r->last_time=0;
+  return 0;
+}
@@ -0,0 +1,585 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2016 Serval Project Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+  Round-trip checks for LBARD's message encodings: encode something the way a
+  sender would, decode it the way a receiver would, and check that we get back
+  what we started with.
+
+  This is linked against all of LBARD, with its main() renamed out of the way
+  (see the Makefile).
+
+  usage: msgtest
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sync.h"
+#include "lbard.h"
+#include "serial.h"
+
+#undef main
+
+int failures=0;
+
+#define CHECK(COND,...) do { if (!(COND)) { \
+      fprintf(stderr,"FAIL: %s:%d: ",__FILE__,__LINE__);	\
+      fprintf(stderr,__VA_ARGS__); fprintf(stderr,"\n");	\
+      failures++; } } while(0)
+
+/*
+  Compact sync tree messages ('s'): two trees with many keys in common, and a
+  few each that the other lacks, must find exactly those differences when they
+  only talk to each other using the compact encoding.
+*/
+#define SYNC_COMMON_KEYS 500
+#define SYNC_UNIQUE_KEYS 50
+
+struct sync_test_node {
+  struct sync_state *state;
+  sync_key_t unique[SYNC_UNIQUE_KEYS];
+  // Which of the other node's unique keys it has told us about, and which of
+  // ours it says it lacks
+  int peer_has[SYNC_UNIQUE_KEYS];
+  int peer_lacks[SYNC_UNIQUE_KEYS];
+  struct sync_test_node *other;
+};
+
+static int sync_test_find(sync_key_t *keys,const sync_key_t *key)
+{
+  for(int i=0;i<SYNC_UNIQUE_KEYS;i++)
+    if (!memcmp(keys[i].key,key->key,KEY_LEN)) return i;
+  return -1;
+}
+
+static void sync_test_has(void *context,void *peer_context,const sync_key_t *key)
+{
+  struct sync_test_node *n=context;
+  int i=sync_test_find(n->other->unique,key);
+  CHECK(i>=0,"peer claims to have a key that only we have");
+  if (i>=0) n->peer_has[i]++;
+}
+
+static void sync_test_lacks(void *context,void *peer_context,void *key_context,
+			    const sync_key_t *key)
+{
+  struct sync_test_node *n=context;
+  int i=sync_test_find(n->unique,key);
+  CHECK(i>=0,"peer claims to lack a key that we both have");
+  if (i>=0) n->peer_lacks[i]++;
+}
+
+static void sync_test_now_has(void *context,void *peer_context,void *key_context,
+			      const sync_key_t *key)
+{
+}
+
+static void sync_test_random_key(sync_key_t *key)
+{
+  for(int i=0;i<KEY_LEN;i++) key->key[i]=random();
+}
+
+int check_sync_tree(void)
+{
+  struct sync_test_node a,b;
+  bzero(&a,sizeof a);
+  bzero(&b,sizeof b);
+  a.other=&b; b.other=&a;
+  a.state=sync_alloc_state(&a,sync_test_has,sync_test_lacks,sync_test_now_has);
+  b.state=sync_alloc_state(&b,sync_test_has,sync_test_lacks,sync_test_now_has);
+
+  for(int i=0;i<SYNC_COMMON_KEYS;i++) {
+    sync_key_t key;
+    sync_test_random_key(&key);
+    sync_add_key(a.state,&key,NULL);
+    sync_add_key(b.state,&key,NULL);
+  }
+  for(int i=0;i<SYNC_UNIQUE_KEYS;i++) {
+    sync_test_random_key(&a.unique[i]);
+    sync_add_key(a.state,&a.unique[i],NULL);
+    sync_test_random_key(&b.unique[i]);
+    sync_add_key(b.state,&b.unique[i],NULL);
+  }
+
+  // Exchange messages of a typical size, until neither has anything to say
+  int rounds;
+  for(rounds=0;rounds<1000;rounds++) {
+    uint8_t msg[192];
+    size_t len=sync_build_compact_message(a.state,msg,sizeof msg);
+    CHECK(!sync_recv_compact_message(b.state,&a,msg,len),
+	  "could not parse compact sync message");
+    len=sync_build_compact_message(b.state,msg,sizeof msg);
+    CHECK(!sync_recv_compact_message(a.state,&b,msg,len),
+	  "could not parse compact sync message");
+    if (!sync_has_transmit_queued(a.state)&&!sync_has_transmit_queued(b.state))
+      break;
+  }
+  CHECK(rounds<1000,"compact sync did not converge");
+
+  for(int i=0;i<SYNC_UNIQUE_KEYS;i++) {
+    CHECK(a.peer_has[i]&&b.peer_lacks[i],"key %d of b was not found",i);
+    CHECK(b.peer_has[i]&&a.peer_lacks[i],"key %d of a was not found",i);
+  }
+
+  sync_free_state(a.state);
+  sync_free_state(b.state);
+  return 0;
+}
+
+/*
+  Reed-Solomon: the data we encode must come back intact after up to NROOTS/2
+  byte errors anywhere in the block.  (The decoder doesn't bother to correct the
+  parity bytes.  rsbench checks that the encoder matches the reference
+  implementation bit for bit.)
+*/
+int check_reed_solomon(void)
+{
+  data_t sent[NN],block[NN];
+
+  for(int n=0;n<1000;n++) {
+    int pad=random()%(NN-NROOTS);
+    int len=NN-NROOTS-pad;
+    int errors=n%(NROOTS/2+1);
+    for(int i=0;i<len;i++) sent[i]=random();
+    encode_rs_8(sent,&sent[len],pad);
+    memcpy(block,sent,NN-pad);
+
+    // Corrupt distinct bytes, so that we know how many errors there are
+    int corrupted[NN];
+    bzero(corrupted,sizeof corrupted);
+    for(int e=0;e<errors;e++) {
+      int pos;
+      do pos=random()%(NN-pad); while(corrupted[pos]);
+      corrupted[pos]=1;
+      block[pos]^=1+(random()%255);
+    }
+
+    int r=decode_rs_8(block,NULL,0,pad);
+    CHECK(r==errors,"RS block %d (pad=%d): decoder found %d of %d errors",
+	  n,pad,r,errors);
+    CHECK(!memcmp(block,sent,len),"RS block %d (pad=%d): not restored",n,pad);
+  }
+
+  return 0;
+}
+
+/*
+  FEC levels: a packet encoded at each level must decode to the same bytes and
+  length, with the level worked out from the packet itself, after as many byte
+  errors as the level will correct.
+*/
+int check_fec_levels(void)
+{
+  int max_errors[FEC_LEVEL_COUNT]={2,4,8,8};
+  int codewords[FEC_LEVEL_COUNT]={1,1,1,2};
+
+  for(int level=0;level<FEC_LEVEL_COUNT;level++) {
+    for(int n=0;n<200;n++) {
+      unsigned char data[256],packet[512];
+      int len=1+random()%fec_max_data_bytes(level);
+      for(int i=0;i<len;i++) data[i]=random();
+      int packet_bytes=fec_encode_packet(level,data,len,packet);
+      CHECK(packet_bytes<=radio_frame_size(),"FEC level %d packet of %d bytes is too big",
+	    level,len);
+
+      // Corrupt distinct bytes of the first codeword, not counting the trailer,
+      // which carries every codewords-th byte of the body and of the parity.
+      int errors=n%max_errors[level];
+      int corrupted[sizeof packet];
+      bzero(corrupted,sizeof corrupted);
+      int last=packet_bytes-((level==FEC_LEVEL_DEFAULT)?0:1);
+      for(int e=0;e<errors;e++) {
+	int pos;
+	do pos=random()%last;
+	while(corrupted[pos]||(((pos<len)?pos:(pos-len))%codewords[level]));
+	corrupted[pos]=1;
+	packet[pos]^=1+(random()%255);
+      }
+
+      int data_length=-1;
+      int r=fec_decode_any_level(packet,packet_bytes,&data_length);
+      CHECK(r==errors,"FEC level %d, %d bytes: decoder found %d of %d errors",
+	    level,len,r,errors);
+      CHECK(data_length==len,"FEC level %d: decoded %d bytes instead of %d",
+	    level,data_length,len);
+      CHECK(!memcmp(packet,data,len),"FEC level %d, %d bytes: not restored",level,len);
+    }
+  }
+  return 0;
+}
+
+/*
+  Coded body blocks ('C'): a body of any length up to FOUNTAIN_MAX_BLOCKS blocks
+  must be rebuilt from plain pieces of it plus a few more coded blocks than are
+  missing.
+*/
+int check_fountain(void)
+{
+  int lengths[]={1,63,64,65,1000,4097,20000,
+		 FOUNTAIN_MAX_BLOCKS*FOUNTAIN_BLOCK_SIZE-1,
+		 FOUNTAIN_MAX_BLOCKS*FOUNTAIN_BLOCK_SIZE,-1};
+  static unsigned char body[FOUNTAIN_MAX_BLOCKS*FOUNTAIN_BLOCK_SIZE];
+
+  for(int l=0;lengths[l]>=0;l++) {
+    int length=lengths[l];
+    int blocks=fountain_block_count(length);
+    for(int i=0;i<length;i++) body[i]=random();
+    struct fountain_decoder *d=fountain_decoder_new(length);
+    CHECK(d,"no fountain decoder for %d bytes",length);
+    if (!d) continue;
+
+    // A plain piece from an unaligned offset only counts for the blocks it covers
+    int offset=(length>100)?100:0;
+    int bytes=length/3;
+    int covered=0;
+    for(int b=0;b<blocks;b++) {
+      int end=(b+1)*FOUNTAIN_BLOCK_SIZE;
+      if (end>length) end=length;
+      if ((b*FOUNTAIN_BLOCK_SIZE>=offset)&&(end<=offset+bytes)) covered++;
+    }
+    fountain_decoder_add_bytes(d,offset,bytes,&body[offset]);
+    CHECK(fountain_decoder_rank(d)==covered,
+	  "%d byte plain piece at %d of %d bytes gave %d blocks instead of %d",
+	  bytes,offset,length,fountain_decoder_rank(d),covered);
+
+    // Then coded blocks that aren't plain source blocks
+    int sent=0;
+    for(unsigned int seed=blocks;!fountain_decoder_complete(d)&&(sent<blocks+40);seed++) {
+      unsigned char block[FOUNTAIN_BLOCK_SIZE];
+      CHECK(!fountain_encode_block(body,length,seed,block),"could not encode block");
+      fountain_decoder_add(d,seed,block);
+      sent++;
+    }
+    CHECK(fountain_decoder_complete(d),"%d byte body not decoded after %d coded blocks",
+	  length,sent);
+    CHECK(sent<=blocks-covered+40,"%d byte body needed %d coded blocks for %d missing",
+	  length,sent,blocks-covered);
+    if (fountain_decoder_complete(d))
+      CHECK(!memcmp(fountain_decoder_body(d),body,length),
+	    "%d byte body decoded incorrectly",length);
+    fountain_decoder_free(d);
+  }
+
+  CHECK(!fountain_decoder_new(FOUNTAIN_MAX_BLOCKS*FOUNTAIN_BLOCK_SIZE+1),
+	"fountain decoder accepted a body of more than %d blocks",FOUNTAIN_MAX_BLOCKS);
+  return 0;
+}
+
+/*
+  Golay protected packet headers: the sender's SID fragment and message counter
+  must survive up to three bit errors in each codeword, and four must be caught.
+*/
+static void flip_bits(unsigned char *codeword,int bits)
+{
+  // Flip distinct bits, so that we know how many errors there are
+  int flipped=0;
+  while(bits--) {
+    int bit;
+    do bit=random()%24; while(flipped&(1<<bit));
+    flipped|=1<<bit;
+    codeword[bit>>3]^=1<<(bit&7);
+  }
+}
+
+int check_golay_header(void)
+{
+  unsigned char packet[256+GOLAY_HEADER_LEN];
+
+  for(int n=0;n<1000;n++) {
+    int len=8+random()%(256-8-GOLAY_HEADER_LEN);
+    for(int i=0;i<len;i++) packet[i]=random();
+    CHECK(golay_header_encode(packet,len+GOLAY_HEADER_LEN,&packet[len])
+	  ==GOLAY_HEADER_LEN,"Golay header is not %d bytes",GOLAY_HEADER_LEN);
+
+    unsigned char sid_fragment=0;
+    int counter_low=-1;
+    int errors=n%4;
+    flip_bits(&packet[len],errors);
+    flip_bits(&packet[len+3],errors);
+    CHECK(!golay_header_decode(packet,len+GOLAY_HEADER_LEN,&sid_fragment,&counter_low),
+	  "Golay header of %d byte packet with %d bit errors not decoded",len,errors);
+    CHECK(sid_fragment==packet[0],"Golay header SID fragment %02x should be %02x",
+	  sid_fragment,packet[0]);
+    CHECK(counter_low==packet[6],"Golay header counter %02x should be %02x",
+	  counter_low,packet[6]);
+
+    golay_header_encode(packet,len+GOLAY_HEADER_LEN,&packet[len]);
+    flip_bits(&packet[len+3],4);
+    CHECK(golay_header_decode(packet,len+GOLAY_HEADER_LEN,&sid_fragment,&counter_low),
+	  "Golay header with 4 bit errors was accepted");
+  }
+  return 0;
+}
+
+// Make a peer, as saw_message() would when we first hear from it
+static int add_test_peer(unsigned char *sid)
+{
+  struct peer_state *p=calloc(1,sizeof(struct peer_state));
+  char sid_prefix[6*2+1];
+  snprintf(sid_prefix,6*2+1,"%02x%02x%02x%02x%02x%02x",
+	   sid[0],sid[1],sid[2],sid[3],sid[4],sid[5]);
+  for(int i=0;i<4;i++) p->sid_prefix_bin[i]=sid[i];
+  p->sid_prefix=strdup(sid_prefix);
+  p->last_message_number=-1;
+  p->tx_bundle=-1;
+  p->request_bitmap_bundle=-1;
+  p->held_map_bundle=-1;
+  peer_records[peer_count]=p;
+  return peer_count++;
+}
+
+// Do we hold exactly these bytes of this segment list?
+static int segments_hold(struct segment_list *s,int offset,int bytes,unsigned char *data)
+{
+  for(;s;s=s->next)
+    if ((offset>=s->start_offset)&&(offset+bytes<=s->start_offset+s->length))
+      return !memcmp(&s->data[offset-s->start_offset],data,bytes);
+  return 0;
+}
+
+// Parse a run of messages the way saw_message() does
+static int parse_test_messages(struct peer_state *sender,unsigned char *msg,int len)
+{
+  int offset=0;
+  while(offset<len) {
+    if (!message_handlers[msg[offset]]) return -1;
+    int advance=message_handlers[msg[offset]](sender,sender->sid_prefix,NULL,NULL,
+					      &msg[offset],len-offset);
+    if (advance<1) return -1;
+    offset+=advance;
+  }
+  return offset==len?0:-1;
+}
+
+/*
+  Compressed bundle pieces ('K' and 'x'): pieces sent using a slot must land in
+  the right place of the right bundle, including with 3 byte offsets, and pieces
+  for a slot that the receiver has a different binding for must be ignored.
+*/
+int check_compressed_pieces(void)
+{
+  char *bid="1122334455667788990011223344556677889900112233445566778899001122";
+  register_bundle("file",bid,"1234567890123","author","1",100000,
+		  "filehash","sender","recipient","");
+  int bundle=lookup_bundle_by_prefix(bundles[0].bid_bin,8);
+  CHECK(bundle==0,"test bundle not registered");
+  if (bundle) return 0;
+
+  // The peer we send the pieces to is us, and the peer we parse them as coming
+  // from is someone else.
+  unsigned char their_sid[32]={0x42,0x43,0x44,0x45,0x46,0x47};
+  int receiver=add_test_peer(my_sid);
+  struct peer_state *sender=peer_records[add_test_peer(their_sid)];
+
+  unsigned char piece[200],later_piece[200],stale_piece[200];
+  for(int i=0;i<200;i++) {
+    piece[i]=random(); later_piece[i]=random(); stale_piece[i]=random();
+  }
+
+  unsigned char msg[1024];
+  int len=0,announce;
+  message_counter++;
+  int slot=piece_context_slot(bundle,bundles[bundle].version,&announce);
+  CHECK(announce,"new slot binding was not announced");
+  piece_context_append_piece(slot,announce,receiver,1000,200,0,1,piece,&len,msg);
+  CHECK(len==PIECE_CONTEXT_BINDING_LEN+piece_context_header_len(1000)+200,
+	"'K'+'x' is %d bytes",len);
+  slot=piece_context_slot(bundle,bundles[bundle].version,&announce);
+  CHECK(!announce,"slot binding was announced twice in one packet");
+  piece_context_append_piece(slot,announce,receiver,0x12345,200,0,1,later_piece,&len,msg);
+
+  // We are the receiver now, and don't have the bundle yet
+  bundle_count=0;
+  CHECK(!parse_test_messages(sender,msg,len),"could not parse compressed pieces");
+  int partial=partial_find(bundles[bundle].bid_bin);
+  CHECK(partial>=0,"compressed pieces did not make a partial");
+  if (partial<0) return 0;
+  struct partial_bundle *p=&partials[partial];
+  CHECK(p->bundle_version==bundles[bundle].version,"partial has version %lld",
+	p->bundle_version);
+  CHECK(segments_hold(p->body_segments,1000,200,piece),"piece not held");
+  CHECK(segments_hold(p->body_segments,0x12345,200,later_piece),
+	"piece with 3 byte offset not held");
+
+  // A piece for a slot that we have a stale binding for must be dropped
+  len=0;
+  message_counter++;
+  slot=piece_context_slot(bundle,bundles[bundle].version,&announce);
+  piece_context_append_piece(slot,0,receiver,5000,200,0,1,stale_piece,&len,msg);
+  sender->piece_context[slot].version--;
+  CHECK(!parse_test_messages(sender,msg,len),"could not parse compressed piece");
+  CHECK(!segments_hold(p->body_segments,5000,200,stale_piece),
+	"piece for stale slot binding was accepted");
+  CHECK(message_handlers['x'](sender,sender->sid_prefix,NULL,NULL,msg,
+			      piece_context_header_len(0)-1)==-1,
+	"truncated compressed piece header was accepted");
+
+  bundle_count=1;
+  return 0;
+}
+
+/*
+  A packet that fails FEC decoding, but has a Golay header, is charged to the peer
+  it names, provided that the peer has told us that it sends such headers.
+*/
+int check_failed_packets(void)
+{
+  unsigned char sid[32]={0x99,0x98,0x97,0x96,0x95,0x94};
+  struct peer_state *p=peer_records[add_test_peer(sid)];
+  p->last_message_time=time(0);
+  p->last_message_number=0x7ff0;
+
+  CHECK(fec_note_failed_packet(0x99,0x05)==-1,
+	"failed packet charged to a peer that doesn't send Golay headers");
+  CHECK(!p->fec_failed_packet_count,"failed packet counted");
+
+  p->golay_header_time=time(0);
+  fec_note_failed_packet(0x99,0x05);
+  CHECK(p->fec_failed_packet_count==1,"failed packet not counted");
+  CHECK(p->last_message_number==0x0005,"message counter 0x%x should have wrapped to 0x5",
+	p->last_message_number);
+  fec_note_failed_packet(0x99,0x07);
+  CHECK(p->last_message_number==0x0007,"message counter is 0x%x instead of 0x7",
+	p->last_message_number);
+  CHECK(p->missed_packet_count==2,"%d packets counted as missed instead of 2",
+	p->missed_packet_count);
+  return 0;
+}
+
+/*
+  Run-length progress reports ('H'): the sender must end up believing that we
+  hold exactly the whole blocks of the body that we do hold, at whatever block
+  size the report had to use.
+*/
+static int check_progress_runs_at(int min_shift,int expected_ranges[][2],int count)
+{
+  int bundle=0;
+  int partial;
+  for(partial=0;partial<MAX_BUNDLES_IN_FLIGHT;partial++)
+    if (!partials[partial].bid_prefix) break;
+  CHECK(partial<MAX_BUNDLES_IN_FLIGHT,"no free partial for 'H' message");
+  if (partial==MAX_BUNDLES_IN_FLIGHT) return -1;
+
+  // Hold a little at the start, something unaligned in the middle, and the end
+  struct segment_list segments[3];
+  int held[3][2]={{0,5000},{20000,20100},{99000,100000}};
+  bzero(segments,sizeof segments);
+  for(int i=0;i<3;i++) {
+    segments[i].start_offset=held[i][0];
+    segments[i].length=held[i][1]-held[i][0];
+    segments[i].next=(i<2)?&segments[i+1]:NULL;
+  }
+  struct partial_bundle *p=&partials[partial];
+  bzero(p,sizeof(struct partial_bundle));
+  p->bid_prefix="1122334455667788";
+  bcopy(bundles[bundle].bid_bin,p->bid_prefix_bin,8);
+  p->body_length=bundles[bundle].length;
+  p->body_segments=segments;
+
+  progress_runs_min_block_shift=min_shift;
+  CHECK(!sync_build_progress_runs_in_slot(0,partial),"could not build 'H' message");
+  bzero(p,sizeof(struct partial_bundle));
+  progress_runs_min_block_shift=6;
+
+  struct peer_state *sender=peer_records[0];
+  sender->tx_bundle=bundle;
+  CHECK(!parse_test_messages(sender,report_queue[0],report_lengths[0]),
+	"could not parse 'H' message");
+  CHECK(sender->held_range_count==count,"'H' message gave %d ranges instead of %d",
+	sender->held_range_count,count);
+  for(int i=0;i<count;i++) {
+    int start=expected_ranges[i][0],end=expected_ranges[i][1];
+    CHECK(peer_held_map_holds(sender,bundle,start,end),
+	  "peer should hold [%d,%d)",start,end);
+    CHECK(!peer_held_map_holds(sender,bundle,start-1,end),
+	  "peer should not hold byte %d",start-1);
+    CHECK(peer_held_map_next_missing(sender,bundle,start)==end,
+	  "peer should be missing byte %d",end);
+  }
+  sender->tx_bundle=-1;
+  return 0;
+}
+
+int check_progress_runs(void)
+{
+  // 64 byte blocks: only whole blocks count as held, except for the end of the body
+  int fine[3][2]={{0,4992},{20032,20096},{99008,100000}};
+  check_progress_runs_at(6,fine,3);
+  // 1KB blocks: the middle bit isn't a whole block any more
+  int coarse[2][2]={{0,4096},{99328,100000}};
+  check_progress_runs_at(10,coarse,2);
+
+  // Corrupt run lengths, as large as can be encoded, must not take the ranges
+  // outside the body.
+  unsigned char msg[1+8+2+1+1+5*50];
+  int len=0;
+  msg[len++]='H';
+  bcopy(bundles[0].bid_bin,&msg[len],8); len+=8;
+  msg[len++]=0xff; msg[len++]=0xff;
+  msg[len++]=24;
+  msg[len++]=5*50;
+  for(int i=0;i<5*50;i++) msg[len++]=((i%5)==4)?0x7f:0xff;
+  struct peer_state *sender=peer_records[0];
+  sender->tx_bundle=0;
+  CHECK(!parse_test_messages(sender,msg,len),"could not parse corrupt 'H' message");
+  for(int i=0;i<sender->held_range_count;i++)
+    CHECK((sender->held_ranges[i][0]>=0)
+	  &&(sender->held_ranges[i][0]<sender->held_ranges[i][1])
+	  &&(sender->held_ranges[i][1]<=bundles[0].length),
+	  "corrupt 'H' message gave range [%d,%d)",
+	  sender->held_ranges[i][0],sender->held_ranges[i][1]);
+  sender->tx_bundle=-1;
+  return 0;
+}
+
+int main(int argc,char **argv)
+{
+  srandom(1);
+
+  check_sync_tree();
+  check_reed_solomon();
+  check_fec_levels();
+  check_fountain();
+  check_golay_header();
+
+  // Enough of LBARD's own state for the message handlers
+  my_sid_hex="0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+  for(int i=0;i<32;i++) {
+    char hex[3]={my_sid_hex[i*2],my_sid_hex[i*2+1],0};
+    my_sid[i]=strtoll(hex,NULL,16);
+  }
+  sync_setup();
+
+  check_compressed_pieces();
+  check_failed_packets();
+  check_progress_runs();
+
+  if (failures) {
+    printf("%d round-trip checks FAILED\n",failures);
+    return 1;
+  }
+  printf("All round-trip checks passed\n");
+  return 0;
+}
@@ -0,0 +1,151 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2016 Serval Project Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+  Check that encode_rs_8() and decode_rs_8() give exactly the same results as
+  Phil Karn's portable reference implementation, and compare their throughput.
+
+  usage: rsbench [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "fec-3.0.1/fixed.h"
+
+void encode_rs_8(data_t *data, data_t *parity,int pad);
+int decode_rs_8(data_t *data, int *eras_pos, int no_eras, int pad);
+
+// The reference implementations, built from the same generic code as the
+// library versions, but without any of the speed ups.
+static void encode_rs_8_reference(data_t *data, data_t *parity,int pad)
+{
+#include "fec-3.0.1/encode_rs.h"
+}
+
+static int decode_rs_8_reference(data_t *data, int *eras_pos, int no_eras, int pad)
+{
+  int retval;
+#include "fec-3.0.1/decode_rs.h"
+  return retval;
+}
+
+long long gettime_us()
+{
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec*1000000LL+tv.tv_usec;
+}
+
+// Fill a block with random data and its parity, then corrupt some bytes
+void make_block(data_t *block,int pad,int errors)
+{
+  int len=NN-NROOTS-pad;
+  for(int i=0;i<len;i++) block[i]=random();
+  encode_rs_8_reference(block,&block[len],pad);
+  for(int e=0;e<errors;e++) block[random()%(NN-pad)]^=1+(random()%255);
+}
+
+int check_exact(int blocks)
+{
+  data_t a[NN],b[NN],pa[NROOTS],pb[NROOTS];
+  int fails=0;
+
+  for(int n=0;n<blocks;n++) {
+    int pad=random()%(NN-NROOTS);
+    int len=NN-NROOTS-pad;
+    for(int i=0;i<len;i++) a[i]=random();
+    encode_rs_8_reference(a,pa,pad);
+    encode_rs_8(a,pb,pad);
+    if (memcmp(pa,pb,NROOTS)) {
+      fprintf(stderr,"Encoder mismatch: block %d, pad=%d\n",n,pad);
+      fails++;
+    }
+
+    // Include error counts beyond what can be corrected
+    make_block(a,pad,random()%24);
+    memcpy(b,a,NN-pad);
+    int ra=decode_rs_8_reference(a,NULL,0,pad);
+    int rb=decode_rs_8(b,NULL,0,pad);
+    if ((ra!=rb)||memcmp(a,b,NN-pad)) {
+      fprintf(stderr,"Decoder mismatch: block %d, pad=%d, result %d vs %d\n",
+	      n,pad,ra,rb);
+      fails++;
+    }
+  }
+  return fails;
+}
+
+typedef int (*decoder)(data_t *data, int *eras_pos, int no_eras, int pad);
+
+double time_decode(decoder d,data_t blocks[][NN],int count,int pad,int iterations)
+{
+  data_t work[NN];
+  long long start=gettime_us();
+  for(int n=0;n<iterations;n++) {
+    memcpy(work,blocks[n%count],NN-pad);
+    d(work,NULL,0,pad);
+  }
+  long long elapsed=gettime_us()-start;
+  if (elapsed<1) elapsed=1;
+  // Throughput of data bytes in MB/sec
+  return (NN-NROOTS-pad)*1.0*iterations/elapsed;
+}
+
+int main(int argc,char **argv)
+{
+  int iterations=20000;
+  if (argc>1) iterations=atoi(argv[1]);
+
+  srandom(1);
+
+  int fails=check_exact(iterations/4);
+  printf("Bit-exactness check: %s\n",fails?"FAILED":"passed");
+
+  // Typical LBARD packet: 200 byte MTU, less parity
+  int pad=NN-200;
+  int len=NN-NROOTS-pad;
+  data_t data[NN],parity[NROOTS];
+  for(int i=0;i<len;i++) data[i]=random();
+
+  long long start=gettime_us();
+  for(int n=0;n<iterations;n++) encode_rs_8_reference(data,parity,pad);
+  long long ref_time=gettime_us()-start;
+  start=gettime_us();
+  for(int n=0;n<iterations;n++) encode_rs_8(data,parity,pad);
+  long long new_time=gettime_us()-start;
+  if (ref_time<1) ref_time=1;
+  if (new_time<1) new_time=1;
+  printf("Encode (%d byte blocks): reference %.2f MB/sec, fast %.2f MB/sec\n",
+	 len,len*1.0*iterations/ref_time,len*1.0*iterations/new_time);
+
+  static data_t blocks[64][NN];
+  int error_counts[]={0,1,4,16};
+  for(int e=0;e<4;e++) {
+    for(int n=0;n<64;n++) make_block(blocks[n],pad,error_counts[e]);
+    printf("Decode (%d byte blocks, %d byte errors): reference %.2f MB/sec, fast %.2f MB/sec\n",
+	   len,error_counts[e],
+	   time_decode(decode_rs_8_reference,blocks,64,pad,iterations),
+	   time_decode(decode_rs_8,blocks,64,pad,iterations));
+  }
+
+  return fails?1:0;
+}
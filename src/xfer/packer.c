@@ -0,0 +1,310 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2016 Serval Project Inc.
+
+This program monitors a local Rhizome database and attempts
+to synchronise it over low-bandwidth declarative transports,
+such as bluetooth name or wifi-direct service information
+messages.  It is intended to give a high priority to MeshMS
+converations among nearby nodes.
+
+The design is fully asynchronous, so a call to the update_my_message()
+function from time to time should be all that is required.
+
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+  Packing the contents of each packet.
+
+  Each packet we send costs the same airtime however full it is, so we want each one
+  to carry the most useful mix of content that will fit.  The candidates are the
+  queued reports (acknowledgements, progress bitmaps and BARs, see
+  report_queue.c), our time stamp and
+  generation ID, a sync tree message, and a piece of the current bundle for each
+  active peer that we are sending to.
+
+  Each candidate has a value per byte, reflecting how urgent it is, and a range of
+  sizes: reports, time stamps and generation IDs are a fixed size, but sync messages
+  and bundle pieces can use anything from a useful minimum up to however much they
+  have to send.  We then allocate space to the most valuable candidates first, which
+  is the optimal solution to this (fractional) knapsack problem, apart from the
+  minimum sizes.  So, for example, a time stamp is only sent once it has become
+  more valuable than the bundle pieces it would displace, or when there is
+  room to spare.
+
+  Finally, the chosen candidates are written into the packet in a fixed order, with
+  each being allowed to use any space that those before it left unused.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+
+#include "sync.h"
+#include "lbard.h"
+
+// Candidate types, in the order they are written into the packet
+#define PACK_REPORT 0
+#define PACK_TIMESTAMP 1
+#define PACK_GENERATIONID 2
+#define PACK_PIECE 3
+#define PACK_SYNC 4
+
+// (see append_timestamp() and append_generationid())
+#define TIMESTAMP_LEN 13
+#define GENERATIONID_LEN 5
+// Bundle piece header is 21 bytes, and it isn't worth sending less than this much
+// data with one.
+#define MIN_PIECE_LEN (21+16)
+#define MIN_SYNC_LEN (SYNC_MSG_HEADER_LEN+8)
+// A sync message when our trees don't need reconciling is small
+#define IDLE_SYNC_LEN (SYNC_MSG_HEADER_LEN+24)
+// Announce our time and instance every so often when there is room, and always
+// at least this often.
+#define MIN_ANNOUNCE_INTERVAL 10
+#define MAX_ANNOUNCE_INTERVAL 30
+
+// Value per byte of each kind of content
+#define VALUE_REPORT 1000
+#define VALUE_FORCED 1000
+#define VALUE_PIECE 10
+#define VALUE_SYNC_ACTIVE 20
+#define VALUE_SYNC_IDLE 1
+
+struct pack_candidate {
+  int type;
+  // Report slot, or peer number
+  int index;
+  int value;
+  int min_bytes;
+  int max_bytes;
+  // Bytes allocated, or 0 if not chosen
+  int bytes;
+  // For pieces, the peer's turn this packet, to break ties between peers fairly
+  int turn;
+};
+
+int packets_since_timestamp=MAX_ANNOUNCE_INTERVAL;
+int packets_since_generationid=MAX_ANNOUNCE_INTERVAL;
+
+// Fill ratio of the packets we send, as a decaying average x256, and in total
+int packet_fill_average=0;
+long long packet_fill_bytes=0;
+long long packet_fill_capacity=0;
+
+static int pack_compare(const void *a,const void *b)
+{
+  const struct pack_candidate *x=a;
+  const struct pack_candidate *y=b;
+  if (x->value!=y->value) return y->value-x->value;
+  if (x->type!=y->type) return x->type-y->type;
+  // Reports of equal priority are flushed last in first out.
+  if ((x->type==PACK_REPORT)&&(x->index!=y->index))
+    return report_queue_sequence[y->index]>report_queue_sequence[x->index]?1:-1;
+  if (x->type==PACK_PIECE) return x->turn-y->turn;
+  return y->index-x->index;
+}
+
+static int pack_emit_order(const void *a,const void *b)
+{
+  const struct pack_candidate *x=a;
+  const struct pack_candidate *y=b;
+  if (x->type!=y->type) return x->type-y->type;
+  // Bundle pieces in order of value
+  if (x->value!=y->value) return y->value-x->value;
+  return x->index-y->index;
+}
+
+static int pack_announce_value(int packets_since)
+{
+  if (packets_since<MIN_ANNOUNCE_INTERVAL) return 0;
+  if (packets_since>=MAX_ANNOUNCE_INTERVAL) return VALUE_FORCED;
+  return packets_since;
+}
+
+static int pack_piece_candidate(int peer,int mtu,struct pack_candidate *c)
+{
+  struct peer_state *p=peer_records[peer];
+  if (!p) return -1;
+  int bundle=p->tx_bundle;
+  if ((bundle<0)||(bundle>=bundle_count)) return -1;
+
+  c->type=PACK_PIECE;
+  c->index=peer;
+  // MeshMS and small bundles first, as for the order we queue them in
+  int class=bundle_cached_priority_class(bundle);
+  c->value=VALUE_PIECE+(15-class);
+  c->min_bytes=MIN_PIECE_LEN;
+  // Don't take space from others that we can't use.  Once we have sent the
+  // whole bundle we start again from the start (or send coded pieces), so
+  // then we can use as much as we can get.
+  long long remaining=bundles[bundle].length-p->tx_bundle_body_offset;
+  if (p->tx_bundle_manifest_offset<1024) remaining+=1024-p->tx_bundle_manifest_offset;
+  if (p->tx_bundle_coded||(remaining<=0)) remaining=mtu;
+  // Allow for a second header, for manifest and body in the same packet
+  remaining+=2*21;
+  if (remaining>mtu) remaining=mtu;
+  c->max_bytes=remaining;
+  return 0;
+}
+
+static int pack_write_report(int slot,int *offset,int mtu,unsigned char *msg_out)
+{
+  if (append_bytes(offset,mtu,msg_out,report_queue[slot],report_lengths[slot])) {
+    fprintf(stderr,"Tried to send report_queue message '%s' to %s*, but append_bytes reported no more space.\n",
+	    report_queue_message[slot],report_queue_peers[slot]->sid_prefix);
+    return -1;
+  }
+  fprintf(stderr,">>> %s Flushing %d byte report from queue, %d remaining.\n",
+	  timestamp_str(),report_lengths[slot],report_queue_length-1);
+  fprintf(stderr,"T+%lldms : Flushing %d byte report from queue, %d remaining.\n",
+	  gettime_ms()-start_time,report_lengths[slot],report_queue_length-1);
+  fprintf(stderr,"Sent report_queue message '%s' to %s*\n",
+	  report_queue_message[slot],report_queue_peers[slot]->sid_prefix);
+  if (report_queue_message[slot])
+    dump_bytes(stderr,"report_queue message",
+	       (unsigned char *)report_queue_message[slot],
+	       report_lengths[slot]);
+  return 0;
+}
+
+int sync_by_tree_stuff_packet(int *offset,int mtu, unsigned char *msg_out,
+			      char *sid_prefix_hex,
+			      char *servald_server,char *credential)
+{
+  struct pack_candidate c[REPORT_QUEUE_LEN+MAX_PEERS+3];
+  int count=0;
+  int reports_sent[REPORT_QUEUE_LEN];
+  bzero(reports_sent,sizeof(reports_sent));
+
+  // Gather the candidates, dropping any reports that are no longer true
+  for(int i=0;i<report_queue_length;i++) {
+    if (report_queue_is_stale(i)) { reports_sent[i]=-1; continue; }
+    c[count].type=PACK_REPORT;
+    c[count].index=i;
+    c[count].value=VALUE_REPORT+report_type_priority(report_queue_types[i]);
+    c[count].min_bytes=c[count].max_bytes=report_lengths[i];
+    count++;
+  }
+
+  c[count].type=PACK_TIMESTAMP;
+  c[count].index=0;
+  c[count].value=pack_announce_value(packets_since_timestamp);
+  c[count].min_bytes=c[count].max_bytes=TIMESTAMP_LEN;
+  if (c[count].value) count++;
+
+  c[count].type=PACK_GENERATIONID;
+  c[count].index=0;
+  c[count].value=pack_announce_value(packets_since_generationid);
+  c[count].min_bytes=c[count].max_bytes=GENERATIONID_LEN;
+  if (c[count].value) count++;
+
+  // Only active peers, with whoever's turn it is first among equals
+  int first=random_active_peer();
+  if (first>=0) {
+    int start=peer_records[first]->active_slot-1;
+    for(int i=0;i<active_peer_total;i++) {
+      int peer=active_peers[(start+i)%active_peer_total];
+      if (pack_piece_candidate(peer,mtu,&c[count])) continue;
+      c[count].turn=i;
+      count++;
+    }
+  }
+
+  // The sync message is worth more while there are differences being resolved,
+  // but we still leave room for bundle pieces to make progress.
+  c[count].type=PACK_SYNC;
+  c[count].index=0;
+  c[count].min_bytes=MIN_SYNC_LEN;
+  if (sync_has_transmit_queued(sync_state)) {
+    c[count].value=VALUE_SYNC_ACTIVE;
+    c[count].max_bytes=mtu/2;
+  } else {
+    c[count].value=VALUE_SYNC_IDLE;
+    c[count].max_bytes=IDLE_SYNC_LEN;
+  }
+  count++;
+
+  // Allocate space to the most valuable first
+  qsort(c,count,sizeof(struct pack_candidate),pack_compare);
+  int space=mtu-(*offset);
+  for(int i=0;i<count;i++) {
+    int bytes=c[i].max_bytes;
+    if (bytes>space) bytes=space;
+    if (bytes<c[i].min_bytes) bytes=0;
+    c[i].bytes=bytes;
+    space-=bytes;
+  }
+
+  // Write them into the packet.  Each may use anything not reserved for those
+  // still to come.
+  qsort(c,count,sizeof(struct pack_candidate),pack_emit_order);
+  int reserved=0;
+  for(int i=0;i<count;i++) reserved+=c[i].bytes;
+  for(int i=0;i<count;i++) {
+    // (the sync message comes last, and makes use of anything left over)
+    if ((!c[i].bytes)&&(c[i].type!=PACK_SYNC)) continue;
+    reserved-=c[i].bytes;
+    int limit=mtu-reserved;
+    if ((limit-(*offset))<c[i].min_bytes) continue;
+    switch(c[i].type) {
+    case PACK_REPORT:
+      if (!pack_write_report(c[i].index,offset,limit,msg_out))
+	reports_sent[c[i].index]=1;
+      break;
+    case PACK_TIMESTAMP:
+      append_timestamp(msg_out,offset);
+      packets_since_timestamp=0;
+      break;
+    case PACK_GENERATIONID:
+      append_generationid(msg_out,offset);
+      packets_since_generationid=0;
+      break;
+    case PACK_PIECE:
+      sync_tree_send_data(offset,limit,msg_out,c[i].index,
+			  sid_prefix_hex,servald_server,credential);
+      break;
+    case PACK_SYNC:
+      sync_tree_send_message(offset,limit,msg_out);
+      break;
+    }
+  }
+  report_queue_remove_sent(reports_sent);
+
+  packets_since_timestamp++;
+  packets_since_generationid++;
+  return 0;
+}
+
+int packet_note_fill(int bytes,int mtu)
+{
+  if (mtu<1) return -1;
+  packet_fill_bytes+=bytes;
+  packet_fill_capacity+=mtu;
+  packet_fill_average+=((bytes<<8)/mtu-packet_fill_average)/8;
+  if (debug_radio_tx)
+    printf(">>> %s Sending packet with %d of %d bytes used (%d%%, average %d%%)\n",
+	   timestamp_str(),bytes,mtu,bytes*100/mtu,packet_fill_average*100/256);
+  return 0;
+}
@@ -0,0 +1,349 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2016 Serval Project Inc.
+
+This program monitors a local Rhizome database and attempts
+to synchronise it over low-bandwidth declarative transports,
+such as bluetooth name or wifi-direct service information
+messages.  It is intended to give a high priority to MeshMS
+converations among nearby nodes.
+
+The design is fully asynchronous, so a call to the update_my_message()
+function from time to time should be all that is required.
+
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+  Disk backed partial bundles.
+
+  If partialspool=<directory> is given, the bytes we receive of each partial
+  bundle are kept in a sparse file in that directory, which we map into memory,
+  instead of in malloc()d buffers.  The segment lists still describe which bytes
+  we have, but the data of each segment points into the mapping at the position
+  of its start offset, so the rest of lbard doesn't need to care where the bytes
+  live.  The kernel can write back and drop pages of the mapping that we aren't
+  using, so large bundles no longer need RAM in proportion to their size.
+
+  The start of the file records which bundle it is, and the extents of it that
+  we hold, so that if lbard restarts, we can carry on from where we were instead
+  of fetching the whole bundle again.
+
+  The file is laid out as:
+  [0,4096)      : header
+  [4096,12288)  : manifest
+  [12288,...)   : body
+
+  If anything goes wrong with the file, we move the partial back into memory and
+  carry on without it.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <strings.h>
+#include <string.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sync.h"
+#include "lbard.h"
+
+#define PARTIAL_SPOOL_MAGIC "LBARDPS1"
+#define PARTIAL_SPOOL_HEADER_SIZE 4096
+#define PARTIAL_SPOOL_MANIFEST_SIZE 8192
+#define PARTIAL_SPOOL_BODY_OFFSET (PARTIAL_SPOOL_HEADER_SIZE+PARTIAL_SPOOL_MANIFEST_SIZE)
+// Grow the mapping in steps of this much, so that we don't remap for every piece
+#define PARTIAL_SPOOL_GROW_STEP 65536
+#define PARTIAL_SPOOL_MAX_EXTENTS 256
+
+struct partial_spool_header {
+  char magic[8];
+  uint8_t bid_prefix_bin[8];
+  int64_t version;
+  int32_t manifest_length;
+  int32_t body_length;
+  int32_t manifest_extent_count;
+  int32_t body_extent_count;
+  // [start, length) of each extent we hold, manifest extents first, in the order
+  // of the segment lists.  If there are too many, the rest are fetched again.
+  int32_t extents[PARTIAL_SPOOL_MAX_EXTENTS][2];
+};
+
+char *partial_spool_dir=NULL;
+
+static void partial_spool_filename(char *filename,int len,unsigned char *bid_prefix_bin)
+{
+  snprintf(filename,len,"%s/%02x%02x%02x%02x%02x%02x%02x%02x.partial",
+	   partial_spool_dir,
+	   bid_prefix_bin[0],bid_prefix_bin[1],bid_prefix_bin[2],bid_prefix_bin[3],
+	   bid_prefix_bin[4],bid_prefix_bin[5],bid_prefix_bin[6],bid_prefix_bin[7]);
+}
+
+static long long partial_spool_position(int is_manifest,int offset)
+{
+  return (is_manifest?PARTIAL_SPOOL_HEADER_SIZE:PARTIAL_SPOOL_BODY_OFFSET)+offset;
+}
+
+unsigned char *partial_spool_ptr(struct partial_bundle *p,int is_manifest,int offset)
+{
+  return &p->spool_map[partial_spool_position(is_manifest,offset)];
+}
+
+static void partial_spool_rebase(struct partial_bundle *p)
+{
+  for(struct segment_list *s=p->manifest_segments;s;s=s->next)
+    if (s->spooled) s->data=partial_spool_ptr(p,1,s->start_offset);
+  for(struct segment_list *s=p->body_segments;s;s=s->next)
+    if (s->spooled) s->data=partial_spool_ptr(p,0,s->start_offset);
+}
+
+static int partial_spool_map_to(struct partial_bundle *p,long long len)
+{
+  if (len<=p->spool_map_len) return 0;
+  len=(len+PARTIAL_SPOOL_GROW_STEP-1)/PARTIAL_SPOOL_GROW_STEP*PARTIAL_SPOOL_GROW_STEP;
+
+  struct stat st;
+  if (fstat(p->spool_fd,&st)) return -1;
+  if ((st.st_size<len)&&ftruncate(p->spool_fd,len)) return -1;
+
+  // Map the new size before letting go of the old mapping, so that we still have
+  // the segments if it fails.
+  unsigned char *map=mmap(NULL,len,PROT_READ|PROT_WRITE,MAP_SHARED,p->spool_fd,0);
+  if (map==MAP_FAILED) return -1;
+  if (p->spool_map) munmap(p->spool_map,p->spool_map_len);
+  p->spool_map=map;
+  p->spool_map_len=len;
+  partial_spool_rebase(p);
+  return 0;
+}
+
+int partial_spool_create(struct partial_bundle *p)
+{
+  if (!partial_spool_dir) return -1;
+  if (p->spool_map) return 0;
+
+  char filename[1024];
+  partial_spool_filename(filename,sizeof(filename),p->bid_prefix_bin);
+  p->spool_fd=open(filename,O_RDWR|O_CREAT|O_TRUNC,0600);
+  if (p->spool_fd<0) {
+    perror("open");
+    fprintf(stderr,"Could not create partial spool file '%s'\n",filename);
+    return -1;
+  }
+  if (partial_spool_map_to(p,PARTIAL_SPOOL_BODY_OFFSET)
+      ||posix_fallocate(p->spool_fd,0,sizeof(struct partial_spool_header))) {
+    fprintf(stderr,"Could not map partial spool file '%s'\n",filename);
+    partial_spool_close(p,1);
+    return -1;
+  }
+  partial_spool_note_progress(p);
+  return 0;
+}
+
+int partial_spool_write(struct partial_bundle *p,int is_manifest,int offset,int bytes,
+			unsigned char *data)
+{
+  if (!p->spool_map) return -1;
+  if ((offset<0)||(bytes<0)) return -1;
+  if (is_manifest&&((offset+bytes)>PARTIAL_SPOOL_MANIFEST_SIZE)) return -1;
+  if (!bytes) return 0;
+
+  long long position=partial_spool_position(is_manifest,offset);
+  if (partial_spool_map_to(p,position+bytes)) return -1;
+  // Make sure that the disk space is really there, since running out of space
+  // while writing to the mapping would kill us with SIGBUS.
+  if (posix_fallocate(p->spool_fd,position,bytes)) return -1;
+  bcopy(data,&p->spool_map[position],bytes);
+  return 0;
+}
+
+static int partial_spool_unspool_segments(struct segment_list *s)
+{
+  for(;s;s=s->next) {
+    if (!s->spooled) continue;
+    unsigned char *d=malloc(s->length);
+    assert(d);
+    bcopy(s->data,d,s->length);
+    s->data=d;
+    s->spooled=0;
+  }
+  return 0;
+}
+
+int partial_spool_abandon(struct partial_bundle *p)
+{
+  if (!p->spool_map) return 0;
+  fprintf(stderr,"Could not write to spool file for %s*, so keeping it in memory instead.\n",
+	  p->bid_prefix);
+  partial_spool_unspool_segments(p->manifest_segments);
+  partial_spool_unspool_segments(p->body_segments);
+  return partial_spool_close(p,1);
+}
+
+int partial_spool_close(struct partial_bundle *p,int discard)
+{
+  if (p->spool_map) munmap(p->spool_map,p->spool_map_len);
+  if (p->spool_map||p->spool_fd>0) close(p->spool_fd);
+  if (discard&&partial_spool_dir&&p->bid_prefix) {
+    char filename[1024];
+    partial_spool_filename(filename,sizeof(filename),p->bid_prefix_bin);
+    unlink(filename);
+  }
+  p->spool_fd=0;
+  p->spool_map=NULL;
+  p->spool_map_len=0;
+  return 0;
+}
+
+static int partial_spool_note_extents(struct segment_list *s,struct partial_spool_header *h,
+				      int *n)
+{
+  int count=0;
+  for(;s&&((*n)<PARTIAL_SPOOL_MAX_EXTENTS);s=s->next) {
+    h->extents[*n][0]=s->start_offset;
+    h->extents[*n][1]=s->length;
+    (*n)++; count++;
+  }
+  return count;
+}
+
+int partial_spool_note_progress(struct partial_bundle *p)
+{
+  if (!p->spool_map) return 0;
+  struct partial_spool_header *h=(struct partial_spool_header *)p->spool_map;
+  memcpy(h->magic,PARTIAL_SPOOL_MAGIC,sizeof(h->magic));
+  bcopy(p->bid_prefix_bin,h->bid_prefix_bin,8);
+  h->version=p->bundle_version;
+  h->manifest_length=p->manifest_length;
+  h->body_length=p->body_length;
+  int n=0;
+  h->manifest_extent_count=partial_spool_note_extents(p->manifest_segments,h,&n);
+  h->body_extent_count=partial_spool_note_extents(p->body_segments,h,&n);
+  return 0;
+}
+
+static int partial_spool_header_ok(struct partial_spool_header *h,long long file_size)
+{
+  if (memcmp(h->magic,PARTIAL_SPOOL_MAGIC,sizeof(h->magic))) return 0;
+  if ((h->manifest_extent_count<0)||(h->body_extent_count<0)) return 0;
+  if ((h->manifest_extent_count+h->body_extent_count)>PARTIAL_SPOOL_MAX_EXTENTS) return 0;
+  for(int n=0;n<(h->manifest_extent_count+h->body_extent_count);n++) {
+    int is_manifest=(n<h->manifest_extent_count);
+    long long start=h->extents[n][0];
+    long long end=start+h->extents[n][1];
+    if ((start<0)||(end<start)) return 0;
+    if (is_manifest&&(end>PARTIAL_SPOOL_MANIFEST_SIZE)) return 0;
+    if (partial_spool_position(is_manifest,0)+end>file_size) return 0;
+  }
+  return 1;
+}
+
+static int partial_spool_restore_file(char *filename)
+{
+  int fd=open(filename,O_RDWR);
+  if (fd<0) return -1;
+
+  struct partial_spool_header h;
+  struct stat st;
+  if (fstat(fd,&st)
+      ||(pread(fd,&h,sizeof(h),0)!=sizeof(h))
+      ||(!partial_spool_header_ok(&h,st.st_size))
+      ||(partial_find(h.bid_prefix_bin)!=-1)) {
+    close(fd);
+    return -1;
+  }
+
+  char bid_prefix[8*2+1];
+  snprintf(bid_prefix,8*2+1,"%02x%02x%02x%02x%02x%02x%02x%02x",
+	   h.bid_prefix_bin[0],h.bid_prefix_bin[1],h.bid_prefix_bin[2],h.bid_prefix_bin[3],
+	   h.bid_prefix_bin[4],h.bid_prefix_bin[5],h.bid_prefix_bin[6],h.bid_prefix_bin[7]);
+  int i=partial_allocate(bid_prefix,h.bid_prefix_bin,h.version);
+  if (i<0) {
+    close(fd);
+    return -1;
+  }
+  struct partial_bundle *p=&partials[i];
+  p->spool_fd=fd;
+  if (partial_spool_map_to(p,st.st_size)) {
+    clear_partial(p);
+    return -1;
+  }
+  p->manifest_length=h.manifest_length;
+  p->body_length=h.body_length;
+
+  // Put the segments back in the same order they were in
+  struct segment_list **tail[2]={&p->body_segments,&p->manifest_segments};
+  for(int n=0;n<(h.manifest_extent_count+h.body_extent_count);n++) {
+    int is_manifest=(n<h.manifest_extent_count);
+    struct segment_list *s=calloc(1,sizeof(struct segment_list));
+    assert(s);
+    s->start_offset=h.extents[n][0];
+    s->length=h.extents[n][1];
+    s->data=partial_spool_ptr(p,is_manifest,s->start_offset);
+    s->spooled=1;
+    *tail[is_manifest]=s;
+    tail[is_manifest]=&s->next;
+  }
+  for(struct segment_list *s=p->manifest_segments;s&&s->next;s=s->next) s->next->prev=s;
+  for(struct segment_list *s=p->body_segments;s&&s->next;s=s->next) s->next->prev=s;
+  merge_segments(&p->manifest_segments);
+  merge_segments(&p->body_segments);
+
+  // So that the first progress report we send for it is already correct
+  partial_update_request_bitmap(p);
+
+  if (debug_pieces)
+    printf(">>> %s Resumed partial %s*/%lld from '%s'\n",
+	   timestamp_str(),p->bid_prefix,p->bundle_version,filename);
+  return 0;
+}
+
+int partial_spool_restore(void)
+{
+  if (!partial_spool_dir) return 0;
+  DIR *d=opendir(partial_spool_dir);
+  if (!d) {
+    perror("opendir");
+    fprintf(stderr,"Could not read partial spool directory '%s'\n",partial_spool_dir);
+    return -1;
+  }
+
+  int count=0;
+  struct dirent *de;
+  while((de=readdir(d))!=NULL) {
+    int len=strlen(de->d_name);
+    if ((len<8)||strcmp(&de->d_name[len-8],".partial")) continue;
+    char filename[1024];
+    snprintf(filename,sizeof(filename),"%s/%s",partial_spool_dir,de->d_name);
+    if (!partial_spool_restore_file(filename)) count++;
+    else {
+      fprintf(stderr,"Discarding invalid partial spool file '%s'\n",filename);
+      unlink(filename);
+    }
+  }
+  closedir(d);
+
+  fprintf(stderr,"Resumed %d partial bundles from '%s'\n",count,partial_spool_dir);
+  return count;
+}
@@ -43,7 +43,164 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "code_instrumentation.h"
 #include "util.h"
 
-struct partial_bundle partials[MAX_BUNDLES_IN_FLIGHT];  
+struct partial_bundle partials[MAX_BUNDLES_IN_FLIGHT];
+
+/*
+  Partials are found by a hash of their binary BID prefix, with chaining.  Both
+  arrays hold partial number + 1, so that zero means the end of the chain.
+*/
+#define PARTIAL_HASH_SIZE 512
+static int partial_hash_heads[PARTIAL_HASH_SIZE];
+static int partial_hash_next[MAX_BUNDLES_IN_FLIGHT];
+
+// Partials that have not progressed for this long are evicted first
+#define PARTIAL_STALE_TIME 60
+
+long long partial_lookups = 0;
+long long partial_lookup_hits = 0;
+long long partial_evictions = 0;
+long long partial_evicted_bytes = 0;
+
+static int partial_hash(unsigned char *bid_prefix_bin)
+{
+  // BIDs are public keys, so any of their bits will do
+  return (bid_prefix_bin[0] | (bid_prefix_bin[1] << 8)) % PARTIAL_HASH_SIZE;
+}
+
+static void partial_index_remove(int partial)
+{
+  int *link = &partial_hash_heads[partial_hash(partials[partial].bid_prefix_bin)];
+  while (*link)
+  {
+    if ((*link) == (partial + 1))
+    {
+      *link = partial_hash_next[partial];
+      partial_hash_next[partial] = 0;
+      return;
+    }
+    link = &partial_hash_next[(*link) - 1];
+  }
+}
+
+int partial_find(unsigned char *bid_prefix_bin)
+{
+  partial_lookups++;
+  int n = partial_hash_heads[partial_hash(bid_prefix_bin)];
+  while (n)
+  {
+    if (partials[n - 1].bid_prefix
+        && (!memcmp(partials[n - 1].bid_prefix_bin, bid_prefix_bin, 8)))
+    {
+      partial_lookup_hits++;
+      return n - 1;
+    }
+    n = partial_hash_next[n - 1];
+  }
+  return -1;
+}
+
+static int partial_bytes_held(struct partial_bundle *p)
+{
+  int bytes = 0;
+  for (struct segment_list *s = p->manifest_segments; s; s = s->next)
+    bytes += s->length;
+  for (struct segment_list *s = p->body_segments; s; s = s->next)
+    bytes += s->length;
+  return bytes;
+}
+
+// How much of the bundle we hold, in thousandths, or 0 if we don't know its size
+static int partial_completeness(struct partial_bundle *p)
+{
+  if ((p->body_length < 0) || (p->manifest_length < 0)) return 0;
+  long long total = (long long)p->body_length + p->manifest_length;
+  if (total < 1) return 0;
+  return partial_bytes_held(p) * 1000LL / total;
+}
+
+/*
+  Choose which partial to give up on when we need room for a new one.
+  Partials that are still making progress are kept in preference to those that
+  have stalled, and within each of those groups we discard the least complete
+  first, so that we don't throw away a transfer that is nearly finished.
+ */
+static int partial_choose_victim(void)
+{
+  int victim = 0;
+  int victim_stale = 0, victim_completeness = 0;
+  time_t now = time(0);
+
+  for (int i = 0; i < MAX_BUNDLES_IN_FLIGHT; i++)
+  {
+    int stale = (now - partials[i].last_progress_time) >= PARTIAL_STALE_TIME;
+    int completeness = partial_completeness(&partials[i]);
+    if (i)
+    {
+      if (stale < victim_stale) continue;
+      if (stale == victim_stale)
+      {
+        if (completeness > victim_completeness) continue;
+        if ((completeness == victim_completeness)
+            && (partials[i].last_progress_time >= partials[victim].last_progress_time))
+          continue;
+      }
+    }
+    victim = i;
+    victim_stale = stale;
+    victim_completeness = completeness;
+  }
+  return victim;
+}
+
+int partial_allocate(char *bid_prefix, unsigned char *bid_prefix_bin, long long version)
+{
+  int retVal = -1;
+
+  LOG_ENTRY;
+
+  do
+  {
+    int i;
+    for (i = 0; i < MAX_BUNDLES_IN_FLIGHT; i++)
+    {
+      if (! partials[i].bid_prefix) break;
+    }
+
+    if (i == MAX_BUNDLES_IN_FLIGHT)
+    {
+      i = partial_choose_victim();
+      partial_evictions++;
+      partial_evicted_bytes += partial_bytes_held(&partials[i]);
+      if (debug_pieces)
+      {
+        printf(">>> %s Giving up on partial %s* (%d/1000 complete) to make room for %s*\n",
+               timestamp_str(), partials[i].bid_prefix,
+               partial_completeness(&partials[i]), bid_prefix);
+      }
+    }
+    // Clear it just to make sure.
+    clear_partial(&partials[i]);
+
+    // Now prepare the partial record
+    partials[i].bid_prefix = strdup(bid_prefix);
+    bcopy(bid_prefix_bin, partials[i].bid_prefix_bin, 8);
+    partials[i].bundle_version = version;
+    partials[i].manifest_length = -1;
+    partials[i].body_length = -1;
+    partials[i].last_progress_time = time(0);
+
+    int h = partial_hash(bid_prefix_bin);
+    partial_hash_next[i] = partial_hash_heads[h];
+    partial_hash_heads[h] = i + 1;
+
+    retVal = i;
+  }
+  while (0);
+
+  LOG_EXIT;
+
+  return retVal;
+}
 
 int partial_recent_sender_report(struct partial_bundle *p)
 {
@@ -193,7 +350,7 @@ int clear_partial(struct partial_bundle *p)
       }
 #endif
       p->manifest_segments = s->next;
-      if (s->data) 
+      if (s->data && (! s->spooled)) 
       {
         free(s->data); 
         s->data = NULL;
@@ -214,7 +371,7 @@ int clear_partial(struct partial_bundle *p)
       }
 #endif
       p->body_segments = s->next;
-      if (s->data) 
+      if (s->data && (! s->spooled)) 
       {
         free(s->data); 
         s->data = NULL;
@@ -224,6 +381,17 @@ int clear_partial(struct partial_bundle *p)
       s = NULL;
     }
 
+    fountain_decoder_free(p->fountain);
+    p->fountain = NULL;
+
+    partial_spool_close(p, 1);
+
+    if (p->bid_prefix)
+    {
+      partial_index_remove(p - partials);
+      free(p->bid_prefix);
+    }
+
     bzero(p, sizeof(struct partial_bundle));
 
   }
@@ -333,6 +501,77 @@ int dump_partial(struct partial_bundle *p)
   return retVal;
 }
 
+/*
+  Make a new segment holding a copy of data, in the partial's spool file if it
+  has one, or otherwise in memory.
+ */
+struct segment_list *partial_segment_new(struct partial_bundle *p, int is_manifest,
+                                         int offset, int bytes, unsigned char *data)
+{
+  struct segment_list *s = calloc(1, sizeof(struct segment_list));
+  assert(s);
+  s->start_offset = offset;
+  s->length = bytes;
+
+  if (p->spool_map && partial_spool_write(p, is_manifest, offset, bytes, data))
+    partial_spool_abandon(p);
+
+  if (p->spool_map)
+  {
+    s->data = partial_spool_ptr(p, is_manifest, offset);
+    s->spooled = 1;
+  }
+  else
+  {
+    s->data = malloc(bytes);
+    assert(s->data);
+    bcopy(data, s->data, bytes);
+  }
+  return s;
+}
+
+/*
+  Add bytes that immediately precede or follow segment s to it.
+ */
+int partial_segment_add_bytes(struct partial_bundle *p, int is_manifest,
+                              struct segment_list *s, int offset, int bytes,
+                              unsigned char *data)
+{
+  if (s->spooled && partial_spool_write(p, is_manifest, offset, bytes, data))
+    partial_spool_abandon(p);
+
+  if (s->spooled)
+  {
+    if (offset < s->start_offset)
+    {
+      s->start_offset = offset;
+      s->data = partial_spool_ptr(p, is_manifest, offset);
+    }
+    s->length += bytes;
+    return 0;
+  }
+
+  int new_length = s->length + bytes;
+  if (offset < s->start_offset)
+  {
+    unsigned char *d = malloc(new_length);
+    assert(d);
+    bcopy(data, d, bytes);
+    bcopy(s->data, &d[bytes], s->length);
+    free(s->data);
+    s->data = d;
+    s->start_offset = offset;
+  }
+  else
+  {
+    s->data = realloc(s->data, new_length);
+    assert(s->data);
+    bcopy(data, &s->data[s->length], bytes);
+  }
+  s->length = new_length;
+  return 0;
+}
+
 int merge_segments(struct segment_list **s)
 {
   int retVal = -1;
@@ -384,22 +623,30 @@ int merge_segments(struct segment_list **s)
           (me->start_offset + me->length) 
           - (next->start_offset + next->length);
 
-        int new_length = next->length + extra_bytes;
-
-        next->data = realloc(next->data,new_length);
-        if (! next->data)
+        if (next->spooled)
         {
-          LOG_ERROR("realloc failed");
-          retVal = -1;
+          // The bytes are already in place in the spool file
+          if (extra_bytes > 0) next->length += extra_bytes;
+        }
+        else
+        {
+          int new_length = next->length + extra_bytes;
+
+          next->data = realloc(next->data,new_length);
+          if (! next->data)
+          {
+            LOG_ERROR("realloc failed");
+            retVal = -1;
+          }
+          assert(next->data);
+
+          bcopy(
+            &me->data[me->length - extra_bytes],
+            &next->data[next->length],
+            extra_bytes);
+
+          next->length = new_length;
         }
-        assert(next->data);
-
-        bcopy(
-          &me->data[me->length - extra_bytes],
-          &next->data[next->length],
-          extra_bytes);
-
-        next->length = new_length;
 
         // Excise redundant segment from list
         *s = next;
@@ -411,7 +658,7 @@ int merge_segments(struct segment_list **s)
 
         // Free redundant segment.
 
-        free(me->data); 
+        if (! me->spooled) free(me->data); 
         me->data=NULL;
 
         free(me); 
@@ -208,6 +208,12 @@ int progress_bitmap_translate(struct peer_state *p,int new_body_offset)
       new_request_bitmap[bit>>3]|=(1<<(bit&7));
   }
   
+  // Fill in any blocks that we know they hold from a run-length progress report
+  for(int bit=0;bit<256;bit++)
+    if (peer_held_map_holds(p,p->request_bitmap_bundle,
+			    new_body_offset+bit*64,new_body_offset+bit*64+64))
+      new_request_bitmap[bit>>3]|=(1<<(bit&7));
+
   p->request_bitmap_offset=new_body_offset;
   memcpy(p->request_bitmap,new_request_bitmap,32);
 
@@ -241,9 +247,39 @@ int dump_peer_tx_bitmap(int peer)
   return 0;
 }
 
+/*
+  Count the active peers that, as far as we know from their request bitmaps,
+  still need the 64 byte block of the body (or manifest) of this bundle that
+  starts at offset.  Everyone hears every piece we send, so we would rather
+  send the blocks that most of them are missing.  Blocks beyond the end of a
+  peer's bitmap are counted as missing, since the bitmap starts at the first
+  block they are missing, unless a run-length progress report says otherwise.
+*/
+static int progress_bitmap_demand(int bundle,int is_manifest,int offset)
+{
+  int demand=0;
+  for(int i=0;i<peer_count;i++) {
+    struct peer_state *p=peer_records[i];
+    if (!p) continue;
+    if (p->request_bitmap_bundle!=bundle) continue;
+    if ((time(0)-p->last_message_time)>peer_keepalive_interval) continue;
+    if (is_manifest) {
+      int block=offset>>6;
+      if (!(p->request_manifest_bitmap[block>>3]&(1<<(block&7)))) demand++;
+    } else {
+      if (offset<p->request_bitmap_offset) continue;
+      int block=(offset-p->request_bitmap_offset)>>6;
+      if (block<32*8) {
+	if (!(p->request_bitmap[block>>3]&(1<<(block&7)))) demand++;
+      } else if (!peer_held_map_holds(p,bundle,offset,offset+64)) demand++;
+    }
+  }
+  return demand;
+}
+
 /*
   Update the point we intend to send from in the current bundle based on the
-  request bitmap.
+  request bitmap, preferring the pieces that the most of our peers want.
  */
 int peer_update_send_point(int peer)
 {
@@ -258,31 +294,36 @@ int peer_update_send_point(int peer)
 
   dump_peer_tx_bitmap(peer);
   
-  // Pick random piece that has yet to be received, and send that
+  // Pick random piece from those that have yet to be received by the most
+  // peers, and send that
 #define MAX_CANDIDATES 32
   int candidates[MAX_CANDIDATES];
   int candidate_count=0;
+  int best_demand=0;
+  int bundle=peer_records[peer]->tx_bundle;
 
   // But limit send point to the valid range of the bundle
   int max_bit=(cached_body_len-peer_records[peer]->request_bitmap_offset)>>6; // = /64
   // (make sure we don't leave out the last piece at the tail)
   if ((cached_body_len-peer_records[peer]->request_bitmap_offset)&63) max_bit++;
-  if (max_bit>=32*8*64) max_bit=32*8*64-1; 
+  // (and to the range of the bitmap)
+  if (max_bit>32*8) max_bit=32*8;
 
   // Search on even boundaries first
-  int i=0; if (peer_records[peer]->request_bitmap_offset&0x40) i=1;
-  for(;i<max_bit;i+=2)
-    if (!(peer_records[peer]->request_bitmap[i>>3]&(1<<(i&7)))) {
+  for(int pass=0;(pass<2)&&(!candidate_count);pass++) {
+    int i=0;
+    if ((!pass)&&(peer_records[peer]->request_bitmap_offset&0x40)) i=1;
+    for(;i<max_bit;i+=(pass?1:2)) {
+      if (peer_records[peer]->request_bitmap[i>>3]&(1<<(i&7))) continue;
       // If the entire bundle has an odd number of pieces, then the last piece
       // is not eligible to be an even boundary.
-      if (i!=(max_bit-1))
-	if (candidate_count<MAX_CANDIDATES) candidates[candidate_count++]=i;
-    }
-  if (!candidate_count) {
-    // No evenly aligned candidates, so include all
-    for(i=0;i<max_bit;i++)
-      if (!(peer_records[peer]->request_bitmap[i>>3]&(1<<(i&7))))
+      if ((!pass)&&(i==(max_bit-1))) continue;
+      int demand=progress_bitmap_demand(bundle,0,
+					peer_records[peer]->request_bitmap_offset+i*64);
+      if (demand<best_demand) continue;
+      if (demand>best_demand) { best_demand=demand; candidate_count=0; }
       if (candidate_count<MAX_CANDIDATES) candidates[candidate_count++]=i;
+    }
   }
   
   if (!candidate_count) {
@@ -292,25 +333,33 @@ int peer_update_send_point(int peer)
       peer_records[peer]->tx_bundle_body_offset
 	=(peer_records[peer]->request_bitmap_offset+(32*8*64));
     }
+    // (skipping over anything they have told us they already hold)
+    peer_records[peer]->tx_bundle_body_offset
+      =peer_held_map_next_missing(peer_records[peer],bundle,
+				  peer_records[peer]->tx_bundle_body_offset);
   } else {
     int candidate=random()%candidate_count;
     int selection=candidates[candidate];
     peer_records[peer]->tx_bundle_body_offset
       =(peer_records[peer]->request_bitmap_offset+(selection*64));
       if (debug_bitmap)
-	printf(">>> %s BITMAP based send point for peer #%d(%s*) = %d (candidate %d/%d = block %d)\n",
+	printf(">>> %s BITMAP based send point for peer #%d(%s*) = %d (candidate %d/%d = block %d, wanted by %d peers)\n",
 	       timestamp_str(),peer,peer_records[peer]->sid_prefix,
 	       peer_records[peer]->tx_bundle_body_offset,
-	       candidate,candidate_count,selection);
+	       candidate,candidate_count,selection,best_demand);
       
   }
 
   // For the manifest, we just have our simple bitmap to go through
   candidate_count=0;
+  best_demand=0;
   for(int i=0;i<(1024/64);i++) {
     if (!(peer_records[peer]->request_manifest_bitmap[i>>3]&(1<<(i&7)))) {
+      int demand=progress_bitmap_demand(bundle,1,i*64);
+      if (demand<best_demand) continue;
+      if (demand>best_demand) { best_demand=demand; candidate_count=0; }
       if (candidate_count<MAX_CANDIDATES)
-	candidates[candidate_count++]=peer_records[peer]->tx_bundle_manifest_offset=i*64;
+	candidates[candidate_count++]=i*64;
     }
   }
   if (!candidate_count)
@@ -73,6 +73,27 @@ int radio_set_type(int radio_type)
   return 0;
 }
 
+/*
+  Each radio type says how big a frame it would like to send, given its per-frame
+  overheads, e.g., the fragmentation of ALE messages, or the handshakes of an ARQ
+  modem.  That can be overridden with the framesize= option, but never beyond what
+  the radio can actually send.
+*/
+int radio_frame_size_override=0;
+
+int radio_frame_size(void)
+{
+  int size=LINK_MTU+FEC_LENGTH;
+  if (radio_get_type()>=0) {
+    radio_type *r=&radio_types[radio_get_type()];
+    if (r->preferred_frame_size) size=r->preferred_frame_size;
+    if (radio_frame_size_override) size=radio_frame_size_override;
+    if (r->max_frame_size&&(size>r->max_frame_size)) size=r->max_frame_size;
+  } else if (radio_frame_size_override) size=radio_frame_size_override;
+  if (size>FEC_MAX_BYTES+FEC_LENGTH) size=FEC_MAX_BYTES+FEC_LENGTH;
+  return size;
+}
+
 int radio_set_feature(int bitmask)
 {
   radio_features|=bitmask;
@@ -105,30 +126,224 @@ int radio_read_bytes(int serialfd,int monitor_mode)
 }
 
 
+/*
+  Adaptive FEC.
+  By default every packet carries 32 bytes of RS(255,223) parity, which can correct
+  up to 16 byte errors, of which we accept up to 7 to keep the risk of false decodes
+  negligible.  Clean links don't need that much, and noisy links need more, so we
+  also support:
+
+  - Sending only the first 8 or 16 parity bytes. The receiver treats the missing
+    parity bytes as erasures, so these are simply weaker versions of the same code.
+  - Splitting the packet between two codewords, each with the full 32 bytes of
+    parity, with the bytes interleaved so that error bursts are shared between them.
+
+  Packets at other than the default level carry a trailing byte that says which
+  level was used. These bytes are far enough apart to survive a single bit error.
+  Default level packets have no trailer, so they are exactly as before, and we only
+  use the other levels when all our active peers have asked for them.
+
+  A default level packet can end in a byte that looks like a trailer. Because a
+  shifted RS codeword is still a codeword, such a packet would decode perfectly
+  well as a punctured packet, just with the wrong length.  To prevent this, the
+  codewords of the other levels begin with the trailer byte, which is not sent, but
+  which must still be intact after decoding.
+*/
+struct fec_level {
+  // parity bytes per codeword that are actually sent
+  int parity_bytes;
+  int codewords;
+  unsigned char trailer;
+  // reject a codeword needing this many or more corrections
+  int max_errors;
+};
+
+struct fec_level fec_levels[FEC_LEVEL_COUNT]={
+  {8,1,0x5a,2},       // FEC_LEVEL_LIGHTEST
+  {16,1,0xa5,4},      // FEC_LEVEL_LIGHT
+  {FEC_LENGTH,1,0,8}, // FEC_LEVEL_DEFAULT
+  {FEC_LENGTH,2,0x3c,8} // FEC_LEVEL_HEAVY
+};
+
+int fec_level_tx=FEC_LEVEL_DEFAULT;
+
+/*
+  Golay protected packet headers.
+  If a packet fails RS decoding, we don't even know who sent it, and so can't count
+  it against the link from that peer.  So, once all our active peers have said they
+  understand them, we follow the FEC protected packet with a short header that is
+  protected on its own by two [24,12] Golay codewords, each of which can correct 3
+  bit errors:
+
+  12 bits : first byte of sender SID + low 4 bits of message counter
+  12 bits : high 4 bits of low byte of message counter + length of whole packet
+
+  The length lets us tell this apart from the end of a packet without a header,
+  and a packet without a header is always tried as such if decoding with the
+  header removed fails.
+*/
+int golay_header_tx=0;
+int compressed_pieces_tx=0;
+int progress_runs_tx=0;
+
+int golay_header_encode(unsigned char *packet,int packet_bytes,unsigned char *out)
+{
+  out[0]=packet[0];
+  out[1]=packet[6]&0xf;
+  out[2]=0;
+  out[3]=(packet[6]>>4)|((packet_bytes&0xf)<<4);
+  out[4]=(packet_bytes>>4)&0xf;
+  out[5]=0;
+  golay_encode(&out[0]);
+  golay_encode(&out[3]);
+  return GOLAY_HEADER_LEN;
+}
+
+// Returns 0 if the last bytes of the packet are a valid header for it.
+int golay_header_decode(unsigned char *packet,int packet_bytes,
+			unsigned char *sid_fragment,int *counter_low)
+{
+  if (packet_bytes<=GOLAY_HEADER_LEN) return -1;
+  unsigned char h[GOLAY_HEADER_LEN];
+  bcopy(&packet[packet_bytes-GOLAY_HEADER_LEN],h,GOLAY_HEADER_LEN);
+  int errs_a,errs_b;
+  int a=golay_decode(&errs_a,&h[0]);
+  int b=golay_decode(&errs_b,&h[3]);
+  // Four or more bit errors are detected, but can't be corrected
+  if ((errs_a>3)||(errs_b>3)) return -1;
+  if ((b>>4)!=packet_bytes) return -1;
+  *sid_fragment=a&0xff;
+  *counter_low=(a>>8)|((b&0xf)<<4);
+  return 0;
+}
+
+// Largest packet body that fits in a frame of the radio's preferred size using
+// this level
+int fec_max_data_bytes(int level)
+{
+  struct fec_level *l=&fec_levels[level];
+  int max=radio_frame_size()-l->parity_bytes*l->codewords-(l->trailer?1:0);
+  if (golay_header_tx) max-=GOLAY_HEADER_LEN;
+  if (max>MAX_LINK_MTU) max=MAX_LINK_MTU;
+  return max;
+}
+
+int fec_level_from_trailer(unsigned char trailer)
+{
+  for(int level=0;level<FEC_LEVEL_COUNT;level++) {
+    if (!fec_levels[level].trailer) continue;
+    unsigned char diff=trailer^fec_levels[level].trailer;
+    // Allow a single bit error
+    if (!(diff&(diff-1))) return level;
+  }
+  return FEC_LEVEL_DEFAULT;
+}
+
+int fec_encode_packet(int level,unsigned char *data,int length,unsigned char *out)
+{
+  struct fec_level *l=&fec_levels[level];
+  unsigned char block[1+FEC_MAX_BYTES];
+  unsigned char parity[FEC_LENGTH];
+
+  bcopy(data,out,length);
+  for(int c=0;c<l->codewords;c++) {
+    // Codeword c carries every l->codewords-th byte of the packet body, and
+    // similarly for the parity that follows it.
+    int n=0;
+    if (l->trailer) block[n++]=l->trailer;
+    for(int i=c;i<length;i+=l->codewords) block[n++]=data[i];
+    encode_rs_8(block,parity,FEC_MAX_BYTES-n);
+    for(int i=0;i<l->parity_bytes;i++) out[length+i*l->codewords+c]=parity[i];
+  }
+  int offset=length+l->parity_bytes*l->codewords;
+  if (l->trailer) out[offset++]=l->trailer;
+  return offset;
+}
+
+// Correct the packet in place, and return the number of byte errors corrected,
+// or -1 if it could not be corrected.
+int fec_decode_packet(int level,unsigned char *packet,int packet_bytes,int *data_length)
+{
+  struct fec_level *l=&fec_levels[level];
+  unsigned char block[FEC_MAX_BYTES+FEC_LENGTH];
+  int eras_pos[FEC_LENGTH];
+  int length=packet_bytes-l->parity_bytes*l->codewords-(l->trailer?1:0);
+  int errors=0;
+
+  if (length<0) return -1;
+  
+  for(int c=0;c<l->codewords;c++) {
+    int n=0;
+    if (l->trailer) block[n++]=l->trailer;
+    for(int i=c;i<length;i+=l->codewords) block[n++]=packet[i];
+    if (n>FEC_MAX_BYTES) return -1;
+    int pad=FEC_MAX_BYTES-n;
+    int no_eras=0;
+    for(int i=0;i<FEC_LENGTH;i++) {
+      if (i<l->parity_bytes) block[n+i]=packet[length+i*l->codewords+c];
+      else {
+	// Parity byte that wasn't sent
+	block[n+i]=0;
+	eras_pos[no_eras++]=pad+n+i;
+      }
+    }
+    int count=decode_rs_8(block,no_eras?eras_pos:NULL,no_eras,pad);
+    if (count<0) return -1;
+    // The erasures are counted as corrections, but they aren't errors
+    count-=no_eras;
+    if (count<0) count=0;
+    if (count>=l->max_errors) return -1;
+    if (l->trailer&&(block[0]!=l->trailer)) return -1;
+    errors+=count;
+    n=l->trailer?1:0;
+    for(int i=c;i<length;i+=l->codewords) packet[i]=block[n++];
+  }
+
+  *data_length=length;
+  return errors;
+}
+
+// Work out which FEC level the packet was sent with, and decode it, returning the
+// number of byte errors corrected, or -1 if it could not be corrected.
+int fec_decode_any_level(unsigned char *packet_data,int packet_bytes,int *data_length)
+{
+  int rs_error_count=-1;
+  int level=FEC_LEVEL_DEFAULT;
+  if (packet_bytes>0) level=fec_level_from_trailer(packet_data[packet_bytes-1]);
+  if (level!=FEC_LEVEL_DEFAULT) {
+    // Try the level indicated by the trailer, but the trailer might just be a
+    // parity byte of a default level packet, so try that if it fails.
+    unsigned char trial[packet_bytes];
+    bcopy(packet_data,trial,packet_bytes);
+    rs_error_count=fec_decode_packet(level,trial,packet_bytes,data_length);
+    if (rs_error_count>=0) bcopy(trial,packet_data,packet_bytes);
+  }
+  if (rs_error_count<0)
+    rs_error_count=fec_decode_packet(FEC_LEVEL_DEFAULT,packet_data,packet_bytes,
+				     data_length);
+  return rs_error_count;
+}
+
 int radio_send_message(int serialfd, unsigned char *buffer,int length)
 {
   unsigned char out[3+FEC_MAX_BYTES+FEC_LENGTH+3];
   int offset=0;
 
   // Encapsulate message in Reed-Solomon wrapper and send.
-  unsigned char parity[FEC_LENGTH];
-
-  // Calculate RS parity
   if (length>FEC_MAX_BYTES||length<0) {
     printf("%s(): Asked to send packet of illegal length"
 	    " (asked for %d, valid range is 0 -- %d)\n",
 	    __FUNCTION__,length,FEC_MAX_BYTES);
     return -1;
   }
-  encode_rs_8(buffer,parity,FEC_MAX_BYTES-length);
-  
-  // Then, the packet body
-  bcopy(buffer,&out[offset],length);
-  offset+=length;
 
-  // Next comes the RS parity bytes
-  bcopy(parity,&out[offset],FEC_LENGTH);
-  offset+=FEC_LENGTH;
+  // Fall back to the default FEC level if the packet won't fit at the chosen level
+  int level=fec_level_tx;
+  if (length>fec_max_data_bytes(level)) level=FEC_LEVEL_DEFAULT;
+  
+  offset=fec_encode_packet(level,buffer,length,out);
+  if (golay_header_tx&&(length<=fec_max_data_bytes(level))&&(length>=8))
+    offset+=golay_header_encode(buffer,offset+GOLAY_HEADER_LEN,&out[offset]);
 
   if (debug_radio_tx) {
     dump_bytes(stdout,"sending packet",buffer,offset);
@@ -147,6 +362,131 @@ int radio_send_message(int serialfd, unsigned char *buffer,int length)
   return 0;
 }
 
+// Update our view of how well we are hearing this peer, and so the FEC level we
+// would like them to use.  rs_error_count is -1 for a packet that we could only
+// attribute to them from its Golay protected header.
+static int fec_update_peer(struct peer_state *p,int rs_error_count)
+{
+  // Averages are fixed point, x256, decaying by 1/8 per packet
+  int missed=p->missed_packet_count-p->fec_missed_packets_seen;
+  // (the missed packet count gets reset from the status page)
+  if (missed<0||missed>16) missed=0;
+  p->fec_missed_packets_seen=p->missed_packet_count;
+  for(int i=0;i<missed;i++) p->fec_loss_average+=(256-p->fec_loss_average)>>3;
+  if (rs_error_count>=0) {
+    p->fec_loss_average-=p->fec_loss_average>>3;
+    p->fec_error_average+=((rs_error_count<<8)-p->fec_error_average)/8;
+    p->packets_seen++;
+  }
+
+  int level;
+  if ((p->fec_loss_average>64)||(p->fec_error_average>=(3<<8)))
+    // Losing more than 1 in 4 packets, or needing more than a few corrections
+    level=FEC_LEVEL_HEAVY;
+  else if ((p->packets_seen<16)||(p->fec_loss_average>16)||(p->fec_error_average>256))
+    level=FEC_LEVEL_DEFAULT;
+  else if (p->fec_error_average>32)
+    level=FEC_LEVEL_LIGHT;
+  else
+    level=FEC_LEVEL_LIGHTEST;
+
+  if (level!=p->fec_level_wanted&&debug_radio)
+    printf(">>> %s Would like %s* to use FEC level %d (errors=%d/256, loss=%d/256)\n",
+	   timestamp_str(),p->sid_prefix,level,
+	   p->fec_error_average,p->fec_loss_average);
+  p->fec_level_wanted=level;
+  return 0;
+}
+
+int fec_note_received_packet(unsigned char *packet_data,int rs_error_count)
+{
+  char peer_prefix[6*2+1];
+  snprintf(peer_prefix,6*2+1,"%02x%02x%02x%02x%02x%02x",
+	   packet_data[0],packet_data[1],packet_data[2],
+	   packet_data[3],packet_data[4],packet_data[5]);
+  int peer=find_peer_by_prefix(peer_prefix);
+  if (peer<0) return -1;
+  return fec_update_peer(peer_records[peer],rs_error_count);
+}
+
+// Count a packet that failed RS decoding against the peer named in its Golay
+// protected header, as though it had not been received at all.
+int fec_note_failed_packet(unsigned char sid_fragment,int counter_low)
+{
+  struct peer_state *p=NULL;
+  for(int i=0;i<peer_count;i++) {
+    if (!peer_records[i]) continue;
+    if ((time(0)-peer_records[i]->last_message_time)>peer_keepalive_interval) continue;
+    if (peer_records[i]->sid_prefix_bin[0]!=sid_fragment) continue;
+    // Packets from older versions can end in bytes that happen to look like a
+    // header, so only blame peers that have told us that they send them.
+    if ((time(0)-peer_records[i]->golay_header_time)>FEC_REQUEST_TIMEOUT) continue;
+    // Don't guess if more than one active peer matches
+    if (p) return -1;
+    p=peer_records[i];
+  }
+  if (!p) return -1;
+
+  p->fec_failed_packet_count++;
+  if (p->last_message_number>=0) {
+    // Work out the full (15 bit) message counter, which must be after the last
+    // one we saw
+    int counter=(p->last_message_number&0x7f00)|counter_low;
+    if (counter<=p->last_message_number) counter=(counter+0x100)&0x7fff;
+    // Count it and anything between as missed, so that the next packet we
+    // decode doesn't count them again.  As in saw_message(), we don't count
+    // across the counter wrapping around.
+    if (counter>p->last_message_number)
+      p->missed_packet_count+=counter-p->last_message_number;
+    p->last_message_number=counter;
+  }
+
+  if (debug_radio)
+    printf(">>> %s Packet from %s* failed FEC decoding (message #%d)\n",
+	   timestamp_str(),p->sid_prefix,p->last_message_number);
+  return fec_update_peer(p,-1);
+}
+
+// We broadcast, so we have to use the strongest FEC level wanted by any of our
+// active peers.  Peers that have not asked for a level, e.g., because they are
+// running an older version of LBARD, get the default level.  Similarly, we only
+// add Golay protected headers, or use compressed piece headers or run-length
+// progress reports, if all of them understand them.
+int fec_choose_tx_level(void)
+{
+  int level=FEC_LEVEL_LIGHTEST;
+  int active_peers=0;
+  int headers_understood=1;
+  int compressed_understood=1;
+  int runs_understood=1;
+
+  for(int i=0;i<peer_count;i++) {
+    struct peer_state *p=peer_records[i];
+    if (!p) continue;
+    if ((time(0)-p->last_message_time)>peer_keepalive_interval) continue;
+    active_peers++;
+    if ((time(0)-p->golay_header_time)>FEC_REQUEST_TIMEOUT) headers_understood=0;
+    if ((time(0)-p->compressed_pieces_time)>FEC_REQUEST_TIMEOUT)
+      compressed_understood=0;
+    if ((time(0)-p->progress_runs_time)>FEC_REQUEST_TIMEOUT) runs_understood=0;
+    int wanted=FEC_LEVEL_DEFAULT;
+    if ((time(0)-p->fec_level_request_time)<=FEC_REQUEST_TIMEOUT)
+      wanted=p->fec_level_requested;
+    if (wanted>level) level=wanted;
+  }
+  
+  if ((!active_peers)||(option_flags&FLAG_NO_ADAPTIVE_FEC)) level=FEC_LEVEL_DEFAULT;
+  golay_header_tx=active_peers&&headers_understood
+    &&(!(option_flags&FLAG_NO_ADAPTIVE_FEC));
+  compressed_pieces_tx=active_peers&&compressed_understood;
+  progress_runs_tx=active_peers&&runs_understood;
+
+  if (level!=fec_level_tx&&debug_radio)
+    printf(">>> %s Switching to FEC level %d\n",timestamp_str(),level);
+  fec_level_tx=level;
+  return level;
+}
+
 int radio_receive_bytes(unsigned char *bytes,int count,int monitor_mode)
 {
   int i,j;
@@ -183,8 +523,22 @@ int saw_packet(unsigned char *packet_data,int packet_bytes,int rssi,
 {
   if (debug_radio) dump_bytes(stdout,"packet before decode_rs",packet_data,packet_bytes);
   
-  int rs_error_count = decode_rs_8(packet_data,NULL,0,
-				   FEC_MAX_BYTES-packet_bytes+FEC_LENGTH);
+  int data_length=0;
+  int rs_error_count=-1;
+
+  // If the packet ends in a Golay protected header, try decoding without it first.
+  unsigned char header_sid_fragment=0;
+  int header_counter=0;
+  int have_header=!golay_header_decode(packet_data,packet_bytes,
+				       &header_sid_fragment,&header_counter);
+  if (have_header) {
+    unsigned char trial[packet_bytes];
+    bcopy(packet_data,trial,packet_bytes);
+    rs_error_count=fec_decode_any_level(trial,packet_bytes-GOLAY_HEADER_LEN,&data_length);
+    if (rs_error_count>=0) bcopy(trial,packet_data,packet_bytes);
+  }
+  if (rs_error_count<0)
+    rs_error_count=fec_decode_any_level(packet_data,packet_bytes,&data_length);
   
   if (debug_radio) dump_bytes(stdout,"received packet",packet_data,packet_bytes);
 
@@ -197,13 +551,15 @@ int saw_packet(unsigned char *packet_data,int packet_bytes,int rssi,
     return -1;
   }
   
-  if (rs_error_count>=0&&rs_error_count<8) {
+  if (rs_error_count>=0) {
     if (0) printf("CHECKPOINT: %s:%d %s() error counts = %d for packet of %d bytes.\n",
 		  __FILE__,__LINE__,__FUNCTION__,
 		  rs_error_count,packet_bytes);
     
-    saw_message(packet_data,packet_bytes-FEC_LENGTH,rssi,
+    saw_message(packet_data,data_length,rssi,
 		my_sid_hex,prefix,servald_server,credential);
+
+    fec_note_received_packet(packet_data,rs_error_count);
     
     // attach presumed SID prefix
     if (debug_radio) {
@@ -226,6 +582,8 @@ int saw_packet(unsigned char *packet_data,int packet_bytes,int rssi,
       }
     return 0;
   } else {
+    // We can't use the packet, but we might at least know who sent it
+    if (have_header) fec_note_failed_packet(header_sid_fragment,header_counter);
     if (debug_radio) {
       if (message_buffer_length) message_buffer_length--; // chop NL
       message_buffer_length+=
@@ -0,0 +1,207 @@
+/*
+Serval Low-bandwidth asychronous Rhizome Demonstrator.
+Copyright (C) 2016 Serval Project Inc.
+
+This program monitors a local Rhizome database and attempts
+to synchronise it over low-bandwidth declarative transports,
+such as bluetooth name or wifi-direct service information
+messages.  It is intended to give a high priority to MeshMS
+converations among nearby nodes.
+
+The design is fully asynchronous, so a call to the update_my_message()
+function from time to time should be all that is required.
+
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+  The queue of reports (acknowledgements, progress bitmaps and BARs) that we
+  want to send.
+
+  Reports are keyed by the peer they are for, the bundle they are about and their
+  type, and a new report replaces any queued report with the same key, since
+  only the most recent progress is of any use to the sender.  Progress bitmaps
+  and BARs are heard by everyone, so are keyed only by bundle and type.  Once we
+  have a bundle, there is no point telling anyone how much of it we are still
+  missing, so queuing a BAR also drops any acknowledgements and bitmaps for that
+  bundle.
+
+  When the queue is full, the lowest priority report is dropped, oldest first.
+  The packer (see packer.c) sends reports in order of priority, and we count the
+  bytes that are replaced, dropped or sent, so that we can see how much of each
+  packet they take up.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+
+#include "sync.h"
+#include "lbard.h"
+
+int report_queue_length=0;
+uint8_t report_queue[REPORT_QUEUE_LEN][MAX_REPORT_LEN];
+uint8_t report_lengths[REPORT_QUEUE_LEN];
+struct peer_state *report_queue_peers[REPORT_QUEUE_LEN];
+int report_queue_partials[REPORT_QUEUE_LEN];
+char *report_queue_message[REPORT_QUEUE_LEN];
+int report_queue_types[REPORT_QUEUE_LEN];
+unsigned char report_queue_bids[REPORT_QUEUE_LEN][8];
+// Order in which the reports were queued, so that we drop the oldest first
+unsigned int report_queue_sequence[REPORT_QUEUE_LEN];
+unsigned int report_queue_next_sequence=0;
+
+long long report_bytes_sent=0;
+long long report_bytes_superseded=0;
+long long report_bytes_evicted=0;
+long long report_bytes_stale=0;
+
+int report_type_priority(int type)
+{
+  switch(type) {
+  case REPORT_TYPE_ACK: return 3;
+  case REPORT_TYPE_BAR: return 2;
+  case REPORT_TYPE_BITMAP: return 1;
+  }
+  return 0;
+}
+
+static int report_type_is_broadcast(int type)
+{
+  return (type==REPORT_TYPE_BITMAP)||(type==REPORT_TYPE_BAR);
+}
+
+static void report_queue_remove(int slot)
+{
+  free(report_queue_message[slot]);
+  report_queue_message[slot]=NULL;
+  report_queue_length--;
+  if (slot==report_queue_length) return;
+  bcopy(report_queue[report_queue_length],report_queue[slot],
+	report_lengths[report_queue_length]);
+  report_lengths[slot]=report_lengths[report_queue_length];
+  report_queue_peers[slot]=report_queue_peers[report_queue_length];
+  report_queue_partials[slot]=report_queue_partials[report_queue_length];
+  report_queue_message[slot]=report_queue_message[report_queue_length];
+  report_queue_message[report_queue_length]=NULL;
+  report_queue_types[slot]=report_queue_types[report_queue_length];
+  bcopy(report_queue_bids[report_queue_length],report_queue_bids[slot],8);
+  report_queue_sequence[slot]=report_queue_sequence[report_queue_length];
+}
+
+int report_queue_slot(int peer,unsigned char *bid_prefix_bin,int type,int partial,
+		      char *description)
+{
+  int slot=-1;
+
+  if (type==REPORT_TYPE_BAR) {
+    // We have the bundle now, so don't tell anyone what we are missing of it
+    for(int i=report_queue_length-1;i>=0;i--)
+      if ((report_queue_types[i]!=REPORT_TYPE_BAR)
+	  &&(!memcmp(report_queue_bids[i],bid_prefix_bin,8))) {
+	report_bytes_superseded+=report_lengths[i];
+	report_queue_remove(i);
+      }
+  }
+
+  for(int i=0;i<report_queue_length;i++) {
+    if (report_queue_types[i]!=type) continue;
+    if (memcmp(report_queue_bids[i],bid_prefix_bin,8)) continue;
+    if ((!report_type_is_broadcast(type))
+	&&(report_queue_peers[i]!=peer_records[peer])) continue;
+    slot=i;
+    report_bytes_superseded+=report_lengths[i];
+    break;
+  }
+
+  if ((slot==-1)&&(report_queue_length>=REPORT_QUEUE_LEN)) {
+    // Drop the oldest of the lowest priority reports, unless they are all more
+    // important than this one.
+    int victim=0;
+    for(int i=1;i<report_queue_length;i++) {
+      int pi=report_type_priority(report_queue_types[i]);
+      int pv=report_type_priority(report_queue_types[victim]);
+      if ((pi<pv)||((pi==pv)&&(report_queue_sequence[i]<report_queue_sequence[victim])))
+	victim=i;
+    }
+    if (report_type_priority(report_queue_types[victim])>report_type_priority(type)) {
+      if (!monitor_mode)
+	fprintf(stderr,"Report queue is full, so not queuing '%s'\n",description);
+      return -1;
+    }
+    if (!monitor_mode)
+      fprintf(stderr,"Report queue is full, so dropping report_queue message '%s'\n",
+	      report_queue_message[victim]?report_queue_message[victim]:"<none>");
+    report_bytes_evicted+=report_lengths[victim];
+    report_queue_remove(victim);
+  }
+
+  if (slot==-1) slot=report_queue_length++;
+
+  if (!monitor_mode) {
+    if (report_queue_message[slot])
+      fprintf(stderr,"Replacing report_queue message '%s' with '%s'\n",
+	      report_queue_message[slot],description);
+    else
+      fprintf(stderr,"Setting report_queue message to '%s'\n",description);
+  }
+  free(report_queue_message[slot]);
+  report_queue_message[slot]=strdup(description);
+
+  // Mark utilisation of slot, so that we can flush out stale messages
+  report_queue_partials[slot]=partial;
+  report_queue_peers[slot]=peer_records[peer];
+  report_queue_types[slot]=type;
+  bcopy(bid_prefix_bin,report_queue_bids[slot],8);
+  report_queue_sequence[slot]=report_queue_next_sequence++;
+  report_lengths[slot]=0;
+
+  return slot;
+}
+
+int report_queue_is_stale(int slot)
+{
+  // Progress reports about a partial bundle that we have since finished with
+  int partial=report_queue_partials[slot];
+  if (partial<0) return 0;
+  if (!partials[partial].bid_prefix) return 1;
+  char bid_hex[8*2+1];
+  snprintf(bid_hex,8*2+1,"%02x%02x%02x%02x%02x%02x%02x%02x",
+	   report_queue_bids[slot][0],report_queue_bids[slot][1],
+	   report_queue_bids[slot][2],report_queue_bids[slot][3],
+	   report_queue_bids[slot][4],report_queue_bids[slot][5],
+	   report_queue_bids[slot][6],report_queue_bids[slot][7]);
+  return strncasecmp(partials[partial].bid_prefix,bid_hex,8*2)?1:0;
+}
+
+// Remove the reports we have sent (or found to be stale) from the queue
+int report_queue_remove_sent(int *sent)
+{
+  for(int i=report_queue_length-1;i>=0;i--) {
+    if (!sent[i]) continue;
+    if (sent[i]>0) report_bytes_sent+=report_lengths[i];
+    else report_bytes_stale+=report_lengths[i];
+    report_queue_remove(i);
+  }
+  return 0;
+}
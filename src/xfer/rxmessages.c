@@ -87,15 +87,18 @@ int saw_message(unsigned char *msg,int len,int rssi,char *my_sid,
     p->last_message_number=-1;
     p->tx_bundle=-1;
     p->request_bitmap_bundle=-1;
+    p->held_map_bundle=-1;
     printf("Registering peer %s*\n",p->sid_prefix);
     if (peer_count<MAX_PEERS) {
-      peer_records[peer_count++]=p;      
+      peer_index=peer_count;
+      peer_records[peer_count++]=p;
     } else {
       // Peer table full.  Do random replacement.
       peer_index=random()%MAX_PEERS;
       free_peer(peer_records[peer_index]);
       peer_records[peer_index]=p;
     }
+    bundle_priority_peer_changed(p->sid_prefix);
   }
   
   // Update time stamp and most recent message from peer
@@ -106,6 +109,7 @@ int saw_message(unsigned char *msg,int len,int rssi,char *my_sid,
     p->missed_packet_count+=msg_number-p->last_message_number-1;
   }
   p->last_message_time=time(0);
+  peer_note_heard(peer_index);
   if (!is_retransmission) p->last_message_number=msg_number;
 
   // Update RSSI log for this sender
@@ -137,6 +137,10 @@ int update_my_message(int serialfd,
   // Build output message
 
   if (mtu<64) return -1;
+
+  // Stronger FEC levels leave less room in each packet
+  fec_choose_tx_level();
+  if (mtu>fec_max_data_bytes(fec_level_tx)) mtu=fec_max_data_bytes(fec_level_tx);
   
   // Clear message
   bzero(msg_out,mtu);
@@ -153,6 +157,7 @@ int update_my_message(int serialfd,
 
   int offset=8;
 
+#ifdef SYNC_BY_BAR
   if (!(random()%10)) {
     // Occassionally announce our time
 
@@ -163,7 +168,6 @@ int update_my_message(int serialfd,
     append_generationid(msg_out,&offset);
   }
   
-#ifdef SYNC_BY_BAR
   // Put one or more BARs
   int bar_number=find_highest_priority_bar();
   if (bundle_count&&((mtu-offset)>=BAR_LENGTH)) {
@@ -188,14 +192,22 @@ int update_my_message(int serialfd,
      know from the sync process.
      Basically we need to iterate through the peers and pick who to respond to.
      We also need the sequence numbers to be recipient specific.
+     See src/xfer/packer.c for how we choose what goes in each packet.
   */
-  sync_by_tree_stuff_packet(&offset,mtu,msg_out,
+  // Occassionally tell a peer which FEC level we would like them to use.
+  // This goes at the end of the packet, because older versions of LBARD stop
+  // parsing a packet when they see a message type they don't know.
+  int fec_request=(!(option_flags&FLAG_NO_ADAPTIVE_FEC))&&(!(random()%4));
+  sync_by_tree_stuff_packet(&offset,fec_request?mtu-FEC_LEVEL_REQUEST_LEN:mtu,msg_out,
 			    my_sid_hex,servald_server,credential);
+  if (fec_request) append_fec_level_request(msg_out,&offset,mtu);
 #endif
 
   // Increment message counter
   message_counter++;
 
+  packet_note_fill(offset,mtu);
+
   if (0) { 
     printf("This message (hex): ");
     for(int i=0;i<offset;i++) printf("%02x",msg_out[i]);